@@ -0,0 +1,556 @@
+#include "ft_ping.h"
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+/* Benchmarks of the hot paths, linked against the objects of ft_ping. Each
+ * result is a JSON Lines record with fixed keys so that the runs of two
+ * commits can be diffed or joined on bench/case/metric. */
+
+_Thread_local struct s_ping g_ping;
+
+#define BENCH_RUNS 5
+#define BENCH_MIN_NSEC 50000000L
+#define BENCH_E2E_COUNT 100000
+#define BENCH_BASELINE_COUNT 20000
+
+static const char *g_rev = "";
+static volatile uint64_t g_sink;
+
+static void
+show_usage_and_exit (int exit_code)
+{
+    printf ("\
+Usage: ft_ping_bench [OPTION]...\n\
+Options :\n\
+  -h, --help         display this help and exit\n\
+  -x, --exec <path>  ft_ping to run the loopback benchmarks with, skipped if\n\
+                     not given\n\
+  -c, --count        requests sent by each loopback benchmark\n\
+  -r, --rev <label>  revision recorded in every result\n");
+    exit (exit_code);
+}
+
+static void
+report (const char *bench, const char *name, const char *metric, double value,
+        const char *unit)
+{
+    printf ("{\"rev\":\"%s\",\"bench\":\"%s\",\"case\":\"%s\",\"metric\":\"%s\","
+            "\"value\":%.3f,\"unit\":\"%s\"}\n",
+            g_rev, bench, name, metric, value, unit);
+    fflush (stdout);
+}
+
+static int64_t
+elapsed_nsec (const struct timespec *start, const struct timespec *end)
+{
+    return (end->tv_sec - start->tv_sec) * 1000000000L
+           + (end->tv_nsec - start->tv_nsec);
+}
+
+static int
+double_cmp (const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Times a micro benchmark. The number of iterations is doubled until
+ * a run lasts BENCH_MIN_NSEC, then BENCH_RUNS runs are timed and the median
+ * is reported, which is what stays stable from one run to the next.
+ * @param fn body of the benchmark, runs the given number of iterations
+ */
+
+static void
+bench_run (const char *bench, const char *name, void (*fn) (uint64_t))
+{
+    struct timespec start;
+    struct timespec end;
+    double runs[BENCH_RUNS];
+    uint64_t iterations = 1;
+
+    for (;;)
+    {
+        clock_gettime (CLOCK_MONOTONIC, &start);
+        fn (iterations);
+        clock_gettime (CLOCK_MONOTONIC, &end);
+        if (elapsed_nsec (&start, &end) >= BENCH_MIN_NSEC)
+        {
+            break;
+        }
+        iterations *= 2;
+    }
+
+    for (int i = 0; i < BENCH_RUNS; ++i)
+    {
+        clock_gettime (CLOCK_MONOTONIC, &start);
+        fn (iterations);
+        clock_gettime (CLOCK_MONOTONIC, &end);
+        runs[i] = (double)elapsed_nsec (&start, &end) / iterations;
+    }
+    qsort (runs, BENCH_RUNS, sizeof (double), double_cmp);
+    report (bench, name, "ns_per_op", runs[BENCH_RUNS / 2], "ns");
+}
+
+static uint8_t g_data[1500];
+
+static void
+bench_checksum_64 (uint64_t n)
+{
+    for (uint64_t i = 0; i < n; ++i)
+    {
+        g_sink += ping_checksum (g_data, 64);
+    }
+}
+
+static void
+bench_checksum_1500 (uint64_t n)
+{
+    for (uint64_t i = 0; i < n; ++i)
+    {
+        g_sink += ping_checksum (g_data, sizeof (g_data));
+    }
+}
+
+static void
+bench_verify_checksum (uint64_t n)
+{
+    for (uint64_t i = 0; i < n; ++i)
+    {
+        g_sink += verify_checksum (g_ping.batch->tmpl_v4,
+                                   g_ping.batch->pkt_size);
+    }
+}
+
+static void
+bench_fill_v4 (uint64_t n)
+{
+    struct timespec sent = { 0 };
+
+    for (uint64_t i = 0; i < n; ++i)
+    {
+        sent.tv_nsec = i;
+        fill_icmp_packet_v4 (g_ping.batch->snd_iov[0].iov_base, (uint16_t)i,
+                             &sent);
+    }
+}
+
+static void
+bench_fill_v6 (uint64_t n)
+{
+    struct timespec sent = { 0 };
+
+    for (uint64_t i = 0; i < n; ++i)
+    {
+        sent.tv_nsec = i;
+        fill_icmp_packet_v6 (g_ping.batch->snd_iov[0].iov_base, (uint16_t)i,
+                             &sent);
+    }
+}
+
+/**
+ * @brief The work done by the receive path for an Echo Reply on a raw IPv4
+ * socket once recvmmsg() returned: header walk, checksum, probe match,
+ * metrics and payload check. Each iteration sends a probe and answers it
+ * with the reply built from its request.
+ */
+
+static void
+bench_reply (uint64_t n)
+{
+    struct s_batch *batch = g_ping.batch;
+    uint8_t *packet = batch->rcv_iov[0].iov_base;
+    struct iphdr *ip_hdr = (struct iphdr *)packet;
+    struct icmphdr *reply = (struct icmphdr *)(packet + sizeof (*ip_hdr));
+    uint8_t should_be;
+
+    memset (ip_hdr, 0, sizeof (*ip_hdr));
+    ip_hdr->ihl = sizeof (*ip_hdr) / 4;
+    ip_hdr->ttl = 64;
+
+    for (uint64_t i = 0; i < n; ++i)
+    {
+        uint64_t sequence = ++g_ping.stats.nb_snd;
+        struct s_probe *probe = start_rtt_metrics (sequence, 0, 0);
+        struct icmphdr *icmp_hdr;
+        struct s_probe *match;
+        uint32_t sum;
+
+        /* The reply is the request with its type changed, the checksum is
+         * adjusted as a responder does. */
+
+        fill_icmp_packet_v4 ((struct ping_packet_v4 *)reply,
+                             (uint16_t)sequence, &probe->sent);
+        reply->type = ICMP_ECHOREPLY;
+        sum = reply->checksum + htons (ICMP_ECHO << 8);
+        reply->checksum = (sum & 0xffff) + (sum >> 16);
+
+        icmp_hdr = (struct icmphdr *)(packet + ip_hdr->ihl * 4);
+        if (verify_checksum (icmp_hdr, batch->pkt_size) == false
+            || icmp_hdr->type != ICMP_ECHOREPLY
+            || (match = probe_lookup (ntohs (icmp_hdr->un.echo.sequence)))
+                   == NULL)
+        {
+            fprintf (stderr, "reply benchmark: reply not matched\n");
+            exit (EXIT_FAILURE);
+        }
+        end_rtt_metrics (match, &match->sent, NULL);
+        g_sink += payload_mismatch (match, (const uint8_t *)(icmp_hdr + 1),
+                                    g_ping.options.datalen, IPV4, &should_be);
+    }
+}
+
+static void
+bench_rtt_stats (uint64_t n)
+{
+    for (uint64_t i = 0; i < n; ++i)
+    {
+        compute_rtt_stats (&g_ping.targets[0]);
+        g_sink += g_ping.targets[0].stats.percentiles[2] > 0;
+    }
+}
+
+/**
+ * @brief Sets up the context of a single IPv4 target as a session does,
+ * without any socket.
+ */
+
+static void
+micro_init ()
+{
+    ping_init_g_info ();
+    g_ping.options.flood = true;
+    g_ping.nb_targets = 1;
+    g_ping.targets_size = 1;
+    if ((g_ping.targets = calloc (1, sizeof (struct s_target))) == NULL)
+    {
+        perror ("calloc");
+        exit (EXIT_FAILURE);
+    }
+    g_ping.targets[0].ipv = IPV4;
+    g_ping.targets[0].addr_4.sin_family = AF_INET;
+    g_ping.targets[0].addr_4.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+    ping_batch_init ();
+
+    for (size_t i = 0; i < sizeof (g_data); ++i)
+    {
+        g_data[i] = (uint8_t)(i * 31 + 7);
+    }
+}
+
+static void
+micro_run ()
+{
+    micro_init ();
+    bench_run ("checksum", "64B", bench_checksum_64);
+    bench_run ("checksum", "1500B", bench_checksum_1500);
+    bench_run ("verify_checksum", "echo", bench_verify_checksum);
+    bench_run ("fill_icmp_packet", "v4", bench_fill_v4);
+    bench_run ("fill_icmp_packet", "v6", bench_fill_v6);
+    bench_run ("reply", "v4_raw", bench_reply);
+    /* The target now holds the replies of the previous benchmark. */
+    bench_run ("compute_rtt_stats", "histogram", bench_rtt_stats);
+    release_resources ();
+}
+
+/**
+ * @brief Smallest RTT user space can see on this host: one Echo Request at a
+ * time, a blocking recvmsg() and nothing else. Like ft_ping, the reply is
+ * timed with its SO_TIMESTAMPNS kernel stamp, the overhead of ft_ping is
+ * its average RTT minus this one.
+ * @return the average RTT in milliseconds, -1 if no socket could be opened.
+ */
+
+static double
+baseline_rtt (ip_version ipv)
+{
+    struct sockaddr_storage addr = { 0 };
+    socklen_t addr_len;
+    int proto = ipv == IPV6 ? IPPROTO_ICMPV6 : IPPROTO_ICMP;
+    int family = ipv == IPV6 ? AF_INET6 : AF_INET;
+    struct timeval timeout = { 1, 0 };
+    int on = 1;
+    _Bool dgram = true;
+    double total = 0;
+    uint16_t ident = getpid () & 0xffff;
+    int fd;
+
+    if ((fd = socket (family, SOCK_DGRAM, proto)) == -1)
+    {
+        dgram = false;
+        if ((fd = socket (family, SOCK_RAW, proto)) == -1)
+        {
+            return -1;
+        }
+    }
+    setsockopt (fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof (timeout));
+    setsockopt (fd, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof (on));
+
+    if (ipv == IPV6)
+    {
+        struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)&addr;
+
+        sin6->sin6_family = AF_INET6;
+        sin6->sin6_addr = in6addr_loopback;
+        addr_len = sizeof (*sin6);
+    }
+    else
+    {
+        struct sockaddr_in *sin = (struct sockaddr_in *)&addr;
+
+        sin->sin_family = AF_INET;
+        sin->sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+        addr_len = sizeof (*sin);
+    }
+
+    for (int i = 0; i < BENCH_BASELINE_COUNT; ++i)
+    {
+        uint8_t request[sizeof (struct icmphdr) + DEFAULT_DATALEN] = { 0 };
+        uint8_t reply[IP_HEADER_MAX + sizeof (request)];
+        char control[CMSG_SPACE (sizeof (struct timespec))];
+        struct iovec iov = { reply, sizeof (reply) };
+        struct msghdr msg = { 0 };
+        struct icmphdr *hdr = (struct icmphdr *)request;
+        struct cmsghdr *cmsg;
+        struct timespec sent;
+        struct timespec received;
+
+        hdr->type = ipv == IPV6 ? ICMP6_ECHO_REQUEST : ICMP_ECHO;
+        hdr->un.echo.id = htons (ident);
+        hdr->un.echo.sequence = htons ((uint16_t)i);
+        if (ipv == IPV4)
+        {
+            hdr->checksum = ping_checksum (request, sizeof (request));
+        }
+
+        clock_gettime (CLOCK_REALTIME, &sent);
+        if (sendto (fd, request, sizeof (request), 0,
+                    (struct sockaddr *)&addr, addr_len)
+            == -1)
+        {
+            close (fd);
+            return -1;
+        }
+
+        /* A raw socket also sees the request and the traffic of others. */
+
+        for (;;)
+        {
+            const struct icmphdr *icmp = (const struct icmphdr *)reply;
+
+            msg.msg_iov = &iov;
+            msg.msg_iovlen = 1;
+            msg.msg_control = control;
+            msg.msg_controllen = sizeof (control);
+            if (recvmsg (fd, &msg, 0) == -1)
+            {
+                close (fd);
+                return -1;
+            }
+            if (!dgram && ipv == IPV4)
+            {
+                icmp = (const struct icmphdr *)(reply
+                                                + (reply[0] & 0x0f) * 4);
+            }
+            if ((icmp->type == ICMP_ECHOREPLY
+                 || icmp->type == ICMP6_ECHO_REPLY)
+                && icmp->un.echo.sequence == hdr->un.echo.sequence
+                && (dgram || icmp->un.echo.id == hdr->un.echo.id))
+            {
+                break;
+            }
+        }
+        clock_gettime (CLOCK_REALTIME, &received);
+        for (cmsg = CMSG_FIRSTHDR (&msg); cmsg != NULL;
+             cmsg = CMSG_NXTHDR (&msg, cmsg))
+        {
+            if (cmsg->cmsg_level == SOL_SOCKET
+                && cmsg->cmsg_type == SCM_TIMESTAMPNS)
+            {
+                memcpy (&received, CMSG_DATA (cmsg), sizeof (received));
+            }
+        }
+        total += elapsed_nsec (&sent, &received) / 1e6;
+    }
+    close (fd);
+    return total / BENCH_BASELINE_COUNT;
+}
+
+/**
+ * @brief Floods a loopback address with ft_ping and reports the rate it
+ * sustains, the CPU it burns per request and the RTT it adds. The average
+ * RTT is taken over the CSV probe records, the summary one is rounded to
+ * the microsecond which is the order of a loopback RTT. The results of a
+ * backend other than the default one are reported as "<addr>/<backend>".
+ */
+
+static void
+e2e_run (const char *exec, const char *addr, ip_version ipv, uint64_t count,
+         const char *io)
+{
+    char name[64];
+    char count_arg[32];
+    char line[1024];
+    struct rusage usage;
+    struct timespec start;
+    struct timespec end;
+    uint64_t transmitted = 0;
+    uint64_t replies = 0;
+    double total = 0;
+    double baseline;
+    double avg;
+    double cpu_ns;
+    double wall_ns;
+    int status;
+    int pipefd[2];
+    pid_t pid;
+    FILE *out;
+
+    snprintf (name, sizeof (name), "%s%s%s", addr, io ? "/" : "",
+              io ? io : "");
+    snprintf (count_arg, sizeof (count_arg), "%" PRIu64, count);
+    if (pipe (pipefd) == -1)
+    {
+        perror ("pipe");
+        exit (EXIT_FAILURE);
+    }
+
+    clock_gettime (CLOCK_MONOTONIC, &start);
+    if ((pid = fork ()) == -1)
+    {
+        perror ("fork");
+        exit (EXIT_FAILURE);
+    }
+    if (pid == 0)
+    {
+        dup2 (pipefd[1], STDOUT_FILENO);
+        close (pipefd[0]);
+        close (pipefd[1]);
+        execl (exec, exec, "-f", "-F", "csv", "-c", count_arg, "-I",
+               io ? io : "socket", addr, (char *)NULL);
+        perror (exec);
+        _exit (EXIT_FAILURE);
+    }
+    close (pipefd[1]);
+
+    out = fdopen (pipefd[0], "r");
+    while (fgets (line, sizeof (line), out) != NULL)
+    {
+        char *field;
+        char *save;
+        int column = 0;
+
+        /* strtok_r() skips the empty fields, the RTT is the 7th field of
+         * a reply and the count the 4th of a summary. */
+
+        if (strncmp (line, "probe,", 6) == 0 && strstr (line, ",reply,"))
+        {
+            for (field = strtok_r (line, ",", &save); field != NULL;
+                 field = strtok_r (NULL, ",", &save), ++column)
+            {
+                if (column == 6)
+                {
+                    total += strtod (field, NULL);
+                    ++replies;
+                    break;
+                }
+            }
+        }
+        else if (strncmp (line, "summary,", 8) == 0)
+        {
+            for (field = strtok_r (line, ",", &save); field != NULL;
+                 field = strtok_r (NULL, ",", &save), ++column)
+            {
+                if (column == 3)
+                {
+                    transmitted = strtoull (field, NULL, 10);
+                    break;
+                }
+            }
+        }
+    }
+    fclose (out);
+
+    if (wait4 (pid, &status, 0, &usage) == -1 || !WIFEXITED (status)
+        || transmitted == 0 || replies == 0)
+    {
+        fprintf (stderr, "loopback benchmark: %s %s failed\n", exec, name);
+        return;
+    }
+    clock_gettime (CLOCK_MONOTONIC, &end);
+
+    wall_ns = elapsed_nsec (&start, &end);
+    avg = total / replies;
+    cpu_ns = (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1e9
+             + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1e3;
+    report ("loopback", name, "pps", transmitted / (wall_ns / 1e9), "pps");
+    report ("loopback", name, "cpu_per_probe", cpu_ns / transmitted, "ns");
+    report ("loopback", name, "rtt_avg", avg * 1e3, "us");
+    if ((baseline = baseline_rtt (ipv)) >= 0)
+    {
+        report ("loopback", name, "rtt_baseline", baseline * 1e3, "us");
+        report ("loopback", name, "rtt_overhead", (avg - baseline) * 1e3,
+                "us");
+    }
+}
+
+int
+main (int argc, char *argv[])
+{
+    static struct option long_options[]
+        = { { "help", no_argument, NULL, 'h' },
+            { "exec", required_argument, NULL, 'x' },
+            { "count", required_argument, NULL, 'c' },
+            { "rev", required_argument, NULL, 'r' },
+            { NULL, 0, NULL, 0 } };
+    const char *exec = NULL;
+    uint64_t count = BENCH_E2E_COUNT;
+    int opt;
+
+    while ((opt = getopt_long (argc, argv, "hx:c:r:", long_options, NULL))
+           != -1)
+    {
+        switch (opt)
+        {
+            case 'x':
+            {
+                exec = optarg;
+                break;
+            }
+            case 'c':
+            {
+                char *endptr;
+
+                count = strtoull (optarg, &endptr, 10);
+                if (count == 0 || *endptr != '\0')
+                {
+                    fprintf (stderr, "Invalid count value: %s\n", optarg);
+                    show_usage_and_exit (EXIT_FAILURE);
+                }
+                break;
+            }
+            case 'r':
+            {
+                g_rev = optarg;
+                break;
+            }
+            default:
+            {
+                show_usage_and_exit (opt == 'h' ? EXIT_SUCCESS
+                                                : EXIT_FAILURE);
+            }
+        }
+    }
+
+    micro_run ();
+    if (exec != NULL)
+    {
+        e2e_run (exec, "127.0.0.1", IPV4, count, NULL);
+        e2e_run (exec, "::1", IPV6, count, NULL);
+        e2e_run (exec, "127.0.0.1", IPV4, count, "io_uring");
+        e2e_run (exec, "::1", IPV6, count, "io_uring");
+    }
+    return EXIT_SUCCESS;
+}
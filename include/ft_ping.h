@@ -1,46 +1,172 @@
 #ifndef FT_PING_H
 #define FT_PING_H
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include <arpa/inet.h>
+#include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <float.h>
 #include <getopt.h>
+#include <ifaddrs.h>
+#include <inttypes.h>
 #include <limits.h>
+#include <linux/errqueue.h>
+#include <linux/filter.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <linux/io_uring.h>
+#include <linux/net_tstamp.h>
+#include <linux/sockios.h>
 #include <math.h>
+#include <net/if.h>
 #include <netdb.h>
 #include <netinet/icmp6.h>
 #include <netinet/ip.h>
 #include <netinet/ip6.h>
 #include <netinet/ip_icmp.h>
+#include <poll.h>
+#include <pthread.h>
 #include <signal.h>
+#include <stdarg.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/time.h>
+#include <sys/timerfd.h>
 #include <sys/types.h>
+#include <sys/un.h>
 #include <time.h>
 #include <unistd.h>
 
-#define PACKET_SIZE 64
 #define CONTROL_BUFFER_SIZE 1024
 
-#define ICMPV4_PACKET_SIZE PACKET_SIZE + sizeof (struct iphdr)
-#define ICMPV4_PAYLOAD_SIZE PACKET_SIZE - sizeof (struct icmphdr)
-
-#define ICMPV6_PACKET_SIZE PACKET_SIZE + sizeof (struct ip6_hdr)
-#define ICMPV6_PAYLOAD_SIZE PACKET_SIZE - sizeof (struct icmp6_hdr)
+/* Payload bytes of an Echo Request, the largest one still fits an IPv4
+ * datagram along with the IP and ICMP headers. */
+#define DEFAULT_DATALEN 56
+#define MAX_DATALEN 65507
+#define MAX_PATTERN_LEN 16
+#define DEFAULT_PATTERN 0xA5
 
 #define RTT_WEIGHT_FACTOR 0.125
 #define RTT_DEVIATION_FACTOR 0.25
 
-#define TIMEOUT 1
+/* Adaptive loss deadline of a probe: the retransmission timeout of its
+ * target, 1 s until a deviation is known as with RFC 6298, bounded like the
+ * RTO of TCP. An explicit -W is at most LOSS_TIMEOUT_MAX_SEC. */
+#define LOSS_TIMEOUT_INIT_MSEC 1000
+#define LOSS_TIMEOUT_MIN_MSEC 200
+#define LOSS_TIMEOUT_MAX_MSEC 60000
+#define LOSS_TIMEOUT_MAX_SEC 3600
+
+/* Loss deadlines are kept in a hierarchical timing wheel of WHEEL_LEVELS
+ * levels of WHEEL_SLOTS slots, a slot of level 0 spans WHEEL_TICK_NSEC and
+ * a slot of level n spans a whole turn of level n - 1. */
+#define WHEEL_TICK_NSEC 1000000
+#define WHEEL_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+#define WHEEL_LEVELS 4
+#define WHEEL_NONE UINT32_MAX
+
+/* Outstanding probes are indexed by their ICMP sequence, the ring size must
+ * be a power of two no larger than the 16-bit sequence space. */
+#define PROBE_RING_SIZE 65536
+
+/* Answered sequences are tracked over the same window, one bit each. */
+#define REPLY_WINDOW_WORDS (PROBE_RING_SIZE / 64)
+
+#define PING_INTERVAL_SEC 1
+#define FLOOD_INTERVAL_NSEC 10000000
+#define SEND_BURST_MAX 64
+#define RECV_BATCH_MAX 64
+
+/* Path mode probes every TTL from 1 up to at most PATH_HOPS_MAX at once. */
+#define PATH_HOPS_MAX 64
+
+/* A receive buffer holds an Echo Reply behind the longest IPv4 header, or
+ * an ICMP error which never exceeds the IPv6 minimum MTU. */
+#define IP_HEADER_MAX 60
+#define ICMP_ERROR_MAX 1280
+#define EPOLL_MAX_EVENTS 8
+#define WORKERS_MAX 256
+
+/* Interfaces whose hardware timestamping configuration -K hardware changed,
+ * and restores at exit. */
+#define HWTSTAMP_IFACES_MAX 16
+
+/* Machine readable records are gathered in a buffer written out once it
+ * cannot hold another record of at most OUTPUT_RECORD_MAX bytes, or once its
+ * oldest record has waited for OUTPUT_FLUSH_MSEC. */
+#define OUTPUT_BUFFER_SIZE (1 << 16)
+#define OUTPUT_RECORD_MAX (1 << 13)
+#define OUTPUT_FLUSH_MSEC 1000
+
+/* In daemon mode, the probing threads publish the statistics of their
+ * targets every METRICS_PUBLISH_MSEC, the RTTs are exposed in METRICS_BUCKETS
+ * cumulative buckets. */
+#define METRICS_PUBLISH_MSEC 1000
+#define METRICS_BUCKETS 16
+#define METRICS_REQUEST_MAX 2048
+
+/* io_uring backend: submission queue entries, receive buffers provided to
+ * the kernel (a power of two) and the completions that fit in between two
+ * reaps. */
+#define URING_ENTRIES 256
+#define URING_BUFFERS 512
+#define URING_CQ_ENTRIES (4 * URING_BUFFERS)
+
+/* AF_PACKET receive ring: PACKET_BLOCKS blocks of PACKET_BLOCK_SIZE bytes,
+ * a block is handed over once full or PACKET_BLOCK_TIMEOUT_MSEC after its
+ * first frame. The RTTs come from the frame stamps, but a flood waiting for
+ * each reply (-f) is paced by the handover. */
+#define PACKET_BLOCK_SIZE (1 << 18)
+#define PACKET_BLOCKS 16
+#define PACKET_FRAME_SIZE 2048
+#define PACKET_BLOCK_TIMEOUT_MSEC 1
+
+/* Layout of the -S statistics segment, readers check the magic and the
+ * version before trusting the rest. */
+#define SHM_MAGIC 0x47505446
+#define SHM_VERSION 1
+#define SHM_HOSTNAME_MAX 256
+
+/* A reader gives up on an entry still being written after SHM_READ_TRIES
+ * attempts, its writer may have died in the middle of an update. */
+#define SHM_READ_TRIES 1000
+
+/* Seconds a name resolved by this run stays valid in the -C cache. */
+#define RESOLVE_CACHE_TTL 300
+
+/* Log-linear latency histogram in nanoseconds: values below HISTO_SUB_COUNT
+ * are counted exactly, every further power of two is split into
+ * HISTO_SUB_COUNT / 2 linear buckets, up to 2^HISTO_MAX_MAGNITUDE ns. */
+#define HISTO_SUB_BITS 7
+#define HISTO_SUB_COUNT (1 << HISTO_SUB_BITS)
+#define HISTO_MAX_MAGNITUDE 40
+#define HISTO_BUCKETS                                                          \
+    (HISTO_SUB_COUNT                                                           \
+     + (HISTO_MAX_MAGNITUDE - HISTO_SUB_BITS) * (HISTO_SUB_COUNT / 2))
+#define NB_PERCENTILES 5
 
 typedef enum
 {
     START,
+    RESOLVED,
+    SEND,
     PING,
+    HOP,
     END
 } message;
 
@@ -51,6 +177,41 @@ typedef enum
     IPV6,
 } ip_version;
 
+typedef enum
+{
+    FORMAT_TEXT,
+    FORMAT_JSON,
+    FORMAT_CSV,
+} output_format;
+
+typedef enum
+{
+    METRICS_HTTP,
+    METRICS_UNIX,
+    METRICS_FILE,
+} metrics_endpoint;
+
+typedef enum
+{
+    IO_SOCKET,
+    IO_URING,
+    IO_PACKET,
+} io_mode;
+
+typedef enum
+{
+    REPLY_OK,
+    REPLY_TRUNCATED,
+    REPLY_CORRUPT,
+} reply_status;
+
+typedef enum
+{
+    TS_NONE,
+    TS_SOFTWARE,
+    TS_HARDWARE,
+} ts_mode;
+
 #ifdef DEBUG
 #define PING_DEBUG(fmt, ...)                                                   \
     fprintf (stderr, "DEBUG: %s:%d:%s(): " fmt, __FILE__, __LINE__, __func__,  \
@@ -59,60 +220,310 @@ typedef enum
 #define PING_DEBUG(fmt, ...)
 #endif
 
+/* The payload length is chosen at run time, see s_options.datalen. */
+
 struct ping_packet_v4
 {
     struct icmphdr hdr;
-    char data[ICMPV4_PAYLOAD_SIZE];
+    uint8_t data[];
 };
 
 struct ping_packet_v6
 {
     struct icmp6_hdr hdr;
-    char data[ICMPV6_PAYLOAD_SIZE];
+    uint8_t data[];
 };
 
 struct s_options
 {
     _Bool verbose;
     _Bool help;
+    _Bool flood;
+    _Bool flood_adaptive;
+    _Bool keep_samples;
+    _Bool all_addresses;
     ip_version ipv;
+    ts_mode timestamping;
+    output_format format;
+    io_mode io;
     uint8_t ttl;
+    uint8_t path_hops;
     uint32_t count;
+    uint32_t workers;
+    uint16_t datalen;
+    uint8_t pattern_len;
+    uint8_t pattern[MAX_PATTERN_LEN];
+    struct timespec interval;
+    struct timespec loss_timeout;
+    struct timespec deadline;
+    const char *cache_path;
+    const char *metrics;
+    const char *stats_shm;
+};
+
+/**
+ * Fixed-size latency histogram, the relative error of a percentile is
+ * bounded by 1 / HISTO_SUB_COUNT whatever the number of samples. Two
+ * histograms are merged by adding their buckets.
+ */
+
+struct s_histogram
+{
+    uint64_t total;
+    uint64_t counts[HISTO_BUCKETS];
+};
+
+/**
+ * One socket per address family is shared by every target. An ICMP datagram
+ * socket is used when permitted, the kernel then picks its identifier,
+ * otherwise a raw socket carrying the identifier of the calling context.
+ * With kernel timestamping, tx_seq maps the OPT_ID key of each request sent
+ * on the socket back to its ICMP sequence.
+ */
+
+struct s_icmp_socket
+{
+    int fd;
+    _Bool dgram;
+    uint16_t ident;
+    uint32_t tx_key;
+    uint16_t *tx_seq;
 };
 
 struct s_sock_info
 {
-    struct addrinfo ai;
-    struct sockaddr_in addr_4;
-    struct sockaddr_in6 addr_6;
-    const char *hostname;
-    char ai_canonname[NI_MAXHOST];
-    char ip_addr[INET6_ADDRSTRLEN];
-    int sock_fd;
+    struct s_icmp_socket v4;
+    struct s_icmp_socket v6;
 };
 
+/**
+ * Single RTT sample, only retained when the samples are kept.
+ */
+
 struct s_rtt
 {
     struct timespec start;
     struct timespec end;
     double rtt;
-    struct s_rtt *next;
 };
 
+/**
+ * Streaming RTT statistics updated on each reply in constant memory, the
+ * mean and the sum of squared deviations are maintained with Welford's
+ * algorithm. Two of them can be merged without any loss.
+ */
+
+struct s_rtt_stats
+{
+    uint64_t n;
+    double mean;
+    double m2;
+    double min;
+    double max;
+};
+
+/**
+ * Kernel timestamp, either software (CLOCK_REALTIME) or taken by the NIC.
+ * Two stamps are only comparable when they are of the same kind.
+ */
+
+struct s_kstamp
+{
+    struct timespec ts;
+    ts_mode kind;
+};
+
+struct s_probe
+{
+    struct timespec sent;
+    struct s_kstamp tx_stamp;
+    uint64_t seq;
+    uint64_t target_seq;
+    uint64_t deadline;
+    uint32_t target;
+    uint32_t wheel_prev;
+    uint32_t wheel_next;
+    uint16_t wheel_slot;
+    uint8_t ttl;
+    _Bool outstanding;
+};
+
+/**
+ * Timing wheel of the loss deadlines of a context, in ticks since origin.
+ * An outstanding probe is linked in a slot by the ring indexes of its
+ * neighbours, slot n of level l being slots[l * WHEEL_SLOTS + n]. The next
+ * tick to be processed is now. The probes of a slot of level l are moved
+ * down once level l - 1 has gone around, they expire from level 0. A bit of
+ * occupied is set per non empty slot.
+ */
+
+struct s_wheel
+{
+    struct timespec origin;
+    uint64_t now;
+    uint32_t count;
+    uint64_t occupied[WHEEL_LEVELS];
+    uint32_t slots[WHEEL_LEVELS * WHEEL_SLOTS];
+};
+
+struct s_target;
+
+/**
+ * Current reply, along with the outcome of its payload check: the received
+ * payload length and, for an altered payload, the first wrong byte. In path
+ * mode, hop is the TTL of the probe answered.
+ */
+
 struct s_info
 {
-    int sequence;
+    struct s_target *target;
+    uint32_t next_target;
+    uint64_t sequence;
+    struct timespec sent;
+    struct timespec received;
+    double rtt;
+    reply_status status;
+    _Bool duplicate;
+    _Bool late;
+    uint8_t hop;
+    ssize_t data_len;
+    ssize_t wrong_byte;
+    uint8_t should_be;
+    uint8_t was;
+    uint16_t ident;
     uint8_t hopli;
     ssize_t bytes_recv;
-    _Bool ready_send;
     _Bool read_loop;
     _Bool exit_code;
 };
 
+struct s_event
+{
+    int epoll_fd;
+    int timer_fd;
+    int stop_fd;
+    int resolve_fd;
+    struct timespec next_send;
+    struct timespec send_interval;
+    struct timespec deadline;
+    struct timespec next_publish;
+    uint64_t nb_turns;
+    _Bool lingering;
+};
+
+/**
+ * Preallocated message vectors for sendmmsg() and recvmmsg(), a burst of
+ * requests is issued and a batch of replies is drained with a single
+ * syscall each. The requests are copied from prebuilt templates. The
+ * templates and the packet buffers are sized to the chosen payload and
+ * carved out of a single allocation, the iovecs point into it. In path
+ * mode, each request carries its own TTL in its control buffer.
+ */
+
+struct s_batch
+{
+    size_t pkt_size;
+    size_t rcv_size;
+    uint8_t *buffers;
+    struct ping_packet_v4 *tmpl_v4;
+    struct ping_packet_v6 *tmpl_v6;
+    struct iovec snd_iov[SEND_BURST_MAX];
+    struct mmsghdr snd_msgs[SEND_BURST_MAX];
+    char snd_ctrl[SEND_BURST_MAX][CMSG_SPACE (sizeof (int))];
+    char rcv_ctrl[RECV_BATCH_MAX][CONTROL_BUFFER_SIZE];
+    struct sockaddr_storage rcv_addr[RECV_BATCH_MAX];
+    struct iovec rcv_iov[RECV_BATCH_MAX];
+    struct mmsghdr rcv_msgs[RECV_BATCH_MAX];
+};
+
+/**
+ * I/O backend of a probing context, the sockets are opened the same way
+ * whatever the backend. watch() hooks a newly opened socket up, send() puts
+ * a burst of filled requests on the wire and handle() drains what the event
+ * loop reported ready on fd, it returns false if fd is not one of its own.
+ * init() returns -1 if the backend is not supported by the kernel.
+ */
+
+struct s_io_backend
+{
+    const char *name;
+    int (*init) ();
+    void (*watch) (struct s_icmp_socket *sock, ip_version ipv);
+    void (*send) (struct s_icmp_socket *sock, struct mmsghdr *msgs,
+                  int count);
+    _Bool (*handle) (int fd);
+    void (*release) ();
+};
+
+/**
+ * io_uring instance of a probing context, set up with raw syscalls. Both
+ * sockets are registered files, each one has a multishot recvmsg armed that
+ * picks its buffers from a ring of URING_BUFFERS provided buffers, and a
+ * multishot poll on its error queue. A provided buffer holds the
+ * io_uring_recvmsg_out header, the address, the control messages and the
+ * datagram, in this order.
+ */
+
+struct s_uring
+{
+    int fd;
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring;
+    size_t cq_ring_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+    _Atomic uint32_t *sq_head;
+    _Atomic uint32_t *sq_tail;
+    uint32_t sq_mask;
+    uint32_t *sq_array;
+    _Atomic uint32_t *cq_head;
+    _Atomic uint32_t *cq_tail;
+    uint32_t cq_mask;
+    struct io_uring_cqe *cqes;
+    struct io_uring_buf_ring *buf_ring;
+    size_t buf_ring_size;
+    uint8_t *buffers;
+    size_t buffer_size;
+    uint16_t buf_tail;
+    uint32_t to_submit;
+    uint32_t sends_pending;
+    struct msghdr recv_msg;
+};
+
+/**
+ * TPACKET_V3 receive ring of a probing context. The kernel fills the blocks
+ * in turn, the one at current is the next to be handed over.
+ */
+
+struct s_packet_ring
+{
+    int fd;
+    uint8_t *map;
+    uint32_t current;
+};
+
+/**
+ * Reply counters and statistics. A duplicate is not counted as a reply, nor
+ * is a late reply, which came back once its probe had been declared lost. A
+ * reordered reply is. The reorder depth is the number of later requests of
+ * the target answered first. The requests the kernel refused to send count
+ * as send errors of their target.
+ */
+
 struct s_stats
 {
-    uint16_t nb_snd;
-    uint16_t nb_res;
+    uint64_t nb_snd;
+    uint64_t nb_res;
+    uint64_t nb_dup;
+    uint64_t nb_reordered;
+    uint64_t nb_late;
+    uint64_t nb_send_err;
+    uint64_t reorder_max;
+    uint64_t last_answered;
+
+    struct timespec session_start;
+    struct timespec session_end;
 
     double pkt_loss;
     double ping_session;
@@ -120,34 +531,341 @@ struct s_stats
     double estimated_rtt;
     double timeout_threshold;
 
+    struct s_rtt_stats rtt;
+    struct s_histogram *histogram;
+    double percentiles[NB_PERCENTILES];
     double min;
     double max;
     double avg;
+    double mdev;
+    double median;
+};
+
+/**
+ * One hop of the path to a target in path mode, probed with the TTL of its
+ * rank. The hop is known by the last address that answered those probes, a
+ * router through Time Exceeded or the destination itself through an Echo
+ * Reply. The loss and the deviation are derived once the session is over.
+ */
+
+struct s_hop
+{
+    struct sockaddr_storage addr;
+    uint64_t nb_snd;
+    uint64_t nb_res;
+    double last_rtt;
+    struct s_rtt_stats rtt;
+    double pkt_loss;
+    double mdev;
+};
+
+/**
+ * Per destination state. Requests are interleaved across targets and share
+ * a single sequence space, the probe ring maps a sequence back to its
+ * target and the reply source address is checked against it.
+ */
+
+struct s_target
+{
+    const char *hostname;
+    char ip_addr[INET6_ADDRSTRLEN];
+    ip_version ipv;
+    union
+    {
+        struct sockaddr_in addr_4;
+        struct sockaddr_in6 addr_6;
+    };
+    struct s_rtt *samples;
+    uint64_t nb_samples;
+    uint64_t samples_size;
+    struct s_stats stats;
+    struct s_hop *hops;
+    uint8_t path_len;
+};
+
+/**
+ * Address resolved for a name on a previous run, valid until expires. A
+ * name has one entry per address, the key tells which addresses were asked
+ * for.
+ */
+
+struct s_cache_entry
+{
+    char hostname[NI_MAXHOST];
+    int key;
+    char ip_addr[INET6_ADDRSTRLEN];
+    long expires;
+};
+
+/**
+ * Asynchronous resolution of one name, list is the one-entry request list
+ * handed to getaddrinfo_a().
+ */
+
+struct s_resolve
+{
+    struct gaicb req;
+    struct gaicb *list[1];
+    struct addrinfo hints;
+    _Bool done;
+    _Bool resolved;
+};
+
+/**
+ * Names still being resolved while the known targets are already probed,
+ * each of them joins the target table once its request completes.
+ */
+
+struct s_resolver
+{
+    struct s_resolve *requests;
+    uint32_t nb_requests;
+    uint32_t nb_pending;
+    struct s_cache_entry *cache;
+    size_t nb_cache;
+    size_t cache_size;
+};
+
+/**
+ * Hardware timestamping configuration an interface had before it was
+ * changed, shared by every thread of the process.
+ */
+
+struct s_hwtstamp_saved
+{
+    pthread_mutex_t lock;
+    uint32_t nb_ifaces;
+    char ifname[HWTSTAMP_IFACES_MAX][IF_NAMESIZE];
+    struct hwtstamp_config config[HWTSTAMP_IFACES_MAX];
+};
+
+/**
+ * Output buffer of the machine readable formats, offset turns the
+ * CLOCK_MONOTONIC probe times into wall clock times.
+ */
+
+struct s_output
+{
+    char *buf;
+    size_t len;
+    struct timespec last_flush;
+    struct timespec offset;
+};
+
+/**
+ * Statistics of one target as last published for the exposition thread.
+ */
+
+struct s_metrics_entry
+{
+    const char *hostname;
+    char ip_addr[INET6_ADDRSTRLEN];
+    uint64_t sent;
+    uint64_t received;
+    uint64_t send_errors;
+    double rtt_sum;
+    uint64_t buckets[METRICS_BUCKETS];
+};
+
+/**
+ * Daemon mode endpoint and snapshot. The snapshot holds one entry per
+ * target, indexed like the target table of the main thread, the lock only
+ * guards copies in and out of it.
+ */
+
+struct s_daemon
+{
+    metrics_endpoint kind;
+    const char *path;
+    int listen_fd;
+    int stop_fd;
+    pthread_t thread;
+    _Bool running;
+    pthread_mutex_t lock;
+    struct s_metrics_entry *entries;
+    uint32_t nb_entries;
+    uint32_t entries_size;
+};
+
+/**
+ * Live statistics of one target in the -S segment, guarded by a seqlock:
+ * seq is odd while the entry is being written. Entries sit on their own
+ * cache lines, the workers write theirs concurrently.
+ */
+
+struct s_shm_target
+{
+    _Atomic uint64_t seq;
+    char hostname[SHM_HOSTNAME_MAX];
+    char ip_addr[INET6_ADDRSTRLEN];
+    uint64_t nb_snd;
+    uint64_t nb_res;
+    struct s_rtt_stats rtt;
+    double last_rtt;
+    double estimated_rtt;
+    double dev_rtt;
+    struct timespec updated;
+} __attribute__ ((aligned (64)));
+
+/**
+ * Head of the -S segment. The times are on CLOCK_MONOTONIC, only the first
+ * nb_targets entries are described.
+ */
+
+struct s_shm_header
+{
+    uint32_t magic;
+    uint32_t version;
+    int32_t pid;
+    uint32_t capacity;
+    _Atomic uint32_t nb_targets;
+    struct timespec started;
+    struct s_shm_target targets[];
 };
 
+struct s_shm
+{
+    int fd;
+    struct s_shm_header *header;
+};
+
+/**
+ * Every thread owns its own context. With several workers, each of them
+ * probes a disjoint slice of the targets through its own sockets, probe ring
+ * and ICMP identifier, the main thread only merges the statistics once they
+ * are all done.
+ */
+
 struct s_ping
 {
     struct s_options options;
-    struct s_rtt *rtt_metrics;
-    struct s_rtt *rtt_metrics_beg;
+    struct s_target *targets;
+    uint32_t nb_targets;
+    uint32_t targets_size;
+    uint32_t first_target;
+    struct s_resolver resolver;
+    struct s_probe *probes;
+    uint64_t *answered;
     struct s_info info;
     struct s_sock_info sock_info;
+    struct s_event event;
+    struct s_wheel wheel;
+    struct s_batch *batch;
+    const struct s_io_backend *io;
+    struct s_uring *uring;
+    struct s_packet_ring *packet;
     struct s_stats stats;
+    struct s_output output;
+};
+
+/**
+ * Worker thread handle. The targets point into the table of the main thread,
+ * the statistics are copied back once the worker is done.
+ */
+
+struct s_worker
+{
+    pthread_t thread;
+    struct s_options options;
+    struct s_target *targets;
+    uint32_t nb_targets;
+    uint32_t first_target;
+    uint16_t ident;
+    int stop_fd;
+    struct s_stats stats;
+    _Bool exit_code;
 };
 
-extern struct s_ping g_ping;
+extern _Thread_local struct s_ping g_ping;
+extern const struct s_io_backend g_io_socket;
+extern const struct s_io_backend g_io_uring;
+extern const struct s_io_backend g_io_packet;
 
-void ping_coord (const char *hostname);
-void fill_icmp_packet_v4 (struct ping_packet_v4 *ping_pkt);
-void fill_icmp_packet_v6 (struct ping_packet_v6 *ping_pkt);
-void start_rtt_metrics ();
-void end_rtt_metrics ();
+void ping_coord (int nb_hosts, char **hosts);
+void ping_session_init ();
+void ping_loop ();
+void ping_workers_run ();
+void ping_template_init (struct ping_packet_v4 *v4, struct ping_packet_v6 *v6);
+void fill_icmp_packet_v4 (struct ping_packet_v4 *ping_pkt, uint16_t sequence,
+                          const struct timespec *sent);
+void fill_icmp_packet_v6 (struct ping_packet_v6 *ping_pkt, uint16_t sequence,
+                          const struct timespec *sent);
+uint16_t ping_checksum (const void *data, size_t len);
+ssize_t payload_mismatch (const struct s_probe *probe, const uint8_t *data,
+                          size_t len, ip_version ipv, uint8_t *should_be);
+struct s_probe *start_rtt_metrics (uint64_t sequence, uint32_t target,
+                                   uint8_t ttl);
+struct s_probe *probe_find (uint16_t sequence);
+struct s_probe *probe_lookup (uint16_t sequence);
+void end_rtt_metrics (struct s_probe *probe, const struct timespec *received,
+                      const struct s_kstamp *rx_stamp);
+void tx_stamp_metrics (uint16_t sequence, const struct s_kstamp *tx_stamp);
+void lost_rtt_metrics (struct s_probe *probe);
+void hop_rtt_metrics (struct s_probe *probe, const struct sockaddr *from,
+                      const struct timespec *received,
+                      const struct s_kstamp *rx_stamp);
+void ping_wheel_init ();
+void ping_wheel_add (struct s_probe *probe, const struct timespec *deadline);
+void ping_wheel_remove (struct s_probe *probe);
+void ping_wheel_expire (const struct timespec *now);
+_Bool ping_wheel_next (struct timespec *next);
 void ping_messages_handler (message type);
+void ping_output_handler (message type);
+void ping_output_error (uint8_t type, uint8_t code, uint32_t mtu,
+                        const char *from);
+void ping_output_lost ();
+void ping_output_probe_lost (const struct s_probe *probe);
+void ping_output_flush ();
+void ping_output_tick (const struct timespec *now);
 void release_resources ();
-void compute_rtt_stats ();
+void compute_rtt_stats (struct s_target *target);
+void compute_aggregate_stats ();
+void compute_hop_stats (struct s_target *target);
+const char *hop_addr (const struct s_hop *hop, char *buf);
 void ping_socket_init ();
+void ping_socket_handler (struct s_icmp_socket *sock, ip_version ipv);
+void ping_reply_handler (struct s_icmp_socket *sock, ip_version ipv,
+                         struct msghdr *msg, size_t len,
+                         const struct timespec *mono,
+                         const struct timespec *real);
+void ping_replies_done ();
+int recv_errqueue (struct s_icmp_socket *sock);
+_Bool icmp_soft_error (int err);
+_Bool icmp_send_error (int err);
+void ping_send_failed (int index, int err);
+void sample_clocks (struct timespec *mono, struct timespec *real);
+void ping_event_watch (int fd);
+void ping_io_init ();
+void ping_io_release ();
+void ping_socket_open (const struct s_target *target);
+void ping_filter_attach (int fd, ip_version ipv);
+void ping_filter_errors_only (const struct s_icmp_socket *sock,
+                              ip_version ipv);
+void ping_filter_packet_attach (int fd, uint16_t ident_v4, uint16_t ident_v6);
+void ping_event_init ();
+void ping_batch_init ();
 void ping_init_g_info();
-_Bool rtt_timeout ();
-_Bool verify_checksum (struct ping_packet_v4 *ping_pkt);
+void ping_daemon_start ();
+void ping_daemon_publish (const struct timespec *now);
+void ping_daemon_stop ();
+void ping_shm_open ();
+void ping_shm_targets ();
+void ping_shm_update (uint32_t target);
+void ping_shm_close ();
+void ping_resolve_start (int nb_hosts, char **hosts);
+uint32_t ping_resolve_handler ();
+void ping_resolve_wait ();
+void ping_resolve_release ();
+void rtt_stats_merge (struct s_rtt_stats *dst, const struct s_rtt_stats *src);
+void histogram_record (struct s_histogram *histogram, double rtt);
+void histogram_merge (struct s_histogram *dst, const struct s_histogram *src);
+void histogram_percentiles (const struct s_histogram *histogram,
+                            const double *percentiles, int nb, double *values);
+void histogram_cumulative (const struct s_histogram *histogram,
+                           const double *bounds, int nb, uint64_t *counts);
+uint64_t ping_total_count ();
+void timespec_add (struct timespec *ts, const struct timespec *delta);
+int timespec_cmp (const struct timespec *a, const struct timespec *b);
+_Bool verify_checksum (const void *icmp, size_t len);
 
 #endif
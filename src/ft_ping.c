@@ -1,14 +1,30 @@
 #include "ft_ping.h"
 
-struct s_ping g_ping;
+_Thread_local struct s_ping g_ping;
 
-static char short_options[] = "vhc:t:46";
+static char short_options[] = "vhc:t:P:i:W:w:fkK:j:s:p:C:aF:D:S:I:46";
 
 static struct option long_options[]
     = { { "verbose", no_argument, NULL, 'v' },
         { "help", no_argument, NULL, 'h' },
         { "count", required_argument, NULL, 'c' },
         { "ttl", required_argument, NULL, 't' },
+        { "path", required_argument, NULL, 'P' },
+        { "interval", required_argument, NULL, 'i' },
+        { "timeout", required_argument, NULL, 'W' },
+        { "deadline", required_argument, NULL, 'w' },
+        { "flood", no_argument, NULL, 'f' },
+        { "keep-samples", no_argument, NULL, 'k' },
+        { "kernel-timestamps", required_argument, NULL, 'K' },
+        { "workers", required_argument, NULL, 'j' },
+        { "size", required_argument, NULL, 's' },
+        { "pattern", required_argument, NULL, 'p' },
+        { "cache", required_argument, NULL, 'C' },
+        { "all-addresses", no_argument, NULL, 'a' },
+        { "format", required_argument, NULL, 'F' },
+        { "daemon", required_argument, NULL, 'D' },
+        { "stats-shm", required_argument, NULL, 'S' },
+        { "io", required_argument, NULL, 'I' },
         { "ipv4", no_argument, NULL, '4' },
         { "ipv6", no_argument, NULL, '6' },
         { NULL, 0, NULL, 0 } };
@@ -22,43 +38,130 @@ Options :\n\
   -h, --help         display this help and exit\n\
   -v, --verbose      verbose output\n\
   -c, --count        stop after sending (and receiving) count ECHO_RESPONSE packets\n\
+                     to each address\n\
   -t, --ttl          set the IP Time to Live\n\
+  -P, --path <hops>  probe every TTL from 1 to hops (at most 64) at once and\n\
+                     report the loss and RTT of each hop of the path\n\
+  -i, --interval     seconds between sending each packet (microsecond resolution)\n\
+  -W, --timeout      seconds to wait for each reply before it is counted as\n\
+                     lost (millisecond resolution, at most 3600), adapted to\n\
+                     the measured RTT of each address by default\n\
+  -w, --deadline     stop after that many seconds whatever the count\n\
+  -f, --flood        flood ping, send as fast as replies come back\n\
+  -k, --keep-samples keep every RTT sample in memory, adds the exact median\n\
+  -K, --kernel-timestamps <software|hardware>\n\
+                     measure RTTs with kernel/NIC transmit and receive stamps,\n\
+                     hardware changes the NIC wide timestamping setting of\n\
+                     the egress interface until ft_ping exits\n\
+  -j, --workers      probe the addresses from that many threads, 0 for one\n\
+                     per online CPU\n\
+  -s, --size         number of data bytes to send (default 56, at most 65507)\n\
+  -p, --pattern      up to 16 hex bytes filling the payload, e.g. -p ff00\n\
+  -C, --cache <file> keep resolved names in file for 5 minutes, numeric\n\
+                     addresses never go through the resolver\n\
+  -a, --all-addresses probe every address of each host side by side, IPv4\n\
+                     and IPv6 alike, and report their latency delta\n\
+  -F, --format <text|json|csv>\n\
+                     one JSON Lines or CSV record per probe and a summary\n\
+                     record per address instead of the text output\n\
+  -D, --daemon <[host]:port|unix:path|file:path>\n\
+                     probe until stopped without printing the replies, the\n\
+                     statistics are served for Prometheus over HTTP, on a\n\
+                     Unix socket or as a textfile collector file\n\
+  -S, --stats-shm <file>\n\
+                     publish live statistics in a shared memory file, read\n\
+                     it with ft_ping_stat (e.g. /dev/shm/ft_ping.stats)\n\
+  -I, --io <socket|io_uring|packet>\n\
+                     I/O backend, io_uring submits a whole burst and reaps\n\
+                     the replies without any syscall per request, packet\n\
+                     captures the replies in a memory mapped AF_PACKET ring\n\
   -4, --ipv4         use IPv4 only\n\
   -6, --ipv6         use IPv6 only\n");
 }
 
+static void
+show_usage_and_exit (int exit_code)
+{
+    show_usage ();
+    exit (exit_code);
+}
+
 /**
- * @brief Checks if the program is run with root rights.
- * Creating raw sockets (SOCK_RAW) for protocols like ICMP (IPPROTO_ICMP)
- * requires elevated privileges
- * @return 1 if the program is executed with root rights, 0 otherwise.
+ * @brief Parses the -p pattern, an even number of hexadecimal digits giving
+ * at most MAX_PATTERN_LEN bytes.
+ * @param arg pattern argument
+ * @return 0 on success, -1 if the pattern is invalid.
  */
 
 static int
-is_running_as_root ()
+parse_pattern (const char *arg)
 {
-    return geteuid () == 0;
+    size_t len = strlen (arg);
+
+    if (len == 0 || len % 2 || len / 2 > MAX_PATTERN_LEN)
+    {
+        return -1;
+    }
+
+    for (size_t i = 0; i < len; i += 2)
+    {
+        char byte[3] = { arg[i], arg[i + 1], '\0' };
+        char *endptr;
+
+        if (!isxdigit ((unsigned char)byte[0])
+            || !isxdigit ((unsigned char)byte[1]))
+        {
+            return -1;
+        }
+        g_ping.options.pattern[i / 2] = (uint8_t)strtoul (byte, &endptr, 16);
+    }
+    g_ping.options.pattern_len = len / 2;
+    return 0;
 }
 
+/**
+ * @brief Without -i, a flood ping sends a new request as soon as the last one
+ * is answered and at least every FLOOD_INTERVAL_NSEC, a regular ping every
+ * PING_INTERVAL_SEC. An explicit -i always yields a fixed rate.
+ */
+
 static void
-show_usage_and_exit (int exit_code)
+set_default_interval ()
 {
-    show_usage ();
-    exit (exit_code);
+    if (g_ping.options.interval.tv_sec || g_ping.options.interval.tv_nsec)
+    {
+        return;
+    }
+
+    if (g_ping.options.flood)
+    {
+        g_ping.options.interval.tv_nsec = FLOOD_INTERVAL_NSEC;
+        g_ping.options.flood_adaptive = true;
+    }
+    else
+    {
+        g_ping.options.interval.tv_sec = PING_INTERVAL_SEC;
+    }
 }
 
+/**
+ * @brief SIGINT only stops the event loop, epoll_wait() returns EINTR and
+ * ping_coord() prints the statistics and releases the resources outside of
+ * the signal context. The workers block SIGINT, the signal is handled by the
+ * main thread which raises the stop event they are waiting on. A daemon is
+ * stopped the same way by SIGTERM.
+ */
+
 static void
 handle_sig (int sig)
 {
-    if (sig == SIGALRM)
-    {
-        g_ping.info.ready_send = true;
-    }
-    else if (sig == SIGINT)
+    if (sig == SIGINT || sig == SIGTERM)
     {
-        ping_messages_handler (END);
-        release_resources ();
-        exit (EXIT_SUCCESS);
+        g_ping.info.read_loop = false;
+        if (g_ping.event.stop_fd != -1)
+        {
+            eventfd_write (g_ping.event.stop_fd, 1);
+        }
     }
 }
 
@@ -70,14 +173,7 @@ main (int argc, char *argv[])
 
     long_index = 0;
 
-    if (!is_running_as_root ())
-    {
-        fprintf (stderr, "Program needs to be run as root\n");
-        exit (EXIT_FAILURE);
-    }
-
     signal (SIGINT, handle_sig);
-    signal (SIGALRM, handle_sig);
 
     ping_init_g_info();
 
@@ -128,6 +224,219 @@ main (int argc, char *argv[])
                 g_ping.options.ttl = (uint8_t)value;
                 break;
             }
+            case 'P':
+            {
+                char *endptr;
+                errno = 0;
+                long value = strtol (optarg, &endptr, 10);
+
+                if (errno == ERANGE || value < 1 || value > PATH_HOPS_MAX
+                    || *endptr != '\0')
+                {
+                    fprintf (stderr, "Invalid hop count: %s\n", optarg);
+                    show_usage_and_exit (EXIT_FAILURE);
+                }
+
+                g_ping.options.path_hops = (uint8_t)value;
+                break;
+            }
+            case 'i':
+            {
+                char *endptr;
+                errno = 0;
+                double value = strtod (optarg, &endptr);
+
+                if (errno == ERANGE || !(value > 0) || value > INT_MAX
+                    || *endptr != '\0')
+                {
+                    fprintf (stderr, "Invalid interval value: %s\n", optarg);
+                    show_usage_and_exit (EXIT_FAILURE);
+                }
+
+                uint64_t usec = (uint64_t)(value * 1e6 + 0.5);
+
+                if (usec == 0)
+                {
+                    fprintf (stderr, "Interval must be at least 1us: %s\n",
+                             optarg);
+                    show_usage_and_exit (EXIT_FAILURE);
+                }
+
+                g_ping.options.interval.tv_sec = usec / 1000000;
+                g_ping.options.interval.tv_nsec = (usec % 1000000) * 1000;
+                break;
+            }
+            case 'W':
+            case 'w':
+            {
+                char *endptr;
+                errno = 0;
+                double value = strtod (optarg, &endptr);
+                double max = opt == 'W' ? LOSS_TIMEOUT_MAX_SEC : INT_MAX;
+
+                if (errno == ERANGE || !(value > 0) || value > max
+                    || *endptr != '\0')
+                {
+                    fprintf (stderr, "Invalid %s value: %s\n",
+                             opt == 'W' ? "timeout" : "deadline", optarg);
+                    show_usage_and_exit (EXIT_FAILURE);
+                }
+
+                uint64_t msec = (uint64_t)(value * 1e3 + 0.5);
+
+                if (msec == 0)
+                {
+                    fprintf (stderr, "%s must be at least 1ms: %s\n",
+                             opt == 'W' ? "Timeout" : "Deadline", optarg);
+                    show_usage_and_exit (EXIT_FAILURE);
+                }
+
+                struct timespec *ts = opt == 'W' ? &g_ping.options.loss_timeout
+                                                 : &g_ping.options.deadline;
+
+                ts->tv_sec = msec / 1000;
+                ts->tv_nsec = (msec % 1000) * 1000000;
+                break;
+            }
+            case 'f':
+            {
+                g_ping.options.flood = true;
+                break;
+            }
+            case 'k':
+            {
+                g_ping.options.keep_samples = true;
+                break;
+            }
+            case 'K':
+            {
+                if (strcmp (optarg, "software") == 0)
+                {
+                    g_ping.options.timestamping = TS_SOFTWARE;
+                }
+                else if (strcmp (optarg, "hardware") == 0)
+                {
+                    g_ping.options.timestamping = TS_HARDWARE;
+                }
+                else
+                {
+                    fprintf (stderr, "Invalid timestamping mode: %s\n",
+                             optarg);
+                    show_usage_and_exit (EXIT_FAILURE);
+                }
+                break;
+            }
+            case 'j':
+            {
+                char *endptr;
+                errno = 0;
+                long value = strtol (optarg, &endptr, 10);
+
+                if (errno == ERANGE || value < 0 || value > WORKERS_MAX
+                    || *endptr != '\0')
+                {
+                    fprintf (stderr, "Invalid workers value: %s\n", optarg);
+                    show_usage_and_exit (EXIT_FAILURE);
+                }
+
+                if (value == 0)
+                {
+                    value = sysconf (_SC_NPROCESSORS_ONLN);
+                    value = value < 1             ? 1
+                            : value > WORKERS_MAX ? WORKERS_MAX
+                                                  : value;
+                }
+
+                g_ping.options.workers = (uint32_t)value;
+                break;
+            }
+            case 's':
+            {
+                char *endptr;
+                errno = 0;
+                long value = strtol (optarg, &endptr, 10);
+
+                if (errno == ERANGE || value < 0 || value > MAX_DATALEN
+                    || *endptr != '\0')
+                {
+                    fprintf (stderr, "Invalid packet size: %s\n", optarg);
+                    show_usage_and_exit (EXIT_FAILURE);
+                }
+
+                g_ping.options.datalen = (uint16_t)value;
+                break;
+            }
+            case 'p':
+            {
+                if (parse_pattern (optarg) == -1)
+                {
+                    fprintf (stderr, "Invalid pattern: %s\n", optarg);
+                    show_usage_and_exit (EXIT_FAILURE);
+                }
+                break;
+            }
+            case 'C':
+            {
+                g_ping.options.cache_path = optarg;
+                break;
+            }
+            case 'a':
+            {
+                g_ping.options.all_addresses = true;
+                break;
+            }
+            case 'F':
+            {
+                if (strcmp (optarg, "text") == 0)
+                {
+                    g_ping.options.format = FORMAT_TEXT;
+                }
+                else if (strcmp (optarg, "json") == 0)
+                {
+                    g_ping.options.format = FORMAT_JSON;
+                }
+                else if (strcmp (optarg, "csv") == 0)
+                {
+                    g_ping.options.format = FORMAT_CSV;
+                }
+                else
+                {
+                    fprintf (stderr, "Invalid output format: %s\n", optarg);
+                    show_usage_and_exit (EXIT_FAILURE);
+                }
+                break;
+            }
+            case 'D':
+            {
+                g_ping.options.metrics = optarg;
+                break;
+            }
+            case 'S':
+            {
+                g_ping.options.stats_shm = optarg;
+                break;
+            }
+            case 'I':
+            {
+                if (strcmp (optarg, "socket") == 0)
+                {
+                    g_ping.options.io = IO_SOCKET;
+                }
+                else if (strcmp (optarg, "io_uring") == 0)
+                {
+                    g_ping.options.io = IO_URING;
+                }
+                else if (strcmp (optarg, "packet") == 0)
+                {
+                    g_ping.options.io = IO_PACKET;
+                }
+                else
+                {
+                    fprintf (stderr, "Invalid I/O backend: %s\n", optarg);
+                    show_usage_and_exit (EXIT_FAILURE);
+                }
+                break;
+            }
             case '4':
             {
                 g_ping.options.ipv = IPV4;
@@ -146,12 +455,18 @@ main (int argc, char *argv[])
         }
     }
 
-    if (optind != argc - 1)
+    if (optind >= argc)
     {
         show_usage_and_exit (EXIT_FAILURE);
     }
 
-    argv += optind;
-    ping_coord (*argv);
+    set_default_interval ();
+
+    if (g_ping.options.metrics != NULL)
+    {
+        signal (SIGTERM, handle_sig);
+    }
+
+    ping_coord (argc - optind, argv + optind);
     return g_ping.info.exit_code;
 }
@@ -1,19 +1,84 @@
 #include "ft_ping.h"
 
+static void
+release_icmp_socket (struct s_icmp_socket *sock)
+{
+    if (sock->fd != -1)
+    {
+        close (sock->fd);
+    }
+    free (sock->tx_seq);
+}
+
 void
 release_resources ()
 {
-    struct s_rtt *tmp;
-    struct s_rtt *next;
+    ping_resolve_release ();
+    ping_output_flush ();
+    free (g_ping.output.buf);
+    g_ping.output.buf = NULL;
+
+    for (uint32_t i = 0; i < g_ping.nb_targets; ++i)
+    {
+        free (g_ping.targets[i].samples);
+        free (g_ping.targets[i].stats.histogram);
+        free (g_ping.targets[i].hops);
+    }
+    free (g_ping.stats.histogram);
+
+    free (g_ping.targets);
+    free (g_ping.probes);
+    free (g_ping.answered);
+    if (g_ping.batch != NULL)
+    {
+        free (g_ping.batch->buffers);
+    }
+    free (g_ping.batch);
+    ping_io_release ();
+    release_icmp_socket (&g_ping.sock_info.v4);
+    release_icmp_socket (&g_ping.sock_info.v6);
+
+    if (g_ping.event.timer_fd != -1)
+    {
+        close (g_ping.event.timer_fd);
+    }
+    if (g_ping.event.epoll_fd != -1)
+    {
+        close (g_ping.event.epoll_fd);
+    }
+    if (g_ping.event.stop_fd != -1)
+    {
+        close (g_ping.event.stop_fd);
+    }
+    if (g_ping.event.resolve_fd != -1)
+    {
+        close (g_ping.event.resolve_fd);
+    }
+}
 
-    tmp = g_ping.rtt_metrics_beg;
+void
+timespec_add (struct timespec *ts, const struct timespec *delta)
+{
+    ts->tv_sec += delta->tv_sec;
+    ts->tv_nsec += delta->tv_nsec;
 
-    while (tmp != NULL)
+    if (ts->tv_nsec >= 1000000000)
     {
-        next = tmp->next;
-        free (tmp);
-        tmp = next;
+        ts->tv_sec += 1;
+        ts->tv_nsec -= 1000000000;
     }
+}
 
-    close (g_ping.sock_info.sock_fd);
-}
\ No newline at end of file
+int
+timespec_cmp (const struct timespec *a, const struct timespec *b)
+{
+    if (a->tv_sec != b->tv_sec)
+    {
+        return a->tv_sec < b->tv_sec ? -1 : 1;
+    }
+    if (a->tv_nsec != b->tv_nsec)
+    {
+        return a->tv_nsec < b->tv_nsec ? -1 : 1;
+    }
+    return 0;
+}
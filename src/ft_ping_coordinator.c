@@ -1,302 +1,682 @@
 #include "ft_ping.h"
 
 /**
- * @brief This function resolves a hostname that will be the ping destination
- * target, we are dealing with IPV4 & 6, The getaddrinfo() function allocates
- * and initializes a linked list of addrinfo structures. There are several
- * reasons why the linked list may have more than one addrinfo structure :
- * - Multihoming (A network host can be reached via multiple IP addresses)
- * - Multiple protocols (AF_INET (IPv4) and AF_INET6 (IPv6))
- * - Various socket types (The same service can be reached via different socket
- * types, such as SOCK_STREAM (TCP) and SOCK_DGRAM (UDP))
- * @param hostname destination hostname
+ * @brief Gives up on a request the kernel refused to send because of its
+ * destination, a target without a route typically. Only that target is
+ * affected: the error is reported and the probe is declared lost at once,
+ * the rest of the burst and the other targets are still probed. A daemon
+ * probing indefinitely only reports the first error of a target, the
+ * following ones are counted in its metrics.
+ * @param index position of the request in the burst being sent
+ * @param err errno of the failed send
  */
 
-static int
-resolve_hostname (const char *hostname)
+void
+ping_send_failed (int index, int err)
 {
-    struct addrinfo hints, *res, *p;
-    int status;
-    ip_version ipv = UNSPEC;
-
-    memset (&hints, 0, sizeof hints);
-    hints.ai_family = AF_UNSPEC;
-    hints.ai_socktype = SOCK_RAW;
-    // hints.ai_flags = AI_CANONNAME; invalid read sizes
+    uint64_t sequence = g_ping.stats.nb_snd + 1 + index;
+    struct s_probe *probe = &g_ping.probes[sequence & (PROBE_RING_SIZE - 1)];
+    struct s_target *target;
 
-    if ((status = getaddrinfo (hostname, NULL, &hints, &res)) != 0)
+    if (!probe->outstanding)
     {
-        fprintf (stderr, "getaddrinfo: %s\n", gai_strerror (status));
-        return -1;
+        return;
     }
+    target = &g_ping.targets[probe->target];
+    if (++target->stats.nb_send_err == 1 || g_ping.options.metrics == NULL)
+    {
+        fprintf (stderr, "sendmsg to %s: %s\n", target->ip_addr,
+                 strerror (err));
+    }
+    ping_wheel_remove (probe);
+    lost_rtt_metrics (probe);
+}
+
+/**
+ * @brief Hands the requests filled at the beginning of the send vector over
+ * to the I/O backend, for the socket of their address family.
+ * @param ipv address family of the requests
+ * @param count number of requests filled
+ */
+
+static void
+flush_icmp_batch (ip_version ipv, int count)
+{
+    struct s_icmp_socket *sock
+        = ipv == IPV6 ? &g_ping.sock_info.v6 : &g_ping.sock_info.v4;
+
+    g_ping.io->send (sock, g_ping.batch->snd_msgs, count);
 
-    for (p = res; p != NULL; p = p->ai_next)
+    /* The kernel numbers the transmit stamps of a socket in send order, a
+     * request it refused is no longer outstanding and takes no number. */
+
+    if (sock->tx_seq != NULL)
     {
-        if (p->ai_family == AF_INET)
+        for (int i = 0; i < count; ++i)
         {
-            struct sockaddr_in *ipv4 = (struct sockaddr_in *)p->ai_addr;
-            void *addr = &(ipv4->sin_addr);
+            uint64_t sequence = g_ping.stats.nb_snd + 1 + i;
 
-            if (inet_ntop (p->ai_family, addr, g_ping.sock_info.ip_addr,
-                           sizeof (g_ping.sock_info.ip_addr))
-                == NULL)
+            if (g_ping.probes[sequence & (PROBE_RING_SIZE - 1)].outstanding)
             {
-                perror ("inet_ntop IPv4");
-                continue;
+                sock->tx_seq[sock->tx_key++ & (PROBE_RING_SIZE - 1)]
+                    = (uint16_t)sequence;
             }
-            memcpy (&g_ping.sock_info.ai, p, sizeof (struct addrinfo));
-            // PING_DEBUG ("IPv4 addr for %s: %s\n", hostname,
-            //             g_ping.sock_info.ip_addr);
+        }
+    }
 
-            ipv = IPV4;
+    g_ping.stats.nb_snd += count;
+}
 
-            if (g_ping.options.ipv == UNSPEC || g_ping.options.ipv == IPV4)
-            {
-                break;
-            }
+/**
+ * @brief Sets the TTL of a single request through its control message, the
+ * requests of one sendmmsg() may then leave with different TTLs. Outside of
+ * path mode, the TTL of the socket applies.
+ * @param hdr message of the request
+ * @param control control buffer of the request
+ * @param ipv address family of the request
+ * @param ttl TTL of a path probe, 0 otherwise
+ */
+
+static void
+set_request_ttl (struct msghdr *hdr, char *control, ip_version ipv,
+                 uint8_t ttl)
+{
+    struct cmsghdr *cmsg;
+    int value = ttl;
+
+    if (ttl == 0)
+    {
+        hdr->msg_control = NULL;
+        hdr->msg_controllen = 0;
+        return;
+    }
+
+    hdr->msg_control = control;
+    hdr->msg_controllen = CMSG_SPACE (sizeof (value));
+    cmsg = CMSG_FIRSTHDR (hdr);
+    cmsg->cmsg_level = ipv == IPV6 ? IPPROTO_IPV6 : IPPROTO_IP;
+    cmsg->cmsg_type = ipv == IPV6 ? IPV6_HOPLIMIT : IP_TTL;
+    cmsg->cmsg_len = CMSG_LEN (sizeof (value));
+    memcpy (CMSG_DATA (cmsg), &value, sizeof (value));
+}
+
+/**
+ * @brief Turns a target has taken so far. A path target sends one request
+ * per hop on each turn, hop 1 is probed on every turn.
+ */
+
+static uint64_t
+target_turns (const struct s_target *target)
+{
+    return target->hops != NULL ? target->hops[0].nb_snd
+                                : target->stats.nb_snd;
+}
+
+/**
+ * @brief Sends a burst of Echo Requests, interleaved across the targets in
+ * round robin. Consecutive requests of the same address family go out with
+ * a single sendmmsg(). Every request is stamped right before the syscall,
+ * the kernel emits them back to back so a shared syscall does not distort
+ * the individual RTTs. With a count, the turn of a target that already
+ * sent its requests is skipped, which happens when a target resolved late
+ * joins the others. In path mode, the turn of a target sends one request
+ * with each TTL from 1 to the length of its path, the whole path is probed
+ * at once.
+ * @param count number of turns, at most SEND_BURST_MAX
+ * @return the number of requests sent.
+ */
+
+static int
+send_icmp_batch (int count)
+{
+    struct s_batch *batch = g_ping.batch;
+    uint64_t first = g_ping.stats.nb_snd;
+    ip_version ipv = UNSPEC;
+    int filled = 0;
+
+    for (int i = 0; i < count; ++i)
+    {
+        uint32_t index = g_ping.info.next_target;
+        struct s_target *target = &g_ping.targets[index];
+        uint8_t hops = target->hops != NULL ? target->path_len : 1;
+
+        g_ping.info.next_target = (index + 1) % g_ping.nb_targets;
+        if (g_ping.options.count && target_turns (target) >= g_ping.options.count)
+        {
+            continue;
         }
-        else if (p->ai_family == AF_INET6)
+        ++g_ping.event.nb_turns;
+
+        for (uint8_t hop = 1; hop <= hops; ++hop)
         {
-            struct sockaddr_in6 *ipv6 = (struct sockaddr_in6 *)p->ai_addr;
-            void *addr = &(ipv6->sin6_addr);
+            struct msghdr *hdr = &batch->snd_msgs[filled].msg_hdr;
+            uint8_t ttl = target->hops != NULL ? hop : 0;
+            const struct s_probe *probe;
+            uint64_t sequence;
 
-            if (inet_ntop (p->ai_family, addr, g_ping.sock_info.ip_addr,
-                           sizeof (g_ping.sock_info.ip_addr))
-                == NULL)
+            if (filled > 0 && (target->ipv != ipv || filled == SEND_BURST_MAX))
             {
-                perror ("inet_ntop IPv6");
-                continue;
+                flush_icmp_batch (ipv, filled);
+                filled = 0;
+                hdr = &batch->snd_msgs[0].msg_hdr;
             }
-            memcpy (&g_ping.sock_info.ai, p, sizeof (struct addrinfo));
-            // PING_DEBUG ("IPv6 addr for %s: %s\n", hostname,
-            //             g_ping.sock_info.ip_addr);
+            ipv = target->ipv;
+            sequence = g_ping.stats.nb_snd + 1 + filled;
+            probe = start_rtt_metrics (sequence, index, ttl);
 
-            ipv = IPV6;
-
-            if (g_ping.options.ipv == UNSPEC || g_ping.options.ipv == IPV6)
+            if (ipv == IPV6)
             {
-                break;
+                fill_icmp_packet_v6 (batch->snd_iov[filled].iov_base,
+                                     (uint16_t)sequence, &probe->sent);
+                hdr->msg_name = &target->addr_6;
+                hdr->msg_namelen = sizeof (target->addr_6);
+            }
+            else
+            {
+                fill_icmp_packet_v4 (batch->snd_iov[filled].iov_base,
+                                     (uint16_t)sequence, &probe->sent);
+                hdr->msg_name = &target->addr_4;
+                hdr->msg_namelen = sizeof (target->addr_4);
             }
+            set_request_ttl (hdr, batch->snd_ctrl[filled], ipv, ttl);
+            ++filled;
         }
     }
 
-    g_ping.options.ipv = ipv;
+    if (filled > 0)
+    {
+        flush_icmp_batch (ipv, filled);
+    }
+    return g_ping.stats.nb_snd - first;
+}
+
+/**
+ * @brief Checks that a reply comes from the destination of the probe it
+ * answers, the sequence alone does not identify the target.
+ * @param probe probe matched by the reply sequence
+ * @param msg received message holding the source address
+ */
+
+static _Bool
+reply_from_target (const struct s_probe *probe, const struct msghdr *msg)
+{
+    const struct s_target *target = &g_ping.targets[probe->target];
 
-    if (res->ai_canonname)
+    if (target->ipv == IPV6)
     {
-        memcpy (g_ping.sock_info.ai_canonname, res->ai_canonname,
-                sizeof (g_ping.sock_info.ai_canonname));
-        g_ping.sock_info.ai.ai_canonname = g_ping.sock_info.ai_canonname;
+        const struct sockaddr_in6 *from = msg->msg_name;
+
+        return from->sin6_family == AF_INET6
+               && memcmp (&from->sin6_addr, &target->addr_6.sin6_addr,
+                          sizeof (struct in6_addr))
+                      == 0;
     }
+    const struct sockaddr_in *from = msg->msg_name;
+
+    return from->sin_family == AF_INET
+           && from->sin_addr.s_addr == target->addr_4.sin_addr.s_addr;
+}
 
-    freeaddrinfo (res);
+/**
+ * @brief Formats an IPv4 or IPv6 address.
+ * @param from address to format
+ * @param buf buffer of INET6_ADDRSTRLEN bytes
+ * @return buf
+ */
 
-    if (p == NULL && ipv == UNSPEC)
+static const char *
+format_addr (const struct sockaddr *from, char *buf)
+{
+    if (from->sa_family == AF_INET6)
+    {
+        inet_ntop (AF_INET6, &((const struct sockaddr_in6 *)from)->sin6_addr,
+                   buf, INET6_ADDRSTRLEN);
+    }
+    else
     {
-        fprintf (stderr, "No valid IPv4 or IPv6 address found for %s\n",
-                 hostname);
-        return -1;
+        inet_ntop (AF_INET, &((const struct sockaddr_in *)from)->sin_addr, buf,
+                   INET6_ADDRSTRLEN);
     }
+    return buf;
+}
 
-    g_ping.sock_info.hostname = hostname;
+/**
+ * @brief Formats the source address of a received message.
+ * @param msg received message holding the source address
+ * @param buf buffer of INET6_ADDRSTRLEN bytes
+ * @return buf
+ */
 
-    return 0;
+static const char *
+source_addr (const struct msghdr *msg, char *buf)
+{
+    return format_addr (msg->msg_name, buf);
 }
 
+/**
+ * @brief Reports an ICMP error about one of our requests, received on a raw
+ * socket or through the error queue of a datagram socket.
+ * @param ipv address family of the error
+ * @param type ICMP type
+ * @param code ICMP code
+ * @param mtu next hop MTU of a Packet Too Big error
+ * @param from address of the router or host reporting the error
+ */
+
 static void
-send_icmp_packet_v4 ()
+icmp_error_message (ip_version ipv, uint8_t type, uint8_t code, uint32_t mtu,
+                    const char *from)
 {
-    struct ping_packet_v4 ping_pkt;
+    if (g_ping.options.format != FORMAT_TEXT)
+    {
+        ping_output_error (type, code, mtu, from);
+        return;
+    }
 
-    fill_icmp_packet_v4 (&ping_pkt);
-    start_rtt_metrics ();
+    if (ipv == IPV6)
+    {
+        switch (type)
+        {
+            case ICMP6_DST_UNREACH:
+                printf ("Destination Unreachable: Code %d.\n", code);
+                break;
+            case ICMP6_PACKET_TOO_BIG:
+                printf ("Packet Too Big: MTU size is %u.\n", mtu);
+                break;
+            case ICMP6_TIME_EXCEEDED:
+                printf ("Time Exceeded: Hop limit exceeded in transit for "
+                        "%s.\n",
+                        from);
+                break;
+            default:
+                printf ("Unhandled ICMPv6 type %d received from %s.\n", type,
+                        from);
+                break;
+        }
+        return;
+    }
 
-    if (sendto (g_ping.sock_info.sock_fd, &ping_pkt,
-                sizeof (struct ping_packet_v4), 0,
-                (struct sockaddr *)&g_ping.sock_info.addr_4,
-                sizeof (g_ping.sock_info.addr_4))
-        == -1)
+    switch (type)
     {
-        perror ("sendto");
-        release_resources ();
-        exit (EXIT_FAILURE);
+        case ICMP_DEST_UNREACH:
+            printf ("Destination Unreachable: Code %d.\n", code);
+            break;
+        case ICMP_TIME_EXCEEDED:
+            printf ("Time Exceeded: TTL expired for %s.\n", from);
+            break;
+        default:
+            printf ("Unhandled ICMP type %d received from %s.\n", type, from);
+            break;
     }
-    ++g_ping.stats.nb_snd;
-    // PING_DEBUG ("Ping sent to %s\n", g_ping.sock_info.ip_addr);
 }
 
+/**
+ * @brief Picks the stamp matching the timestamping mode out of a
+ * SCM_TIMESTAMPING control message, the hardware one when the NIC provided
+ * it and the software one otherwise.
+ * @param tss stamps reported by the kernel
+ * @param stamp selected stamp, of kind TS_NONE if none is usable
+ */
+
 static void
-send_icmp_packet_v6 ()
+select_kstamp (const struct scm_timestamping *tss, struct s_kstamp *stamp)
 {
-    struct ping_packet_v6 ping_pkt;
-
-    fill_icmp_packet_v6 (&ping_pkt);
-    start_rtt_metrics ();
+    stamp->kind = TS_NONE;
 
-    if (sendto (g_ping.sock_info.sock_fd, &ping_pkt,
-                sizeof (struct ping_packet_v6), 0,
-                (struct sockaddr *)&g_ping.sock_info.addr_6,
-                sizeof (g_ping.sock_info.addr_6))
-        == -1)
+    if (g_ping.options.timestamping == TS_HARDWARE
+        && (tss->ts[2].tv_sec || tss->ts[2].tv_nsec))
     {
-        perror ("sendto");
-        release_resources ();
-        exit (EXIT_FAILURE);
+        stamp->ts = tss->ts[2];
+        stamp->kind = TS_HARDWARE;
+    }
+    else if (tss->ts[0].tv_sec || tss->ts[0].tv_nsec)
+    {
+        stamp->ts = tss->ts[0];
+        stamp->kind = TS_SOFTWARE;
     }
-
-    ++g_ping.stats.nb_snd;
-    // PING_DEBUG ("Ping sent to %s\n", g_ping.sock_info.ip_addr);
 }
 
+/**
+ * @brief Converts the software receive stamp of a datagram to
+ * CLOCK_MONOTONIC, the clock used for the send times. The offset between
+ * both clocks is sampled once per batch, right after recvmmsg().
+ * @param msg received message carrying the control messages
+ * @param mono CLOCK_MONOTONIC time sampled after recvmmsg()
+ * @param real CLOCK_REALTIME time sampled after recvmmsg()
+ * @param received receive time, left to mono if the kernel did not stamp it
+ * @param rx_stamp raw kernel stamp when SO_TIMESTAMPING is enabled
+ */
+
 static void
-recv_icmp_packet_v4 ()
+rx_timestamp (struct msghdr *msg, const struct timespec *mono,
+              const struct timespec *real, struct timespec *received,
+              struct s_kstamp *rx_stamp)
 {
-    char recv_packet[PACKET_SIZE + sizeof (struct iphdr)];
-    struct sockaddr_in r_addr;
-    socklen_t addr_len;
+    struct cmsghdr *cmsg;
+    struct timespec stamp;
+    int64_t age_ns;
+    int64_t received_ns;
+
+    *received = *mono;
+    rx_stamp->kind = TS_NONE;
+
+    for (cmsg = CMSG_FIRSTHDR (msg); cmsg != NULL;
+         cmsg = CMSG_NXTHDR (msg, cmsg))
+    {
+        if (cmsg->cmsg_level != SOL_SOCKET)
+        {
+            continue;
+        }
+        if (cmsg->cmsg_type == SCM_TIMESTAMPNS)
+        {
+            memcpy (&stamp, CMSG_DATA (cmsg), sizeof (stamp));
+            break;
+        }
+        if (cmsg->cmsg_type == SCM_TIMESTAMPING)
+        {
+            struct scm_timestamping tss;
+
+            memcpy (&tss, CMSG_DATA (cmsg), sizeof (tss));
+            select_kstamp (&tss, rx_stamp);
+            stamp = tss.ts[0];
+            break;
+        }
+    }
+
+    if (cmsg == NULL)
+    {
+        return;
+    }
+
+    age_ns = (int64_t)(real->tv_sec - stamp.tv_sec) * 1000000000
+             + (real->tv_nsec - stamp.tv_nsec);
+    if (age_ns < 0)
+    {
+        return;
+    }
+    received_ns = (int64_t)mono->tv_sec * 1000000000 + mono->tv_nsec - age_ns;
+    received->tv_sec = received_ns / 1000000000;
+    received->tv_nsec = received_ns % 1000000000;
+}
 
-    addr_len = sizeof (r_addr);
+/**
+ * @brief Samples CLOCK_MONOTONIC and CLOCK_REALTIME as one instant. The
+ * monotonic read is bracketed by two realtime reads, the narrowest bracket
+ * out of a few attempts is kept so that a preemption between the reads does
+ * not skew the conversion of the receive stamps.
+ * @param mono CLOCK_MONOTONIC time
+ * @param real CLOCK_REALTIME time, midpoint of the bracket
+ */
 
-    g_ping.info.bytes_recv
-        = recvfrom (g_ping.sock_info.sock_fd, recv_packet, sizeof (recv_packet),
-                    MSG_DONTWAIT, (struct sockaddr *)&r_addr, &addr_len);
+void
+sample_clocks (struct timespec *mono, struct timespec *real)
+{
+    int64_t best = INT64_MAX;
 
-    if (g_ping.info.bytes_recv <= 0)
+    for (int i = 0; i < 3; ++i)
     {
-        if (errno == EAGAIN || errno == EWOULDBLOCK)
+        struct timespec before, m, after;
+        int64_t before_ns, after_ns;
+
+        clock_gettime (CLOCK_REALTIME, &before);
+        clock_gettime (CLOCK_MONOTONIC, &m);
+        clock_gettime (CLOCK_REALTIME, &after);
+
+        before_ns = (int64_t)before.tv_sec * 1000000000 + before.tv_nsec;
+        after_ns = (int64_t)after.tv_sec * 1000000000 + after.tv_nsec;
+
+        if (after_ns - before_ns < best)
         {
-            return;
+            int64_t mid_ns = before_ns + (after_ns - before_ns) / 2;
+
+            best = after_ns - before_ns;
+            *mono = m;
+            real->tv_sec = mid_ns / 1000000000;
+            real->tv_nsec = mid_ns % 1000000000;
         }
-        if (g_ping.info.bytes_recv == -1)
+    }
+}
+
+/**
+ * @brief Checks the payload of an Echo Reply against the one of its request,
+ * a truncated or altered payload is reported but the reply still counts.
+ * @param probe probe answered by the reply
+ * @param data payload of the reply
+ * @param len received payload length
+ * @param ipv address family of the reply
+ */
+
+static void
+check_reply_payload (const struct s_probe *probe, const uint8_t *data,
+                     ssize_t len, ip_version ipv)
+{
+    struct s_info *info = &g_ping.info;
+
+    info->status = REPLY_OK;
+    info->data_len = len < 0 ? 0 : len;
+
+    if (len < g_ping.options.datalen)
+    {
+        info->status = REPLY_TRUNCATED;
+        if (len <= 0)
         {
-            perror ("recvfrom");
+            return;
         }
-        else
+    }
+    else
+    {
+        len = g_ping.options.datalen;
+    }
+
+    if ((info->wrong_byte
+         = payload_mismatch (probe, data, len, ipv, &info->should_be))
+        != -1)
+    {
+        info->status = REPLY_CORRUPT;
+        info->was = data[info->wrong_byte];
+    }
+}
+
+/**
+ * @brief Matches a Time Exceeded message with the path probe it quotes, the
+ * quoted Echo Request carries our identifier and the sequence of the probe.
+ * The router that sent the message is the hop at the TTL of the probe.
+ * @param ipv address family of the message
+ * @param echo quoted Echo Request, its first 8 bytes at least
+ * @param dst destination address of the quoted request
+ * @param ident identifier of the socket the request left on
+ * @param from address of the router
+ * @param received CLOCK_MONOTONIC time at which the message was received
+ * @param rx_stamp kernel receive stamp of the message
+ * @return true if the message was about one of our path probes.
+ */
+
+static _Bool
+path_hop_reply (ip_version ipv, const uint8_t *echo, const void *dst,
+                uint16_t ident, const struct sockaddr *from,
+                const struct timespec *received,
+                const struct s_kstamp *rx_stamp)
+{
+    const struct s_target *target;
+    struct s_probe *probe;
+    uint16_t id, sequence;
+
+    memcpy (&id, echo + 4, sizeof (id));
+    memcpy (&sequence, echo + 6, sizeof (sequence));
+    if (g_ping.options.path_hops == 0
+        || echo[0] != (ipv == IPV6 ? ICMP6_ECHO_REQUEST : ICMP_ECHO)
+        || id != htons (ident)
+        || (probe = probe_find (ntohs (sequence))) == NULL || probe->ttl == 0)
+    {
+        return false;
+    }
+
+    target = &g_ping.targets[probe->target];
+    if (target->ipv != ipv
+        || (ipv == IPV6 ? memcmp (dst, &target->addr_6.sin6_addr,
+                                  sizeof (struct in6_addr))
+                        : memcmp (dst, &target->addr_4.sin_addr,
+                                  sizeof (struct in_addr)))
+               != 0)
+    {
+        return false;
+    }
+
+    hop_rtt_metrics (probe, from, received, rx_stamp);
+    ping_messages_handler (HOP);
+    return true;
+}
+
+/**
+ * @brief Reads the TTL of a reply received on a datagram socket from the
+ * IP_TTL control message.
+ */
+
+static uint8_t
+recv_ttl (struct msghdr *msg)
+{
+    struct cmsghdr *cmsg;
+
+    for (cmsg = CMSG_FIRSTHDR (msg); cmsg != NULL;
+         cmsg = CMSG_NXTHDR (msg, cmsg))
+    {
+        if (cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_TTL)
         {
-            fprintf (stderr, "The peer has performed an orderly shutdown.");
+            int ttl;
+            memcpy (&ttl, CMSG_DATA (cmsg), sizeof (ttl));
+            return ttl;
         }
-        g_ping.info.read_loop = g_ping.info.exit_code = false;
     }
+    return 0;
+}
+
+static void
+handle_icmp_packet_v4 (const struct s_icmp_socket *sock, struct msghdr *msg,
+                       const struct timespec *received,
+                       const struct s_kstamp *rx_stamp)
+{
+    char *recv_packet = msg->msg_iov->iov_base;
+    struct icmphdr *icmp_hdr;
+
+    /* On a raw socket, the response includes the IP header followed by the
+     * ICMP header. It is necessary to extract the IP header to access the
+     * ICMP header. A datagram socket only delivers the ICMP message. */
 
-    /* The response includes the IP header followed by the ICMP header. It is
-     * necessary to extract the IP header to access the ICMP header. */
+    if (sock->dgram)
+    {
+        icmp_hdr = (struct icmphdr *)recv_packet;
+        g_ping.info.hopli = recv_ttl (msg);
+    }
+    else
+    {
+        struct iphdr *ip_hdr = (struct iphdr *)recv_packet;
 
-    struct iphdr *ip_hdr = (struct iphdr *)recv_packet;
-    struct icmphdr *icmp_hdr
-        = (struct icmphdr *)(recv_packet + ip_hdr->ihl * 4);
+        icmp_hdr = (struct icmphdr *)(recv_packet + ip_hdr->ihl * 4);
+        g_ping.info.hopli = ip_hdr->ttl;
+        g_ping.info.bytes_recv -= ip_hdr->ihl * 4;
+    }
 
-    g_ping.info.hopli = ip_hdr->ttl;
-    g_ping.info.sequence = ntohs (icmp_hdr->un.echo.sequence);
+    uint16_t sequence = ntohs (icmp_hdr->un.echo.sequence);
+    struct s_probe *probe;
+    char from[INET6_ADDRSTRLEN];
 
     // PING_DEBUG ("Received ICMP packet:\n");
     // PING_DEBUG ("Type: %d\n", icmp_hdr->type);
     // PING_DEBUG ("Code: %d\n", icmp_hdr->code);
     // PING_DEBUG ("Checksum: %d\n", icmp_hdr->checksum);
-    // PING_DEBUG ("Sequence: %d\n", g_ping.info.sequence);
+    // PING_DEBUG ("Sequence: %d\n", sequence);
     // PING_DEBUG ("Identifier: %d\n", ntohs (icmp_hdr->un.echo.id));
 
-    if (verify_checksum ((struct ping_packet_v4 *)icmp_hdr) == false)
+    /* A corrupted message is dropped, it does not end the session. */
+
+    if (verify_checksum (icmp_hdr, g_ping.info.bytes_recv) == false)
     {
-        fprintf (stderr, "Received corrupted ICMPv4 packet\n");
-        g_ping.info.read_loop = false;
+        fprintf (stderr, "Received corrupted ICMPv4 packet from %s\n",
+                 source_addr (msg, from));
+        return;
     }
 
     switch (icmp_hdr->type)
     {
         case ICMP_ECHOREPLY:
-            if (icmp_hdr->un.echo.id == htons (getpid ())
-                && icmp_hdr->un.echo.sequence
-                       == htons (g_ping.info.sequence))
+            if (icmp_hdr->un.echo.id == htons (sock->ident)
+                && (probe = probe_find (sequence)) != NULL
+                && reply_from_target (probe, msg))
             {
-                end_rtt_metrics ();
+                end_rtt_metrics (probe, received, rx_stamp);
+                check_reply_payload (probe,
+                                     (const uint8_t *)(icmp_hdr + 1),
+                                     g_ping.info.bytes_recv
+                                         - sizeof (struct icmphdr),
+                                     IPV4);
                 ping_messages_handler (PING);
-                ++g_ping.stats.nb_res;
             }
             break;
         case ICMP_ECHO:
             PING_DEBUG ("Ignoring my own ICMP_ECHO request.\n");
             break;
-        case ICMP_DEST_UNREACH:
-            printf ("Destination Unreachable: Code %d.\n", icmp_hdr->code);
-            break;
-        case ICMP6_PACKET_TOO_BIG:
-            printf ("Packet Too Big: MTU size is %u.\n",
-                    ntohl (icmp_hdr->un.frag.mtu));
-            break;
         case ICMP_TIME_EXCEEDED:
-            printf ("Time Exceeded: TTL expired for %s.\n",
-                    g_ping.sock_info.ip_addr);
+        {
+            /* A raw socket sees the quoted IP header, then the quoted Echo
+             * Request. */
+
+            const struct iphdr *quoted = (const struct iphdr *)(icmp_hdr + 1);
+            ssize_t len = g_ping.info.bytes_recv - sizeof (struct icmphdr);
+
+            if (len >= (ssize_t)sizeof (struct iphdr)
+                && quoted->protocol == IPPROTO_ICMP
+                && len >= quoted->ihl * 4 + (ssize_t)sizeof (struct icmphdr)
+                && path_hop_reply (IPV4,
+                                   (const uint8_t *)quoted + quoted->ihl * 4,
+                                   &quoted->daddr, sock->ident, msg->msg_name,
+                                   received, rx_stamp))
+            {
+                break;
+            }
+            icmp_error_message (IPV4, icmp_hdr->type, icmp_hdr->code,
+                                ntohs (icmp_hdr->un.frag.mtu),
+                                source_addr (msg, from));
             break;
+        }
         default:
-            printf ("Unhandled ICMP type %d received from %s.\n",
-                    icmp_hdr->type, g_ping.sock_info.ip_addr);
+            icmp_error_message (IPV4, icmp_hdr->type, icmp_hdr->code,
+                                ntohs (icmp_hdr->un.frag.mtu),
+                                source_addr (msg, from));
             break;
     }
 }
 
 static void
-recv_icmp_packet_v6 ()
+handle_icmp_packet_v6 (const struct s_icmp_socket *sock, struct msghdr *msg,
+                       const struct timespec *received,
+                       const struct s_kstamp *rx_stamp)
 {
-    char recv_packet[PACKET_SIZE + sizeof (struct iphdr)];
-    struct msghdr msg;
-    struct iovec iov;
-    char control_buf[CONTROL_BUFFER_SIZE];
-    struct cmsghdr *cmsg;
-
-    iov.iov_base = recv_packet;
-    iov.iov_len = sizeof (recv_packet);
-
-    memset (&msg, 0, sizeof (msg));
-    msg.msg_iov = &iov;
-    msg.msg_iovlen = 1;
-    msg.msg_control = control_buf;
-    msg.msg_controllen = sizeof (control_buf);
-
-    g_ping.info.bytes_recv
-        = recvmsg (g_ping.sock_info.sock_fd, &msg, MSG_DONTWAIT);
-
-    if (g_ping.info.bytes_recv <= 0)
-    {
-        if (errno == EAGAIN || errno == EWOULDBLOCK)
-        {
-            return;
-        }
-        if (g_ping.info.bytes_recv == -1)
-        {
-            perror ("recvmsg");
-        }
-        else
-        {
-            fprintf (stderr, "The peer has performed an orderly shutdown.");
-        }
-        g_ping.info.read_loop = g_ping.info.exit_code = false;
-    }
-
-    struct icmp6_hdr *icmp6_hdr = (struct icmp6_hdr *)recv_packet;
+    struct icmp6_hdr *icmp6_hdr = (struct icmp6_hdr *)msg->msg_iov->iov_base;
     uint8_t type = icmp6_hdr->icmp6_type;
+    uint16_t sequence = ntohs (icmp6_hdr->icmp6_dataun.icmp6_un_data16[1]);
+    struct s_probe *probe;
+    struct cmsghdr *cmsg;
+    char from[INET6_ADDRSTRLEN];
 
     g_ping.info.hopli = -1;
-    for (cmsg = CMSG_FIRSTHDR (&msg); cmsg != NULL;
-         cmsg = CMSG_NXTHDR (&msg, cmsg))
+    for (cmsg = CMSG_FIRSTHDR (msg); cmsg != NULL;
+         cmsg = CMSG_NXTHDR (msg, cmsg))
     {
         if (cmsg->cmsg_level == IPPROTO_IPV6
             && cmsg->cmsg_type == IPV6_HOPLIMIT)
         {
-            uint8_t hoplimit;
+            int hoplimit;
             memcpy (&hoplimit, CMSG_DATA (cmsg), sizeof (hoplimit));
             g_ping.info.hopli = hoplimit;
             break;
         }
     }
 
-    g_ping.info.sequence
-        = ntohs (icmp6_hdr->icmp6_dataun.icmp6_un_data16[1]);
-
     // PING_DEBUG ("Received ICMPv6 packet:\n");
     // PING_DEBUG ("Type: %d\n", type);
     // PING_DEBUG ("Code: %d\n", icmp6_hdr->icmp6_code);
     // PING_DEBUG ("Checksum: %d\n", ntohs (icmp6_hdr->icmp6_cksum));
-    // PING_DEBUG ("Sequence: %d\n", g_ping.info.sequence);
+    // PING_DEBUG ("Sequence: %d\n", sequence);
     // PING_DEBUG ("Hop Limit: %d\n", g_ping.info.hopli);
     // PING_DEBUG ("Identifier: %d\n",
     //             ntohs (icmp6_hdr->icmp6_dataun.icmp6_un_data16[0]));
@@ -304,75 +684,731 @@ recv_icmp_packet_v6 ()
     switch (type)
     {
         case ICMP6_ECHO_REPLY:
-            if (icmp6_hdr->icmp6_dataun.icmp6_un_data16[0] == htons (getpid ())
-                && g_ping.info.sequence
-                       == ntohs (icmp6_hdr->icmp6_dataun.icmp6_un_data16[1]))
+            if (icmp6_hdr->icmp6_dataun.icmp6_un_data16[0]
+                   == htons (sock->ident)
+                && (probe = probe_find (sequence)) != NULL
+                && reply_from_target (probe, msg))
             {
-                end_rtt_metrics ();
+                end_rtt_metrics (probe, received, rx_stamp);
+                check_reply_payload (probe,
+                                     (const uint8_t *)(icmp6_hdr + 1),
+                                     g_ping.info.bytes_recv
+                                         - sizeof (struct icmp6_hdr),
+                                     IPV6);
                 ping_messages_handler (PING);
-                ++g_ping.stats.nb_res;
             }
             break;
-        case ICMP6_DST_UNREACH:
-            printf ("Destination Unreachable: Code %d.\n",
-                    icmp6_hdr->icmp6_code);
-            break;
-        case ICMP6_PACKET_TOO_BIG:
-            printf ("Packet Too Big: MTU size is %u.\n",
-                    ntohl (icmp6_hdr->icmp6_mtu));
-            break;
         case ICMP6_TIME_EXCEEDED:
-            printf ("Time Exceeded: Hop limit exceeded in transit for %s.\n",
-                    g_ping.sock_info.ip_addr);
+        {
+            /* The fixed IPv6 header is quoted first, quoted extension headers
+             * are not followed. */
+
+            const struct ip6_hdr *quoted
+                = (const struct ip6_hdr *)(icmp6_hdr + 1);
+
+            if (g_ping.info.bytes_recv
+                    >= (ssize_t)(sizeof (struct icmp6_hdr)
+                                 + sizeof (struct ip6_hdr)
+                                 + sizeof (struct icmp6_hdr))
+                && quoted->ip6_nxt == IPPROTO_ICMPV6
+                && path_hop_reply (IPV6, (const uint8_t *)(quoted + 1),
+                                   &quoted->ip6_dst, sock->ident,
+                                   msg->msg_name, received, rx_stamp))
+            {
+                break;
+            }
+            icmp_error_message (IPV6, type, icmp6_hdr->icmp6_code,
+                                ntohl (icmp6_hdr->icmp6_mtu),
+                                source_addr (msg, from));
             break;
+        }
         default:
-            printf ("Unhandled ICMPv6 type %d received from %s.\n",
-                    icmp6_hdr->icmp6_type, g_ping.sock_info.ip_addr);
+            icmp_error_message (IPV6, type, icmp6_hdr->icmp6_code,
+                                ntohl (icmp6_hdr->icmp6_mtu),
+                                source_addr (msg, from));
             break;
     }
-
-    return;
 }
 
 /**
- * @brief Supervises the steps of the ping diagnosis.
- * This function is the central point regarding the supervision of the steps to
- * perform a ping diagnostic from the creation of sockets to the sending and
- * reception of ICMP packets.
- * @param hostname destination hostname
+ * @brief Dispatches one datagram received on a socket, whatever the backend
+ * that received it.
+ * @param sock socket the datagram was received on
+ * @param ipv address family of the socket
+ * @param msg received message, its address and control messages included
+ * @param len length of the datagram
+ * @param mono CLOCK_MONOTONIC time sampled once the datagram was received
+ * @param real CLOCK_REALTIME time sampled along with mono
  */
 
 void
-ping_coord (const char *hostname)
+ping_reply_handler (struct s_icmp_socket *sock, ip_version ipv,
+                    struct msghdr *msg, size_t len,
+                    const struct timespec *mono, const struct timespec *real)
 {
-    if (resolve_hostname (hostname) == -1)
+    struct timespec received;
+    struct s_kstamp rx_stamp;
+
+    g_ping.info.bytes_recv = len;
+    rx_timestamp (msg, mono, real, &received, &rx_stamp);
+
+    if (ipv == IPV6)
     {
-        fprintf (stderr, "Failed to resolve hostname\n");
-        exit (EXIT_FAILURE);
+        handle_icmp_packet_v6 (sock, msg, &received, &rx_stamp);
     }
+    else
+    {
+        handle_icmp_packet_v4 (sock, msg, &received, &rx_stamp);
+    }
+}
 
-    ping_socket_init ();
-    ping_messages_handler (START);
+/**
+ * @brief Matches a Time Exceeded message read from the error queue of a
+ * datagram socket with its path probe. The datagram is the quoted Echo
+ * Request and its address the destination of the request, the router is
+ * the offender.
+ * @return true if the message was about one of our path probes.
+ */
 
-    while (g_ping.info.read_loop)
-    {
-        if (g_ping.info.ready_send == true)
-        {
-            g_ping.info.ready_send = false;
-            g_ping.options.ipv == IPV6 ? send_icmp_packet_v6 ()
-                                       : send_icmp_packet_v4 ();
-            alarm (1);
-        }
+static _Bool
+path_error_reply (const struct s_icmp_socket *sock, ip_version ipv,
+                  struct msghdr *msg, struct sock_extended_err *serr,
+                  const struct timespec *mono, const struct timespec *real)
+{
+    const void *dst
+        = ipv == IPV6
+              ? (const void *)&((struct sockaddr_in6 *)msg->msg_name)->sin6_addr
+              : (const void *)&((struct sockaddr_in *)msg->msg_name)->sin_addr;
+    struct timespec received;
+    struct s_kstamp rx_stamp;
 
-        g_ping.options.ipv == IPV6 ? recv_icmp_packet_v6 ()
-                                   : recv_icmp_packet_v4 ();
+    rx_timestamp (msg, mono, real, &received, &rx_stamp);
+    return path_hop_reply (ipv, msg->msg_iov->iov_base, dst, sock->ident,
+                           SO_EE_OFFENDER (serr), &received, &rx_stamp);
+}
 
-        if (g_ping.options.count
-            && g_ping.stats.nb_snd >= g_ping.options.count)
+/**
+ * @brief Drains the socket error queue. It holds the transmit stamps, the
+ * OPT_ID counter numbers the requests sent on the socket from 0 and the
+ * sequence of each one was recorded in send order. On a datagram socket, it
+ * also holds the ICMP errors about our requests.
+ * @param sock socket whose error queue is drained
+ * @return the number of messages read, 0 once the error queue is drained.
+ */
+
+int
+recv_errqueue (struct s_icmp_socket *sock)
+{
+    struct s_batch *batch = g_ping.batch;
+    struct timespec mono, real;
+    int count;
+
+    for (int i = 0; i < RECV_BATCH_MAX; ++i)
+    {
+        batch->rcv_msgs[i].msg_hdr.msg_namelen = sizeof (batch->rcv_addr[i]);
+        batch->rcv_msgs[i].msg_hdr.msg_controllen = CONTROL_BUFFER_SIZE;
+    }
+
+    count = recvmmsg (sock->fd, batch->rcv_msgs, RECV_BATCH_MAX,
+                      MSG_ERRQUEUE | MSG_DONTWAIT, NULL);
+
+    if (count > 0)
+    {
+        sample_clocks (&mono, &real);
+    }
+
+    for (int i = 0; i < count; ++i)
+    {
+        struct msghdr *msg = &batch->rcv_msgs[i].msg_hdr;
+        struct sock_extended_err *serr = NULL;
+        struct s_kstamp tx_stamp = { { 0, 0 }, TS_NONE };
+        struct cmsghdr *cmsg;
+
+        for (cmsg = CMSG_FIRSTHDR (msg); cmsg != NULL;
+             cmsg = CMSG_NXTHDR (msg, cmsg))
+        {
+            if (cmsg->cmsg_level == SOL_SOCKET
+                && cmsg->cmsg_type == SCM_TIMESTAMPING)
+            {
+                struct scm_timestamping tss;
+
+                memcpy (&tss, CMSG_DATA (cmsg), sizeof (tss));
+                select_kstamp (&tss, &tx_stamp);
+            }
+            else if ((cmsg->cmsg_level == SOL_IP
+                      && cmsg->cmsg_type == IP_RECVERR)
+                     || (cmsg->cmsg_level == SOL_IPV6
+                         && cmsg->cmsg_type == IPV6_RECVERR))
+            {
+                serr = (struct sock_extended_err *)CMSG_DATA (cmsg);
+            }
+        }
+
+        if (serr != NULL && serr->ee_errno == ENOMSG
+            && serr->ee_origin == SO_EE_ORIGIN_TIMESTAMPING
+            && serr->ee_info == SCM_TSTAMP_SND && tx_stamp.kind != TS_NONE)
+        {
+            tx_stamp_metrics (
+                sock->tx_seq[serr->ee_data & (PROBE_RING_SIZE - 1)],
+                &tx_stamp);
+        }
+        else if (serr != NULL
+                 && (serr->ee_origin == SO_EE_ORIGIN_ICMP
+                     || serr->ee_origin == SO_EE_ORIGIN_ICMP6))
+        {
+            ip_version ipv
+                = serr->ee_origin == SO_EE_ORIGIN_ICMP6 ? IPV6 : IPV4;
+            char from[INET6_ADDRSTRLEN];
+
+            if (serr->ee_type
+                    == (ipv == IPV6 ? ICMP6_TIME_EXCEEDED : ICMP_TIME_EXCEEDED)
+                && batch->rcv_msgs[i].msg_len >= sizeof (struct icmphdr)
+                && path_error_reply (sock, ipv, msg, serr, &mono, &real))
+            {
+                continue;
+            }
+            icmp_error_message (ipv, serr->ee_type, serr->ee_code,
+                                serr->ee_info,
+                                format_addr (SO_EE_OFFENDER (serr), from));
+        }
+    }
+
+    return count < 0 ? 0 : count;
+}
+
+_Bool
+icmp_soft_error (int err)
+{
+    return err == EHOSTUNREACH || err == ENETUNREACH || err == ECONNREFUSED
+           || err == EHOSTDOWN || err == ENETDOWN || err == EMSGSIZE
+           || err == EPROTO || err == EACCES || err == ENOPROTOOPT;
+}
+
+/**
+ * @brief Tells a send refused for the destination of the request alone, no
+ * route, a request too large or rejected by the firewall, from a failure of
+ * the socket itself.
+ */
+
+_Bool
+icmp_send_error (int err)
+{
+    return icmp_soft_error (err) || err == EPERM || err == EADDRNOTAVAIL;
+}
+
+/**
+ * @brief Drains up to RECV_BATCH_MAX datagrams with a single recvmmsg() and
+ * dispatches them in arrival order, each one with its own receive time.
+ * @param sock socket to drain
+ * @param ipv address family of the socket
+ * @return the number of datagrams received, 0 once the socket is drained.
+ */
+
+static int
+recv_icmp_batch (struct s_icmp_socket *sock, ip_version ipv)
+{
+    struct s_batch *batch = g_ping.batch;
+    struct timespec mono, real;
+    int count;
+
+    for (int i = 0; i < RECV_BATCH_MAX; ++i)
+    {
+        batch->rcv_msgs[i].msg_hdr.msg_namelen = sizeof (batch->rcv_addr[i]);
+        batch->rcv_msgs[i].msg_hdr.msg_controllen = CONTROL_BUFFER_SIZE;
+    }
+
+    count = recvmmsg (sock->fd, batch->rcv_msgs, RECV_BATCH_MAX, MSG_DONTWAIT,
+                      NULL);
+
+    if (count <= 0)
+    {
+        if (count == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            return 0;
+        }
+
+        /* A datagram socket reports a pending ICMP error once on the next
+         * read, the error itself is read from the error queue and the
+         * datagrams queued behind it are still to be drained. */
+
+        if (count == -1 && sock->dgram && icmp_soft_error (errno))
+        {
+            recv_errqueue (sock);
+            return RECV_BATCH_MAX;
+        }
+        if (count == -1)
+        {
+            perror ("recvmmsg");
+        }
+        else
+        {
+            fprintf (stderr, "The peer has performed an orderly shutdown.");
+        }
+        g_ping.info.read_loop = g_ping.info.exit_code = false;
+        return 0;
+    }
+
+    sample_clocks (&mono, &real);
+
+    for (int i = 0; i < count && g_ping.info.read_loop; ++i)
+    {
+        ping_reply_handler (sock, ipv, &batch->rcv_msgs[i].msg_hdr,
+                            batch->rcv_msgs[i].msg_len, &mono, &real);
+    }
+
+    return count;
+}
+
+/**
+ * @brief Arms the send timer on an absolute CLOCK_MONOTONIC deadline. The
+ * schedule is derived from the previous deadline and not from the time the
+ * timer was serviced, so the interval does not drift with processing time.
+ * @param deadline absolute time of the next expiration
+ */
+
+static void
+ping_timer_arm (const struct timespec *deadline)
+{
+    struct itimerspec its;
+
+    memset (&its, 0, sizeof (its));
+    its.it_value = *deadline;
+
+    if (timerfd_settime (g_ping.event.timer_fd, TFD_TIMER_ABSTIME, &its, NULL)
+        == -1)
+    {
+        perror ("timerfd_settime");
+        release_resources ();
+        exit (EXIT_FAILURE);
+    }
+}
+
+/**
+ * @brief The count is only reached once every name has been resolved, a
+ * target still to come has requests of its own to send.
+ */
+
+static _Bool
+ping_count_reached ()
+{
+    return g_ping.options.count && g_ping.resolver.nb_pending == 0
+           && g_ping.event.nb_turns >= ping_total_count ();
+}
+
+/**
+ * @brief The session is over once every request of the count has been
+ * answered or declared lost, none of them is left in the timing wheel.
+ */
+
+static _Bool
+ping_count_done ()
+{
+    return ping_count_reached () && g_ping.wheel.count == 0;
+}
+
+/**
+ * @brief Arms the timer on the earliest of the next send, the next loss
+ * deadline and the -w deadline. Nothing is sent once the count is reached,
+ * the session then ends with the last deadline of the wheel at the latest.
+ */
+
+static void
+ping_timer_update ()
+{
+    struct timespec next = { 0, 0 };
+    struct timespec expiry;
+    _Bool armed = false;
+
+    if (g_ping.nb_targets > 0 && !g_ping.event.lingering)
+    {
+        next = g_ping.event.next_send;
+        armed = true;
+    }
+    if (ping_wheel_next (&expiry)
+        && (!armed || timespec_cmp (&expiry, &next) < 0))
+    {
+        next = expiry;
+        armed = true;
+    }
+    if ((g_ping.event.deadline.tv_sec != 0
+         || g_ping.event.deadline.tv_nsec != 0)
+        && (!armed || timespec_cmp (&g_ping.event.deadline, &next) < 0))
+    {
+        next = g_ping.event.deadline;
+    }
+    ping_timer_arm (&next);
+}
+
+/**
+ * @brief Sends every request whose deadline has passed, at most
+ * SEND_BURST_MAX at once, then arms the timer on the next deadline. A
+ * schedule too late to be caught up within one burst restarts from now
+ * rather than bursting indefinitely. Once the requested count has been sent,
+ * the timer only waits for the loss deadlines of the last requests.
+ * @param now current CLOCK_MONOTONIC time
+ */
+
+static void
+ping_send_due (const struct timespec *now)
+{
+    struct timespec *next = &g_ping.event.next_send;
+    int burst = 0;
+
+    /* Nothing is sent before the first name is resolved. */
+
+    if (g_ping.nb_targets == 0)
+    {
+        ping_timer_update ();
+        return;
+    }
+
+    while (timespec_cmp (now, next) >= 0 && burst < SEND_BURST_MAX
+           && (!g_ping.options.count
+               || g_ping.event.nb_turns + burst < ping_total_count ()))
+    {
+        timespec_add (next, &g_ping.event.send_interval);
+        ++burst;
+    }
+
+    if (burst > 0)
+    {
+        burst = send_icmp_batch (burst);
+        for (int i = 0; i < burst; ++i)
+        {
+            ping_messages_handler (SEND);
+        }
+    }
+
+    if (timespec_cmp (now, next) >= 0)
+    {
+        *next = *now;
+        timespec_add (next, &g_ping.event.send_interval);
+    }
+
+    if (ping_count_reached ())
+    {
+        g_ping.event.lingering = true;
+    }
+
+    /* The last requests may all have been refused, nothing is left to wait
+     * for. */
+
+    if (ping_count_done ())
+    {
+        g_ping.info.read_loop = false;
+        return;
+    }
+
+    ping_timer_update ();
+}
+
+/**
+ * @brief Serves the timer: the -w deadline ends the session, the probes
+ * whose deadline has passed are declared lost, then the due requests are
+ * sent.
+ */
+
+static void
+ping_timer_handler ()
+{
+    uint64_t expirations;
+    struct timespec now;
+
+    if (read (g_ping.event.timer_fd, &expirations, sizeof (expirations)) == -1)
+    {
+        return;
+    }
+
+    clock_gettime (CLOCK_MONOTONIC, &now);
+    if ((g_ping.event.deadline.tv_sec != 0
+         || g_ping.event.deadline.tv_nsec != 0)
+        && timespec_cmp (&now, &g_ping.event.deadline) >= 0)
+    {
+        g_ping.info.read_loop = false;
+        return;
+    }
+
+    ping_wheel_expire (&now);
+    if (ping_count_done ())
+    {
+        g_ping.info.read_loop = false;
+        return;
+    }
+
+    ping_send_due (&now);
+    ping_output_tick (&now);
+    if (g_ping.options.metrics != NULL)
+    {
+        ping_daemon_publish (&now);
+    }
+}
+
+/**
+ * @brief Ends the session once every request has been answered or declared
+ * lost. In adaptive flood mode, the answer to the last request sent triggers
+ * the next one immediately. Called by the I/O backend once it drained the
+ * replies.
+ */
+
+void
+ping_replies_done ()
+{
+    if (ping_count_done ())
+    {
+        g_ping.info.read_loop = false;
+        return;
+    }
+
+    if (g_ping.options.flood_adaptive && !g_ping.event.lingering
+        && !g_ping.probes[g_ping.stats.nb_snd & (PROBE_RING_SIZE - 1)]
+                .outstanding)
+    {
+        struct timespec now;
+
+        clock_gettime (CLOCK_MONOTONIC, &now);
+        g_ping.event.next_send = now;
+        ping_send_due (&now);
+    }
+}
+
+/**
+ * @brief Drains every datagram queued on a socket, the socket is level
+ * triggered so anything left behind would wake epoll_wait() up again.
+ * Receive path of the socket backend.
+ * @param sock readable socket
+ * @param ipv address family of the socket
+ */
+
+void
+ping_socket_handler (struct s_icmp_socket *sock, ip_version ipv)
+{
+    /* Transmit stamps are consumed first, they are usually queued before the
+     * reply they relate to. A short batch means the queue has been emptied,
+     * anything arriving afterwards wakes epoll_wait() up again. */
+
+    if (g_ping.options.timestamping != TS_NONE || sock->dgram)
+    {
+        while (recv_errqueue (sock) == RECV_BATCH_MAX)
+        {
+        }
+    }
+
+    while (g_ping.info.read_loop
+           && recv_icmp_batch (sock, ipv) == RECV_BATCH_MAX)
+    {
+    }
+
+    ping_replies_done ();
+}
+
+/**
+ * @brief Spreads the sends of one interval evenly across the targets, each
+ * target is then probed once per interval.
+ */
+
+static void
+set_send_interval ()
+{
+    uint64_t interval_ns = (uint64_t)g_ping.options.interval.tv_sec * 1000000000
+                           + g_ping.options.interval.tv_nsec;
+
+    if (g_ping.nb_targets > 1)
+    {
+        interval_ns /= g_ping.nb_targets;
+    }
+    if (interval_ns == 0)
+    {
+        interval_ns = 1;
+    }
+    g_ping.event.send_interval.tv_sec = interval_ns / 1000000000;
+    g_ping.event.send_interval.tv_nsec = interval_ns % 1000000000;
+}
+
+/**
+ * @brief Brings the targets whose name has just been resolved into the
+ * session, the send interval is spread across them as well. The session
+ * starts sending with the first target, it gives up once every name failed.
+ */
+
+static void
+ping_resolve_event ()
+{
+    uint32_t first = g_ping.nb_targets;
+
+    if (ping_resolve_handler () > 0)
+    {
+        for (uint32_t i = first; i < g_ping.nb_targets; ++i)
+        {
+            ping_socket_open (&g_ping.targets[i]);
+            g_ping.info.target = &g_ping.targets[i];
+            ping_messages_handler (RESOLVED);
+        }
+        ping_shm_targets ();
+        set_send_interval ();
+
+        if (first == 0)
+        {
+            struct timespec now;
+
+            clock_gettime (CLOCK_MONOTONIC, &now);
+            g_ping.event.next_send = now;
+            ping_send_due (&now);
+        }
+    }
+    else if (g_ping.nb_targets == 0 && g_ping.resolver.nb_pending == 0)
+    {
+        g_ping.info.exit_code = true;
+        g_ping.info.read_loop = false;
+    }
+}
+
+/**
+ * @brief Opens the sockets, the event loop and the batches of the calling
+ * context, for its own slice of targets.
+ */
+
+void
+ping_session_init ()
+{
+    set_send_interval ();
+    ping_socket_init ();
+    ping_batch_init ();
+    ping_event_init ();
+}
+
+/**
+ * @brief Sends the first requests and runs the event loop of the calling
+ * context until the session is over or the stop event is raised.
+ */
+
+void
+ping_loop ()
+{
+    struct timespec start;
+
+    clock_gettime (CLOCK_MONOTONIC, &start);
+    if (g_ping.options.deadline.tv_sec != 0
+        || g_ping.options.deadline.tv_nsec != 0)
+    {
+        g_ping.event.deadline = start;
+        timespec_add (&g_ping.event.deadline, &g_ping.options.deadline);
+    }
+    g_ping.event.next_send = start;
+    ping_send_due (&start);
+
+    while (g_ping.info.read_loop)
+    {
+        struct epoll_event events[EPOLL_MAX_EVENTS];
+        int nfds;
+
+        /* Blocks until a reply is readable or the next send is due, an idle
+         * session does not consume any CPU time. */
+
+        nfds = epoll_wait (g_ping.event.epoll_fd, events, EPOLL_MAX_EVENTS, -1);
+
+        if (nfds == -1)
         {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            perror ("epoll_wait");
             break;
         }
+
+        for (int i = 0; i < nfds && g_ping.info.read_loop; ++i)
+        {
+            if (events[i].data.fd == g_ping.event.timer_fd)
+            {
+                ping_timer_handler ();
+            }
+            else if (events[i].data.fd == g_ping.event.stop_fd)
+            {
+                g_ping.info.read_loop = false;
+            }
+            else if (events[i].data.fd == g_ping.event.resolve_fd)
+            {
+                ping_resolve_event ();
+            }
+            else
+            {
+                g_ping.io->handle (events[i].data.fd);
+            }
+        }
+    }
+}
+
+/**
+ * @brief Supervises the steps of the ping diagnosis.
+ * This function is the central point regarding the supervision of the steps to
+ * perform a ping diagnostic from the creation of sockets to the sending and
+ * reception of ICMP packets. Numeric and cached hosts are probed right away
+ * while the other names are resolved in the background, the targets are
+ * probed either by the calling thread or by a pool of workers. The workers
+ * split the targets between them, every name is resolved before they start.
+ * @param nb_hosts number of destination hostnames
+ * @param hosts destination hostnames
+ */
+
+void
+ping_coord (int nb_hosts, char **hosts)
+{
+    if ((g_ping.targets = calloc (nb_hosts, sizeof (struct s_target)))
+        == NULL)
+    {
+        perror ("calloc");
+        release_resources ();
+        exit (EXIT_FAILURE);
+    }
+    g_ping.targets_size = nb_hosts;
+
+    ping_resolve_start (nb_hosts, hosts);
+
+    if (g_ping.options.workers > 1)
+    {
+        ping_resolve_wait ();
+    }
+
+    if (g_ping.nb_targets == 0 && g_ping.resolver.nb_pending == 0)
+    {
+        release_resources ();
+        exit (EXIT_FAILURE);
+    }
+
+    if (g_ping.nb_targets > 0 && g_ping.options.workers > g_ping.nb_targets)
+    {
+        g_ping.options.workers = g_ping.nb_targets;
+    }
+
+    if (g_ping.options.metrics != NULL)
+    {
+        ping_daemon_start ();
+    }
+    if (g_ping.options.stats_shm != NULL)
+    {
+        ping_shm_open ();
+    }
+
+    if (g_ping.options.workers > 1)
+    {
+        ping_messages_handler (START);
+        ping_workers_run ();
+    }
+    else
+    {
+        ping_session_init ();
+        ping_messages_handler (START);
+        ping_loop ();
+        if (g_ping.options.format != FORMAT_TEXT)
+        {
+            ping_output_lost ();
+        }
+    }
+    if (g_ping.options.metrics != NULL)
+    {
+        ping_daemon_stop ();
     }
+    ping_shm_close ();
     ping_messages_handler (END);
     release_resources ();
 }
@@ -0,0 +1,541 @@
+#include "ft_ping.h"
+
+/* Shared by the probing threads, which publish into it, and the exposition
+ * thread, which renders it. */
+
+static struct s_daemon g_daemon = { .listen_fd = -1,
+                                    .stop_fd = -1,
+                                    .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static const double METRICS_BOUNDS_MS[METRICS_BUCKETS]
+    = { 0.05, 0.1, 0.25, 0.5, 1,   2.5, 5,    10,
+        25,   50,  100,  250, 500, 1000, 2500, 5000 };
+
+static const char *HTTP_HEADER_FORMAT
+    = "HTTP/1.0 %s\r\nContent-Type: text/plain; version=0.0.4; "
+      "charset=utf-8\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n";
+
+/**
+ * @brief Copies the statistics of the targets of the calling thread into
+ * the snapshot, once every METRICS_PUBLISH_MSEC. The snapshot is skipped
+ * when a scrape is reading it, the probe loop never waits for a scrape and
+ * the next tick publishes again.
+ * @param now current CLOCK_MONOTONIC time
+ */
+
+void
+ping_daemon_publish (const struct timespec *now)
+{
+    struct timespec period = { METRICS_PUBLISH_MSEC / 1000,
+                               (METRICS_PUBLISH_MSEC % 1000) * 1000000 };
+    uint32_t last = g_ping.first_target + g_ping.nb_targets;
+
+    if (timespec_cmp (now, &g_ping.event.next_publish) < 0
+        || pthread_mutex_trylock (&g_daemon.lock) != 0)
+    {
+        return;
+    }
+
+    /* Targets resolved late grow the snapshot of a single session. */
+
+    if (last > g_daemon.entries_size)
+    {
+        struct s_metrics_entry *entries;
+
+        if ((entries = realloc (g_daemon.entries,
+                                last * sizeof (struct s_metrics_entry)))
+            == NULL)
+        {
+            pthread_mutex_unlock (&g_daemon.lock);
+            return;
+        }
+        g_daemon.entries = entries;
+        g_daemon.entries_size = last;
+    }
+
+    for (uint32_t i = 0; i < g_ping.nb_targets; ++i)
+    {
+        const struct s_target *target = &g_ping.targets[i];
+        struct s_metrics_entry *entry
+            = &g_daemon.entries[g_ping.first_target + i];
+
+        entry->hostname = target->hostname;
+        memcpy (entry->ip_addr, target->ip_addr, sizeof (entry->ip_addr));
+        entry->sent = target->stats.nb_snd;
+        entry->received = target->stats.nb_res;
+        entry->send_errors = target->stats.nb_send_err;
+        entry->rtt_sum = target->stats.rtt.mean * target->stats.rtt.n;
+        histogram_cumulative (target->stats.histogram, METRICS_BOUNDS_MS,
+                              METRICS_BUCKETS, entry->buckets);
+    }
+    if (last > g_daemon.nb_entries)
+    {
+        g_daemon.nb_entries = last;
+    }
+    pthread_mutex_unlock (&g_daemon.lock);
+
+    g_ping.event.next_publish = *now;
+    timespec_add (&g_ping.event.next_publish, &period);
+}
+
+/**
+ * @brief Writes a label value, escaped as the exposition format requires.
+ */
+
+static void
+metrics_label (FILE *out, const char *str)
+{
+    for (; *str != '\0'; ++str)
+    {
+        if (*str == '\\' || *str == '"')
+        {
+            fputc ('\\', out);
+        }
+        if (*str == '\n')
+        {
+            fputs ("\\n", out);
+            continue;
+        }
+        fputc (*str, out);
+    }
+}
+
+static void
+metrics_labels (FILE *out, const struct s_metrics_entry *entry)
+{
+    fputs ("{target=\"", out);
+    metrics_label (out, entry->hostname);
+    fprintf (out, "\",addr=\"%s\"", entry->ip_addr);
+}
+
+/**
+ * @brief Renders the snapshot in the Prometheus text format. Only the
+ * rendering holds the snapshot lock, the page is sent once released.
+ * @param size receives the length of the page
+ * @return the page, to be freed, NULL if it could not be rendered.
+ */
+
+static char *
+metrics_render (size_t *size)
+{
+    char *page = NULL;
+    FILE *out;
+
+    if ((out = open_memstream (&page, size)) == NULL)
+    {
+        return NULL;
+    }
+
+    pthread_mutex_lock (&g_daemon.lock);
+
+    fputs ("# HELP ft_ping_sent_total Echo Requests sent.\n"
+           "# TYPE ft_ping_sent_total counter\n",
+           out);
+    for (uint32_t i = 0; i < g_daemon.nb_entries; ++i)
+    {
+        fputs ("ft_ping_sent_total", out);
+        metrics_labels (out, &g_daemon.entries[i]);
+        fprintf (out, "} %" PRIu64 "\n", g_daemon.entries[i].sent);
+    }
+
+    fputs ("# HELP ft_ping_received_total Echo Replies received.\n"
+           "# TYPE ft_ping_received_total counter\n",
+           out);
+    for (uint32_t i = 0; i < g_daemon.nb_entries; ++i)
+    {
+        fputs ("ft_ping_received_total", out);
+        metrics_labels (out, &g_daemon.entries[i]);
+        fprintf (out, "} %" PRIu64 "\n", g_daemon.entries[i].received);
+    }
+
+    fputs ("# HELP ft_ping_send_errors_total Echo Requests the kernel "
+           "refused to send, for lack of a route typically.\n"
+           "# TYPE ft_ping_send_errors_total counter\n",
+           out);
+    for (uint32_t i = 0; i < g_daemon.nb_entries; ++i)
+    {
+        fputs ("ft_ping_send_errors_total", out);
+        metrics_labels (out, &g_daemon.entries[i]);
+        fprintf (out, "} %" PRIu64 "\n", g_daemon.entries[i].send_errors);
+    }
+
+    fputs ("# HELP ft_ping_loss_ratio Share of the Echo Requests left "
+           "unanswered, the ones in flight included.\n"
+           "# TYPE ft_ping_loss_ratio gauge\n",
+           out);
+    for (uint32_t i = 0; i < g_daemon.nb_entries; ++i)
+    {
+        const struct s_metrics_entry *entry = &g_daemon.entries[i];
+
+        fputs ("ft_ping_loss_ratio", out);
+        metrics_labels (out, entry);
+        fprintf (out, "} %.6f\n",
+                 entry->sent ? (double)(entry->sent - entry->received)
+                                   / entry->sent
+                             : 0.0);
+    }
+
+    fputs ("# HELP ft_ping_rtt_seconds Round trip time of the Echo "
+           "Replies.\n"
+           "# TYPE ft_ping_rtt_seconds histogram\n",
+           out);
+    for (uint32_t i = 0; i < g_daemon.nb_entries; ++i)
+    {
+        const struct s_metrics_entry *entry = &g_daemon.entries[i];
+
+        for (int b = 0; b < METRICS_BUCKETS; ++b)
+        {
+            fputs ("ft_ping_rtt_seconds_bucket", out);
+            metrics_labels (out, entry);
+            fprintf (out, ",le=\"%g\"} %" PRIu64 "\n",
+                     METRICS_BOUNDS_MS[b] / 1000, entry->buckets[b]);
+        }
+        fputs ("ft_ping_rtt_seconds_bucket", out);
+        metrics_labels (out, entry);
+        fprintf (out, ",le=\"+Inf\"} %" PRIu64 "\n", entry->received);
+        fputs ("ft_ping_rtt_seconds_sum", out);
+        metrics_labels (out, entry);
+        fprintf (out, "} %.9f\n", entry->rtt_sum / 1000);
+        fputs ("ft_ping_rtt_seconds_count", out);
+        metrics_labels (out, entry);
+        fprintf (out, "} %" PRIu64 "\n", entry->received);
+    }
+
+    pthread_mutex_unlock (&g_daemon.lock);
+
+    if (fclose (out) != 0)
+    {
+        free (page);
+        return NULL;
+    }
+    return page;
+}
+
+static void
+send_all (int fd, const char *buf, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t ret = send (fd, buf, len, MSG_NOSIGNAL);
+
+        if (ret == -1 && errno == EINTR)
+        {
+            continue;
+        }
+        if (ret <= 0)
+        {
+            return;
+        }
+        buf += ret;
+        len -= ret;
+    }
+}
+
+/**
+ * @brief Answers one HTTP scrape, GET / and GET /metrics return the page.
+ * The connection times out rather than holding the exposition thread.
+ * @param fd accepted connection
+ */
+
+static void
+metrics_serve (int fd)
+{
+    struct timeval timeout = { 1, 0 };
+    char request[METRICS_REQUEST_MAX];
+    char header[256];
+    size_t len = 0;
+    size_t size = 0;
+    char *page = NULL;
+    const char *status = "404 Not Found";
+
+    setsockopt (fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof (timeout));
+    setsockopt (fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof (timeout));
+
+    while (len < sizeof (request) - 1)
+    {
+        ssize_t ret = recv (fd, request + len, sizeof (request) - 1 - len, 0);
+
+        if (ret <= 0)
+        {
+            break;
+        }
+        len += ret;
+        request[len] = '\0';
+        if (strstr (request, "\r\n\r\n") != NULL)
+        {
+            break;
+        }
+    }
+    request[len] = '\0';
+
+    if (strncmp (request, "GET / ", 6) == 0
+        || strncmp (request, "GET /metrics ", 13) == 0)
+    {
+        if ((page = metrics_render (&size)) != NULL)
+        {
+            status = "200 OK";
+        }
+        else
+        {
+            status = "500 Internal Server Error";
+        }
+    }
+
+    snprintf (header, sizeof (header), HTTP_HEADER_FORMAT, status, size);
+    send_all (fd, header, strlen (header));
+    send_all (fd, page, size);
+    free (page);
+}
+
+/**
+ * @brief Replaces the textfile collector file with the current snapshot,
+ * the collector never reads a partial file.
+ */
+
+static void
+metrics_write_file ()
+{
+    char tmp_path[PATH_MAX];
+    size_t size;
+    char *page;
+    FILE *file;
+
+    if ((page = metrics_render (&size)) == NULL
+        || snprintf (tmp_path, sizeof (tmp_path), "%s.%d", g_daemon.path,
+                     getpid ())
+               >= (int)sizeof (tmp_path)
+        || (file = fopen (tmp_path, "w")) == NULL)
+    {
+        free (page);
+        return;
+    }
+
+    if (fwrite (page, 1, size, file) != size || fclose (file) != 0
+        || rename (tmp_path, g_daemon.path) != 0)
+    {
+        unlink (tmp_path);
+    }
+    free (page);
+}
+
+/**
+ * @brief Exposition thread, it waits for scrapes or, for a textfile, for
+ * the next period until the stop event is raised.
+ */
+
+static void *
+metrics_thread (void *arg)
+{
+    struct pollfd fds[2] = { { g_daemon.stop_fd, POLLIN, 0 },
+                             { g_daemon.listen_fd, POLLIN, 0 } };
+    int timeout = g_daemon.kind == METRICS_FILE ? METRICS_PUBLISH_MSEC : -1;
+
+    (void)arg;
+    while (true)
+    {
+        int ret = poll (fds, g_daemon.listen_fd != -1 ? 2 : 1, timeout);
+
+        if (ret == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            break;
+        }
+        if (fds[0].revents & POLLIN)
+        {
+            break;
+        }
+        if (g_daemon.kind == METRICS_FILE)
+        {
+            metrics_write_file ();
+        }
+        else if (ret > 0 && (fds[1].revents & POLLIN))
+        {
+            int fd = accept4 (g_daemon.listen_fd, NULL, NULL, SOCK_CLOEXEC);
+
+            if (fd != -1)
+            {
+                metrics_serve (fd);
+                close (fd);
+            }
+        }
+    }
+
+    /* The last state of the targets is left behind for the collector. */
+
+    if (g_daemon.kind == METRICS_FILE)
+    {
+        metrics_write_file ();
+    }
+    return NULL;
+}
+
+/**
+ * @brief Opens the listening socket of an HTTP endpoint, [host]:port or
+ * unix:path. The host defaults to the loopback address.
+ * @return 0 on success, -1 otherwise.
+ */
+
+static int
+metrics_listen (const char *endpoint)
+{
+    struct addrinfo hints, *res;
+    char host[NI_MAXHOST];
+    const char *port = strrchr (endpoint, ':');
+    int on = 1;
+
+    if (g_daemon.kind == METRICS_UNIX)
+    {
+        struct sockaddr_un addr = { .sun_family = AF_UNIX };
+
+        if (strlen (g_daemon.path) >= sizeof (addr.sun_path)
+            || (g_daemon.listen_fd
+                = socket (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0))
+                   == -1)
+        {
+            return -1;
+        }
+        strcpy (addr.sun_path, g_daemon.path);
+        unlink (g_daemon.path);
+        if (bind (g_daemon.listen_fd, (struct sockaddr *)&addr, sizeof (addr))
+            == -1)
+        {
+            return -1;
+        }
+        return listen (g_daemon.listen_fd, SOMAXCONN);
+    }
+
+    if (port == NULL || (size_t)(port - endpoint) >= sizeof (host))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    snprintf (host, sizeof (host), "%.*s", (int)(port - endpoint), endpoint);
+    if (host[0] == '[' && host[strlen (host) - 1] == ']')
+    {
+        memmove (host, host + 1, strlen (host) - 2);
+        host[strlen (host) - 2] = '\0';
+    }
+
+    memset (&hints, 0, sizeof (hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo (host[0] ? host : "127.0.0.1", port + 1, &hints, &res)
+        != 0)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if ((g_daemon.listen_fd = socket (res->ai_family,
+                                      SOCK_STREAM | SOCK_CLOEXEC, 0))
+            == -1
+        || setsockopt (g_daemon.listen_fd, SOL_SOCKET, SO_REUSEADDR, &on,
+                       sizeof (on))
+               == -1
+        || bind (g_daemon.listen_fd, res->ai_addr, res->ai_addrlen) == -1)
+    {
+        freeaddrinfo (res);
+        return -1;
+    }
+    freeaddrinfo (res);
+    return listen (g_daemon.listen_fd, SOMAXCONN);
+}
+
+/**
+ * @brief Starts the exposition thread of the daemon mode. The snapshot
+ * covers every target known so far, signals are left to the main thread.
+ */
+
+void
+ping_daemon_start ()
+{
+    const char *endpoint = g_ping.options.metrics;
+    sigset_t mask, prev;
+    int err;
+
+    if (strncmp (endpoint, "unix:", 5) == 0)
+    {
+        g_daemon.kind = METRICS_UNIX;
+        g_daemon.path = endpoint + 5;
+    }
+    else if (strncmp (endpoint, "file:", 5) == 0)
+    {
+        g_daemon.kind = METRICS_FILE;
+        g_daemon.path = endpoint + 5;
+    }
+    else
+    {
+        g_daemon.kind = METRICS_HTTP;
+    }
+
+    if ((g_daemon.entries_size = g_ping.nb_targets) > 0
+        && (g_daemon.entries = calloc (g_daemon.entries_size,
+                                       sizeof (struct s_metrics_entry)))
+               == NULL)
+    {
+        perror ("calloc");
+        release_resources ();
+        exit (EXIT_FAILURE);
+    }
+
+    if ((g_daemon.kind != METRICS_FILE && metrics_listen (endpoint) == -1)
+        || (g_daemon.stop_fd = eventfd (0, EFD_CLOEXEC)) == -1)
+    {
+        perror (endpoint);
+        ping_daemon_stop ();
+        release_resources ();
+        exit (EXIT_FAILURE);
+    }
+
+    sigemptyset (&mask);
+    sigaddset (&mask, SIGINT);
+    sigaddset (&mask, SIGTERM);
+    pthread_sigmask (SIG_BLOCK, &mask, &prev);
+    err = pthread_create (&g_daemon.thread, NULL, metrics_thread, NULL);
+    pthread_sigmask (SIG_SETMASK, &prev, NULL);
+
+    if (err != 0)
+    {
+        fprintf (stderr, "pthread_create: %s\n", strerror (err));
+        ping_daemon_stop ();
+        release_resources ();
+        exit (EXIT_FAILURE);
+    }
+    g_daemon.running = true;
+}
+
+/**
+ * @brief Stops the exposition thread and closes its endpoint.
+ */
+
+void
+ping_daemon_stop ()
+{
+    if (g_daemon.running)
+    {
+        eventfd_write (g_daemon.stop_fd, 1);
+        pthread_join (g_daemon.thread, NULL);
+        g_daemon.running = false;
+    }
+    if (g_daemon.listen_fd != -1)
+    {
+        close (g_daemon.listen_fd);
+        if (g_daemon.kind == METRICS_UNIX)
+        {
+            unlink (g_daemon.path);
+        }
+    }
+    if (g_daemon.stop_fd != -1)
+    {
+        close (g_daemon.stop_fd);
+    }
+    g_daemon.listen_fd = -1;
+    g_daemon.stop_fd = -1;
+    free (g_daemon.entries);
+    g_daemon.entries = NULL;
+    g_daemon.nb_entries = 0;
+    g_daemon.entries_size = 0;
+}
@@ -0,0 +1,200 @@
+#include "ft_ping.h"
+
+#define FILTER_LEN(code) (sizeof (code) / sizeof ((code)[0]))
+
+/* Beyond 16 bits, never equal to a loaded identifier. */
+#define FILTER_NO_IDENT 0x10000
+
+static void
+attach_filter (int fd, struct sock_filter *code, unsigned short len)
+{
+    struct sock_fprog prog = { .len = len, .filter = code };
+
+    if (setsockopt (fd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof (prog))
+        < 0)
+    {
+        perror ("setsockopt");
+        release_resources ();
+        exit (EXIT_FAILURE);
+    }
+}
+
+/**
+ * @brief A raw IPv4 socket sees the IP header. X is loaded with the length of
+ * the outer IP header, an error message is followed by the quoted IP header
+ * whose length is added to X in turn to reach the quoted ICMP header.
+ * @param fd raw IPv4 socket
+ * @param ident ICMP identifier of the calling context
+ * @param replies false to only let the error messages through
+ */
+
+static void
+attach_filter_v4 (int fd, uint16_t ident, _Bool replies)
+{
+    struct sock_filter code[] = {
+        BPF_STMT (BPF_LDX | BPF_B | BPF_MSH, 0),
+        BPF_STMT (BPF_LD | BPF_B | BPF_IND, 0),
+        BPF_JUMP (BPF_JMP | BPF_JEQ | BPF_K, ICMP_ECHOREPLY, 3, 0),
+        BPF_JUMP (BPF_JMP | BPF_JEQ | BPF_K, ICMP_DEST_UNREACH, 4, 0),
+        BPF_JUMP (BPF_JMP | BPF_JEQ | BPF_K, ICMP_TIME_EXCEEDED, 3, 0),
+        BPF_JUMP (BPF_JMP | BPF_JEQ | BPF_K, ICMP_PARAMETERPROB, 2, 14),
+        /* Echo Reply, identifier */
+        BPF_STMT (BPF_LD | BPF_H | BPF_IND, 4),
+        BPF_JUMP (BPF_JMP | BPF_JEQ | BPF_K, replies ? ident : FILTER_NO_IDENT,
+                  11, 12),
+        /* Error, quoted protocol and quoted IP header length */
+        BPF_STMT (BPF_LD | BPF_B | BPF_IND, 8 + 9),
+        BPF_JUMP (BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_ICMP, 0, 10),
+        BPF_STMT (BPF_LD | BPF_B | BPF_IND, 8),
+        BPF_STMT (BPF_ALU | BPF_AND | BPF_K, 0x0F),
+        BPF_STMT (BPF_ALU | BPF_LSH | BPF_K, 2),
+        BPF_STMT (BPF_ALU | BPF_ADD | BPF_X, 0),
+        BPF_STMT (BPF_MISC | BPF_TAX, 0),
+        /* Error, quoted Echo Request and identifier */
+        BPF_STMT (BPF_LD | BPF_B | BPF_IND, 8),
+        BPF_JUMP (BPF_JMP | BPF_JEQ | BPF_K, ICMP_ECHO, 0, 3),
+        BPF_STMT (BPF_LD | BPF_H | BPF_IND, 8 + 4),
+        BPF_JUMP (BPF_JMP | BPF_JEQ | BPF_K, ident, 0, 1),
+        BPF_STMT (BPF_RET | BPF_K, UINT32_MAX),
+        BPF_STMT (BPF_RET | BPF_K, 0),
+    };
+
+    attach_filter (fd, code, FILTER_LEN (code));
+}
+
+/**
+ * @brief A raw IPv6 socket starts at the ICMPv6 header, an error message
+ * quotes the fixed IPv6 header right after its own 8 bytes. Quoted extension
+ * headers are not followed, such errors are dropped.
+ * @param fd raw IPv6 socket
+ * @param ident ICMP identifier of the calling context
+ * @param replies false to only let the error messages through
+ */
+
+static void
+attach_filter_v6 (int fd, uint16_t ident, _Bool replies)
+{
+    struct sock_filter code[] = {
+        BPF_STMT (BPF_LD | BPF_B | BPF_ABS, 0),
+        BPF_JUMP (BPF_JMP | BPF_JEQ | BPF_K, ICMP6_ECHO_REPLY, 4, 0),
+        BPF_JUMP (BPF_JMP | BPF_JEQ | BPF_K, ICMP6_DST_UNREACH, 5, 0),
+        BPF_JUMP (BPF_JMP | BPF_JEQ | BPF_K, ICMP6_PACKET_TOO_BIG, 4, 0),
+        BPF_JUMP (BPF_JMP | BPF_JEQ | BPF_K, ICMP6_TIME_EXCEEDED, 3, 0),
+        BPF_JUMP (BPF_JMP | BPF_JEQ | BPF_K, ICMP6_PARAM_PROB, 2, 9),
+        /* Echo Reply, identifier */
+        BPF_STMT (BPF_LD | BPF_H | BPF_ABS, 4),
+        BPF_JUMP (BPF_JMP | BPF_JEQ | BPF_K, replies ? ident : FILTER_NO_IDENT,
+                  6, 7),
+        /* Error, quoted next header, Echo Request and identifier */
+        BPF_STMT (BPF_LD | BPF_B | BPF_ABS, 8 + 6),
+        BPF_JUMP (BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_ICMPV6, 0, 5),
+        BPF_STMT (BPF_LD | BPF_B | BPF_ABS, 8 + 40),
+        BPF_JUMP (BPF_JMP | BPF_JEQ | BPF_K, ICMP6_ECHO_REQUEST, 0, 3),
+        BPF_STMT (BPF_LD | BPF_H | BPF_ABS, 8 + 40 + 4),
+        BPF_JUMP (BPF_JMP | BPF_JEQ | BPF_K, ident, 0, 1),
+        BPF_STMT (BPF_RET | BPF_K, UINT32_MAX),
+        BPF_STMT (BPF_RET | BPF_K, 0),
+    };
+
+    attach_filter (fd, code, FILTER_LEN (code));
+}
+
+/**
+ * @brief Attaches a classic BPF program to a raw ICMP socket. Only the Echo
+ * Replies carrying our identifier and the error messages quoting one of our
+ * Echo Requests are queued, the traffic of other processes is dropped in the
+ * kernel before it is ever copied to userspace.
+ * @param fd raw socket
+ * @param ipv address family of the socket
+ */
+
+void
+ping_filter_attach (int fd, ip_version ipv)
+{
+    if (ipv == IPV6)
+    {
+        attach_filter_v6 (fd, g_ping.info.ident, true);
+    }
+    else
+    {
+        attach_filter_v4 (fd, g_ping.info.ident, true);
+    }
+}
+
+/**
+ * @brief Lets only the error messages through an ICMP socket whose Echo
+ * Replies are captured elsewhere. A datagram socket gets its errors through
+ * the error queue, which is not filtered, nothing is queued at all.
+ * @param sock ICMP socket
+ * @param ipv address family of the socket
+ */
+
+void
+ping_filter_errors_only (const struct s_icmp_socket *sock, ip_version ipv)
+{
+    struct sock_filter drop[] = {
+        BPF_STMT (BPF_RET | BPF_K, 0),
+    };
+
+    if (sock->dgram)
+    {
+        attach_filter (sock->fd, drop, FILTER_LEN (drop));
+    }
+    else if (ipv == IPV6)
+    {
+        attach_filter_v6 (sock->fd, sock->ident, false);
+    }
+    else
+    {
+        attach_filter_v4 (sock->fd, sock->ident, false);
+    }
+}
+
+/**
+ * @brief Attaches the filter of an AF_PACKET socket capturing our Echo
+ * Replies. Frames start at the network header, IPv4 replies are recognized
+ * past a header of any length and IPv6 ones right after the fixed header.
+ * Each family is matched on the identifier of its own socket. A reply to a
+ * local address is seen leaving the loopback before entering it, only the
+ * incoming copy is kept. Fragments are captured before reassembly, they are
+ * never matched.
+ * @param fd AF_PACKET socket
+ * @param ident_v4 identifier of the IPv4 socket
+ * @param ident_v6 identifier of the IPv6 socket
+ */
+
+void
+ping_filter_packet_attach (int fd, uint16_t ident_v4, uint16_t ident_v6)
+{
+    struct sock_filter code[] = {
+        BPF_STMT (BPF_LD | BPF_W | BPF_ABS, SKF_AD_OFF + SKF_AD_PKTTYPE),
+        BPF_JUMP (BPF_JMP | BPF_JEQ | BPF_K, PACKET_OUTGOING, 20, 0),
+        /* IP version */
+        BPF_STMT (BPF_LD | BPF_B | BPF_ABS, 0),
+        BPF_STMT (BPF_ALU | BPF_RSH | BPF_K, 4),
+        BPF_JUMP (BPF_JMP | BPF_JEQ | BPF_K, 4, 0, 9),
+        /* IPv4, protocol, unfragmented, then type and identifier past the
+         * header */
+        BPF_STMT (BPF_LD | BPF_B | BPF_ABS, 9),
+        BPF_JUMP (BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_ICMP, 0, 15),
+        BPF_STMT (BPF_LD | BPF_H | BPF_ABS, 6),
+        BPF_JUMP (BPF_JMP | BPF_JSET | BPF_K, IP_MF | IP_OFFMASK, 13, 0),
+        BPF_STMT (BPF_LDX | BPF_B | BPF_MSH, 0),
+        BPF_STMT (BPF_LD | BPF_B | BPF_IND, 0),
+        BPF_JUMP (BPF_JMP | BPF_JEQ | BPF_K, ICMP_ECHOREPLY, 0, 10),
+        BPF_STMT (BPF_LD | BPF_H | BPF_IND, 4),
+        BPF_JUMP (BPF_JMP | BPF_JEQ | BPF_K, ident_v4, 7, 8),
+        /* IPv6, next header, then type and identifier */
+        BPF_JUMP (BPF_JMP | BPF_JEQ | BPF_K, 6, 0, 7),
+        BPF_STMT (BPF_LD | BPF_B | BPF_ABS, 6),
+        BPF_JUMP (BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_ICMPV6, 0, 5),
+        BPF_STMT (BPF_LD | BPF_B | BPF_ABS, 40),
+        BPF_JUMP (BPF_JMP | BPF_JEQ | BPF_K, ICMP6_ECHO_REPLY, 0, 3),
+        BPF_STMT (BPF_LD | BPF_H | BPF_ABS, 44),
+        BPF_JUMP (BPF_JMP | BPF_JEQ | BPF_K, ident_v6, 0, 1),
+        BPF_STMT (BPF_RET | BPF_K, UINT32_MAX),
+        BPF_STMT (BPF_RET | BPF_K, 0),
+    };
+
+    attach_filter (fd, code, FILTER_LEN (code));
+}
@@ -0,0 +1,143 @@
+#include "ft_ping.h"
+
+#define HISTO_HALF_COUNT (HISTO_SUB_COUNT / 2)
+
+/**
+ * @brief Maps a value to its bucket. The magnitude of the value selects a
+ * power of two range, its HISTO_SUB_BITS most significant bits select the
+ * linear bucket within that range.
+ * @param value value in nanoseconds
+ * @return the bucket index, values beyond the range fall in the last bucket.
+ */
+
+static uint32_t
+histogram_index (uint64_t value)
+{
+    int magnitude;
+    int shift;
+
+    if (value < HISTO_SUB_COUNT)
+    {
+        return value;
+    }
+
+    magnitude = 63 - __builtin_clzll (value);
+    if (magnitude >= HISTO_MAX_MAGNITUDE)
+    {
+        return HISTO_BUCKETS - 1;
+    }
+
+    shift = magnitude - HISTO_SUB_BITS + 1;
+    return HISTO_SUB_COUNT + (shift - 1) * HISTO_HALF_COUNT
+           + ((value >> shift) - HISTO_HALF_COUNT);
+}
+
+/**
+ * @brief Value standing for a whole bucket, its midpoint, so that the error
+ * is at most half a bucket width.
+ * @param index bucket index
+ * @return the value in nanoseconds.
+ */
+
+static double
+histogram_value (uint32_t index)
+{
+    uint32_t offset;
+    int shift;
+
+    if (index < HISTO_SUB_COUNT)
+    {
+        return index;
+    }
+
+    offset = index - HISTO_SUB_COUNT;
+    shift = offset / HISTO_HALF_COUNT + 1;
+    return (double)((uint64_t)(HISTO_HALF_COUNT + offset % HISTO_HALF_COUNT)
+                    << shift)
+           + (double)((1ULL << shift) - 1) / 2;
+}
+
+/**
+ * @brief Counts a sample.
+ * @param histogram histogram to update
+ * @param rtt sample in milliseconds
+ */
+
+void
+histogram_record (struct s_histogram *histogram, double rtt)
+{
+    uint64_t value = rtt > 0 ? (uint64_t)(rtt * 1e6 + 0.5) : 0;
+
+    ++histogram->counts[histogram_index (value)];
+    ++histogram->total;
+}
+
+void
+histogram_merge (struct s_histogram *dst, const struct s_histogram *src)
+{
+    for (uint32_t i = 0; i < HISTO_BUCKETS; ++i)
+    {
+        dst->counts[i] += src->counts[i];
+    }
+    dst->total += src->total;
+}
+
+/**
+ * @brief Computes several percentiles in a single pass over the buckets.
+ * @param histogram histogram holding at least one sample
+ * @param percentiles percentiles in increasing order, between 0 and 100
+ * @param nb number of percentiles
+ * @param values receives the percentiles in milliseconds
+ */
+
+void
+histogram_percentiles (const struct s_histogram *histogram,
+                       const double *percentiles, int nb, double *values)
+{
+    uint64_t seen = 0;
+    uint32_t index = 0;
+
+    for (int i = 0; i < nb; ++i)
+    {
+        uint64_t rank = (uint64_t)ceil (percentiles[i] / 100.0
+                                        * (double)histogram->total);
+
+        if (rank == 0)
+        {
+            rank = 1;
+        }
+        while (index < HISTO_BUCKETS - 1
+               && seen + histogram->counts[index] < rank)
+        {
+            seen += histogram->counts[index++];
+        }
+        values[i] = histogram_value (index) / 1e6;
+    }
+}
+
+/**
+ * @brief Counts the samples at or below each of several bounds, the
+ * cumulative buckets of a Prometheus histogram.
+ * @param histogram histogram to read, NULL for no sample at all
+ * @param bounds upper bounds in increasing order, in milliseconds
+ * @param nb number of bounds
+ * @param counts receives the number of samples at or below each bound
+ */
+
+void
+histogram_cumulative (const struct s_histogram *histogram,
+                      const double *bounds, int nb, uint64_t *counts)
+{
+    uint64_t seen = 0;
+    uint32_t index = 0;
+
+    for (int i = 0; i < nb; ++i)
+    {
+        while (histogram != NULL && index < HISTO_BUCKETS
+               && histogram_value (index) <= bounds[i] * 1e6)
+        {
+            seen += histogram->counts[index++];
+        }
+        counts[i] = seen;
+    }
+}
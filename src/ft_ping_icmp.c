@@ -1,5 +1,108 @@
 #include "ft_ping.h"
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CHECKSUM_SIMD
+#endif
+
+/* Below this length the setup of the vector accumulators is not worth it. */
+#define CHECKSUM_SIMD_MIN 128
+
+/* 32-bit lanes are folded before they can overflow, each step adds at most
+ * two 16-bit words to a lane. */
+#define CHECKSUM_FLUSH_STEPS 4096
+
+static uint64_t
+sum16_scalar (const uint8_t *data, size_t len)
+{
+    uint64_t sum = 0;
+    size_t i;
+
+    for (i = 0; i + 1 < len; i += 2)
+    {
+        uint16_t word;
+
+        memcpy (&word, data + i, sizeof (word));
+        sum += word;
+    }
+
+    /* An odd trailing byte is padded with a zero byte, in memory order so
+     * that the sum stays independent of the host byte order (RFC 1071). */
+
+    if (len % 2)
+    {
+        uint16_t word = 0;
+
+        memcpy (&word, data + len - 1, 1);
+        sum += word;
+    }
+    return sum;
+}
+
+#ifdef CHECKSUM_SIMD
+
+__attribute__ ((target ("avx2"))) static uint64_t
+sum16_avx2 (const uint8_t *data, size_t len, size_t *done)
+{
+    const __m256i zero = _mm256_setzero_si256 ();
+    uint64_t sum = 0;
+    size_t i = 0;
+
+    while (i + 32 <= len)
+    {
+        __m256i acc = zero;
+        uint32_t lanes[8];
+
+        for (int step = 0; step < CHECKSUM_FLUSH_STEPS && i + 32 <= len;
+             ++step, i += 32)
+        {
+            __m256i v = _mm256_loadu_si256 ((const __m256i *)(data + i));
+
+            acc = _mm256_add_epi32 (acc, _mm256_unpacklo_epi16 (v, zero));
+            acc = _mm256_add_epi32 (acc, _mm256_unpackhi_epi16 (v, zero));
+        }
+        _mm256_storeu_si256 ((__m256i *)lanes, acc);
+        for (int l = 0; l < 8; ++l)
+        {
+            sum += lanes[l];
+        }
+    }
+    *done = i;
+    return sum;
+}
+
+__attribute__ ((target ("sse2"))) static uint64_t
+sum16_sse2 (const uint8_t *data, size_t len, size_t *done)
+{
+    const __m128i zero = _mm_setzero_si128 ();
+    uint64_t sum = 0;
+    size_t i = 0;
+
+    while (i + 16 <= len)
+    {
+        __m128i acc = zero;
+        uint32_t lanes[4];
+
+        for (int step = 0; step < CHECKSUM_FLUSH_STEPS && i + 16 <= len;
+             ++step, i += 16)
+        {
+            __m128i v = _mm_loadu_si128 ((const __m128i *)(data + i));
+
+            acc = _mm_add_epi32 (acc, _mm_unpacklo_epi16 (v, zero));
+            acc = _mm_add_epi32 (acc, _mm_unpackhi_epi16 (v, zero));
+        }
+        _mm_storeu_si128 ((__m128i *)lanes, acc);
+        for (int l = 0; l < 4; ++l)
+        {
+            sum += lanes[l];
+        }
+    }
+    *done = i;
+    return sum;
+}
+
+#endif
+
 /**
  * @brief Compute a checksum for data integrity.
  *
@@ -15,84 +118,232 @@
  *    set of octets, including the checksum field. If the result is all 1 bits
  *    (i.e., -0 in 1's complement arithmetic), the check succeeds.
  *
- * @param ping_pkt Pointer to the `ping_packet` structure whose data is to be
- * checksummed.
- * @param len Size of the `ping_packet` structure.
+ * The words are added into wide accumulators and folded once at the end.
+ * Large buffers are summed 32 or 16 bytes at a time with AVX2 or SSE2 when
+ * the CPU supports them, the scalar loop handles the rest.
+ *
+ * @param data data to be checksummed
+ * @param len number of bytes
  *
  * @return The computed checksum as a 16-bit integer.
  */
 
-static uint16_t
-compute_checksum_v4 (struct ping_packet_v4 *ping_pkt, size_t len)
+uint16_t
+ping_checksum (const void *data, size_t len)
 {
-    const uint16_t *data = (const void *)ping_pkt;
-    uint32_t sum = 0;
+    const uint8_t *bytes = data;
+    uint64_t sum = 0;
+    size_t done = 0;
 
-    /* Add 16-bit words */
-    for (size_t i = 0; i < len / 2; ++i)
+#ifdef CHECKSUM_SIMD
+    if (len >= CHECKSUM_SIMD_MIN)
     {
-        sum += data[i];
+        if (__builtin_cpu_supports ("avx2"))
+        {
+            sum = sum16_avx2 (bytes, len, &done);
+        }
+        else if (__builtin_cpu_supports ("sse2"))
+        {
+            sum = sum16_sse2 (bytes, len, &done);
+        }
     }
+#endif
+    sum += sum16_scalar (bytes + done, len - done);
 
-    /* Carry bit (if the length is odd, add the last byte) */
-    if (len % 2)
+    /* Fold 64-bit sum to 16 bits */
+    while (sum >> 16)
     {
-        sum += ((const uint8_t *)data)[len - 1] << 8;
+        sum = (sum & 0xFFFF) + (sum >> 16);
     }
+    return ~sum;
+}
+
+/**
+ * @brief Updates a checksum after some 16-bit aligned words changed, without
+ * summing the whole packet again (RFC 1624, eqn. 3):
+ *
+ * HC' = ~(~HC + ~m + m')
+ *
+ * @param checksum checksum covering the old words
+ * @param old words before the change
+ * @param new words after the change
+ * @param len number of bytes changed, even
+ * @return the checksum covering the new words.
+ */
+
+static uint16_t
+checksum_adjust (uint16_t checksum, const void *old, const void *new,
+                 size_t len)
+{
+    const uint8_t *o = old;
+    const uint8_t *n = new;
+    uint32_t sum = (uint16_t)~checksum;
+
+    for (size_t i = 0; i < len; i += 2)
+    {
+        uint16_t m, m2;
 
-    /* Fold 32-bit sum to 16 bits */
+        memcpy (&m, o + i, sizeof (m));
+        memcpy (&m2, n + i, sizeof (m2));
+        sum += (uint16_t)~m;
+        sum += m2;
+    }
     while (sum >> 16)
     {
         sum = (sum & 0xFFFF) + (sum >> 16);
     }
-
     return ~sum;
 }
 
+/**
+ * @brief Bytes at the head of the payload carrying the send time, nothing is
+ * embedded when the payload is too short to hold it.
+ */
+
+static size_t
+stamp_len ()
+{
+    return g_ping.options.datalen >= sizeof (struct timespec)
+               ? sizeof (struct timespec)
+               : 0;
+}
+
+/**
+ * @brief Fills a payload with the pattern given with -p repeated, or with
+ * DEFAULT_PATTERN, the room of the send time is left to zero.
+ */
+
+static void
+fill_payload (uint8_t *data)
+{
+    const struct s_options *options = &g_ping.options;
+
+    if (options->pattern_len == 0)
+    {
+        memset (data, DEFAULT_PATTERN, options->datalen);
+    }
+    else
+    {
+        for (size_t i = 0; i < options->datalen; ++i)
+        {
+            data[i] = options->pattern[i % options->pattern_len];
+        }
+    }
+    memset (data, 0, stamp_len ());
+}
+
+/**
+ * @brief Builds the Echo Request templates of the calling context once, only
+ * the sequence and the send time embedded in the payload differ from one
+ * request to the next.
+ * @param v4 ICMPv4 template of s_batch.pkt_size bytes
+ * @param v6 ICMPv6 template of s_batch.pkt_size bytes
+ */
+
 void
-fill_icmp_packet_v4 (struct ping_packet_v4 *ping_pkt)
+ping_template_init (struct ping_packet_v4 *v4, struct ping_packet_v6 *v6)
 {
-    static int sequence = 0;
-
-    memset (ping_pkt, 0, sizeof (struct ping_packet_v4));
-    ping_pkt->hdr.type = ICMP_ECHO;
-    ping_pkt->hdr.code = 0;
-    /* Using the mask ensures that the ID does not exceed 16 bits, which is a
-     * convention for ICMP packets */
-    ping_pkt->hdr.un.echo.id = htons (getpid () & 0xFFFF);
-    ping_pkt->hdr.un.echo.sequence = htons (++sequence);
-    /* Filling data payload with random data */
-    memset (ping_pkt->data, 0xA5, sizeof (ping_pkt->data));
+    size_t size = g_ping.batch->pkt_size;
+
+    memset (v4, 0, size);
+    v4->hdr.type = ICMP_ECHO;
+    v4->hdr.code = 0;
+    /* Each socket has its own identifier, the replies are demultiplexed on
+     * it. A datagram socket overwrites it with the one the kernel picked. */
+    v4->hdr.un.echo.id = htons (g_ping.sock_info.v4.ident);
+    fill_payload (v4->data);
     /* Remember to set the checksum to 0 since it will be calculated on the
      * entire ICMP packet. */
-    ping_pkt->hdr.checksum = 0;
+    v4->hdr.checksum = 0;
+    v4->hdr.checksum = ping_checksum (v4, size);
+
+    memset (v6, 0, size);
+    v6->hdr.icmp6_type = ICMP6_ECHO_REQUEST;
+    v6->hdr.icmp6_code = 0;
+    v6->hdr.icmp6_dataun.icmp6_un_data16[0] = htons (g_ping.sock_info.v6.ident);
+    fill_payload (v6->data);
+    /* The checksum will be calculated by the TCP/IP stack. */
+    v6->hdr.icmp6_cksum = 0;
+}
+
+/**
+ * @brief Copies the template and stamps the sequence and the send time, the
+ * sequence field is immediately followed by the payload so both are covered
+ * by a single incremental checksum update.
+ */
+
+void
+fill_icmp_packet_v4 (struct ping_packet_v4 *ping_pkt, uint16_t sequence,
+                     const struct timespec *sent)
+{
+    const struct ping_packet_v4 *tmpl = g_ping.batch->tmpl_v4;
+
+    memcpy (ping_pkt, tmpl, g_ping.batch->pkt_size);
+    ping_pkt->hdr.un.echo.sequence = htons (sequence);
+    memcpy (ping_pkt->data, sent, stamp_len ());
     ping_pkt->hdr.checksum
-        = compute_checksum_v4 (ping_pkt, sizeof (struct ping_packet_v4));
+        = checksum_adjust (tmpl->hdr.checksum, &tmpl->hdr.un.echo.sequence,
+                           &ping_pkt->hdr.un.echo.sequence,
+                           sizeof (uint16_t) + stamp_len ());
 }
 
 void
-fill_icmp_packet_v6 (struct ping_packet_v6 *ping_pkt)
+fill_icmp_packet_v6 (struct ping_packet_v6 *ping_pkt, uint16_t sequence,
+                     const struct timespec *sent)
 {
-    static int sequence = 0;
-
-    memset (ping_pkt, 0, sizeof (struct ping_packet_v6));
-    ping_pkt->hdr.icmp6_type = ICMP6_ECHO_REQUEST;
-    ping_pkt->hdr.icmp6_code = 0;
-    uint16_t identifier = getpid () & 0xFFFF;
-    uint16_t seq = ++sequence;
-    ping_pkt->hdr.icmp6_dataun.icmp6_un_data16[0] = htons (identifier);
-    ping_pkt->hdr.icmp6_dataun.icmp6_un_data16[1] = htons (seq);
-    memset (ping_pkt->data, 0xA5, sizeof (ping_pkt->data));
-    /* The checksum will be calculated by the TCP/IP stack. */
-    ping_pkt->hdr.icmp6_cksum = 0;
+    memcpy (ping_pkt, g_ping.batch->tmpl_v6, g_ping.batch->pkt_size);
+    ping_pkt->hdr.icmp6_dataun.icmp6_un_data16[1] = htons (sequence);
+    memcpy (ping_pkt->data, sent, stamp_len ());
 }
 
+/**
+ * @brief Checks the payload echoed back by a reply against the one of its
+ * request. Both parts are compared with memcmp(), which glibc dispatches to
+ * its SSE2/AVX2 implementation, the first wrong byte is only looked up on a
+ * mismatch.
+ * @param probe probe answered by the reply
+ * @param data payload of the reply
+ * @param len payload length of the reply, at most the request one
+ * @param ipv address family of the reply
+ * @param should_be receives the expected value of the first wrong byte
+ * @return the offset of the first wrong byte, -1 if the payload is intact.
+ */
+
+ssize_t
+payload_mismatch (const struct s_probe *probe, const uint8_t *data,
+                  size_t len, ip_version ipv, uint8_t *should_be)
+{
+    const uint8_t *expected = ipv == IPV6 ? g_ping.batch->tmpl_v6->data
+                                          : g_ping.batch->tmpl_v4->data;
+    const uint8_t *sent = (const uint8_t *)&probe->sent;
+    size_t stamp = stamp_len () < len ? stamp_len () : len;
+
+    if (memcmp (data, sent, stamp) == 0
+        && memcmp (data + stamp, expected + stamp, len - stamp) == 0)
+    {
+        return -1;
+    }
+
+    for (size_t i = 0; i < len; ++i)
+    {
+        *should_be = i < stamp ? sent[i] : expected[i];
+        if (data[i] != *should_be)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Checks the checksum of a received ICMP message over its actual
+ * length, the sum including the checksum field is then zero.
+ * @param icmp ICMP header of the message
+ * @param len length of the ICMP message
+ */
+
 _Bool
-verify_checksum (struct ping_packet_v4 *ping_pkt)
+verify_checksum (const void *icmp, size_t len)
 {
-    uint16_t received_checksum = ping_pkt->hdr.checksum;
-    ping_pkt->hdr.checksum = 0;
-    uint16_t computed_checksum
-        = compute_checksum_v4 (ping_pkt, sizeof (struct ping_packet_v4));
-    return (computed_checksum == received_checksum);
-}
\ No newline at end of file
+    return ping_checksum (icmp, len) == 0;
+}
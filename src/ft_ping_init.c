@@ -1,60 +1,345 @@
 #include "ft_ping.h"
 
+static struct s_hwtstamp_saved g_hwtstamp
+    = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
 void
 ping_init_g_info()
 {
     g_ping.options.ipv = UNSPEC;
     g_ping.info.read_loop = true;
-    g_ping.info.ready_send = true;
-    g_ping.stats.timeout_threshold = TIMEOUT;
+    g_ping.stats.timeout_threshold = LOSS_TIMEOUT_INIT_MSEC;
+    g_ping.sock_info.v4.fd = -1;
+    g_ping.sock_info.v6.fd = -1;
+    g_ping.event.epoll_fd = -1;
+    g_ping.event.timer_fd = -1;
+    g_ping.event.stop_fd = -1;
+    g_ping.event.resolve_fd = -1;
+    g_ping.options.workers = 1;
+    g_ping.options.datalen = DEFAULT_DATALEN;
+    /* Using the mask ensures that the ID does not exceed 16 bits, which is a
+     * convention for ICMP packets */
+    g_ping.info.ident = getpid () & 0xFFFF;
+
+    /* The probe ring and the reply window are allocated once, their size
+     * does not depend on the session length nor on the number of probes in
+     * flight. */
+
+    if ((g_ping.probes = calloc (PROBE_RING_SIZE, sizeof (struct s_probe)))
+            == NULL
+        || (g_ping.answered = calloc (REPLY_WINDOW_WORDS, sizeof (uint64_t)))
+               == NULL)
+    {
+        perror ("calloc");
+        exit (EXIT_FAILURE);
+    }
+    ping_wheel_init ();
 }
 
-void
-ping_socket_init ()
+/**
+ * @brief Finds the interface the destination is routed through. Connecting a
+ * UDP socket does not send anything, it only selects the source address
+ * which is then looked up among the interface addresses.
+ * @param target destination whose route is looked up
+ * @param ifname buffer of IF_NAMESIZE bytes receiving the interface name
+ * @return 0 on success, -1 otherwise.
+ */
+
+static int
+egress_interface (const struct s_target *target, char *ifname)
 {
-    /* SOCK_RAW provides access to internal network protocols and interfaces,
-     * which is essential for creating, sending and receiving ICMP packets, only
-     * available to users with root-user authority. */
+    struct sockaddr_storage local;
+    socklen_t len = sizeof (local);
+    struct ifaddrs *ifa_list, *ifa;
+    int fd;
+    int ret = -1;
 
-    if ((g_ping.sock_info.sock_fd
-         = socket (g_ping.options.ipv == IPV6 ? AF_INET6 : AF_INET, SOCK_RAW,
-                   g_ping.options.ipv == IPV6 ? IPPROTO_ICMPV6 : IPPROTO_ICMP))
+    if ((fd = socket (target->ipv == IPV6 ? AF_INET6 : AF_INET, SOCK_DGRAM, 0))
         == -1)
     {
-        perror ("socket");
+        return -1;
+    }
+
+    if ((target->ipv == IPV6
+             ? connect (fd, (struct sockaddr *)&target->addr_6,
+                        sizeof (target->addr_6))
+             : connect (fd, (struct sockaddr *)&target->addr_4,
+                        sizeof (target->addr_4)))
+            == -1
+        || getsockname (fd, (struct sockaddr *)&local, &len) == -1
+        || getifaddrs (&ifa_list) == -1)
+    {
+        close (fd);
+        return -1;
+    }
+    close (fd);
+
+    for (ifa = ifa_list; ifa != NULL && ret == -1; ifa = ifa->ifa_next)
+    {
+        if (ifa->ifa_addr == NULL || ifa->ifa_addr->sa_family != local.ss_family)
+        {
+            continue;
+        }
+        if ((local.ss_family == AF_INET
+             && ((struct sockaddr_in *)ifa->ifa_addr)->sin_addr.s_addr
+                    == ((struct sockaddr_in *)&local)->sin_addr.s_addr)
+            || (local.ss_family == AF_INET6
+                && memcmp (&((struct sockaddr_in6 *)ifa->ifa_addr)->sin6_addr,
+                           &((struct sockaddr_in6 *)&local)->sin6_addr,
+                           sizeof (struct in6_addr))
+                       == 0))
+        {
+            snprintf (ifname, IF_NAMESIZE, "%s", ifa->ifa_name);
+            ret = 0;
+        }
+    }
+
+    freeifaddrs (ifa_list);
+    return ret;
+}
+
+/**
+ * @brief Puts back the hardware timestamping configuration of every
+ * interface changed by -K hardware, registered with atexit() so that it
+ * runs once on any exit of the process, after every worker is done.
+ */
+
+static void
+restore_hw_timestamping ()
+{
+    struct ifreq ifr;
+    int fd;
+
+    if ((fd = socket (AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0)) == -1)
+    {
+        return;
+    }
+    pthread_mutex_lock (&g_hwtstamp.lock);
+    for (uint32_t i = 0; i < g_hwtstamp.nb_ifaces; ++i)
+    {
+        memset (&ifr, 0, sizeof (ifr));
+        memcpy (ifr.ifr_name, g_hwtstamp.ifname[i], IF_NAMESIZE);
+        ifr.ifr_data = (char *)&g_hwtstamp.config[i];
+        ioctl (fd, SIOCSHWTSTAMP, &ifr);
+    }
+    g_hwtstamp.nb_ifaces = 0;
+    pthread_mutex_unlock (&g_hwtstamp.lock);
+    close (fd);
+}
+
+/**
+ * @brief Saves the configuration of an interface the first time any thread
+ * is about to change it. An interface beyond HWTSTAMP_IFACES_MAX is left as
+ * it is.
+ * @param fd socket used for the ioctl
+ * @param ifname interface about to be changed
+ * @return 0 if the configuration is saved, -1 otherwise.
+ */
+
+static int
+save_hw_timestamping (int fd, const char *ifname)
+{
+    struct ifreq ifr;
+    int ret = -1;
+
+    pthread_mutex_lock (&g_hwtstamp.lock);
+    for (uint32_t i = 0; i < g_hwtstamp.nb_ifaces && ret == -1; ++i)
+    {
+        if (strncmp (g_hwtstamp.ifname[i], ifname, IF_NAMESIZE) == 0)
+        {
+            ret = 0;
+        }
+    }
+    if (ret == -1 && g_hwtstamp.nb_ifaces < HWTSTAMP_IFACES_MAX)
+    {
+        uint32_t i = g_hwtstamp.nb_ifaces;
+
+        memset (&ifr, 0, sizeof (ifr));
+        memcpy (ifr.ifr_name, ifname, IF_NAMESIZE);
+        ifr.ifr_data = (char *)&g_hwtstamp.config[i];
+        if (ioctl (fd, SIOCGHWTSTAMP, &ifr) == 0)
+        {
+            memcpy (g_hwtstamp.ifname[i], ifname, IF_NAMESIZE);
+            if (g_hwtstamp.nb_ifaces++ == 0)
+            {
+                atexit (restore_hw_timestamping);
+            }
+            ret = 0;
+        }
+    }
+    pthread_mutex_unlock (&g_hwtstamp.lock);
+    return ret;
+}
+
+/**
+ * @brief Asks the NIC of the egress interface to stamp every packet. This
+ * needs a driver supporting SIOCSHWTSTAMP, loopback and most virtual
+ * interfaces do not. The setting is NIC wide, a PTP daemon relying on the
+ * same interface is affected until the previous configuration, saved with
+ * SIOCGHWTSTAMP, is restored at exit.
+ * @param fd socket used for the ioctl
+ * @param target destination whose egress interface is configured
+ * @return 0 if hardware timestamping is enabled, -1 otherwise.
+ */
+
+static int
+enable_hw_timestamping (int fd, const struct s_target *target)
+{
+    struct hwtstamp_config config;
+    struct ifreq ifr;
+
+    memset (&ifr, 0, sizeof (ifr));
+    if (egress_interface (target, ifr.ifr_name) == -1
+        || save_hw_timestamping (fd, ifr.ifr_name) == -1)
+    {
+        return -1;
+    }
+
+    memset (&config, 0, sizeof (config));
+    config.tx_type = HWTSTAMP_TX_ON;
+    config.rx_filter = HWTSTAMP_FILTER_ALL;
+    ifr.ifr_data = (char *)&config;
+
+    if (ioctl (fd, SIOCSHWTSTAMP, &ifr) == -1)
+    {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Enables SO_TIMESTAMPING. Receive stamps come along with the
+ * datagrams, transmit stamps are queued on the socket error queue with a
+ * per socket counter (OPT_ID) identifying the request, without a copy of the
+ * packet (OPT_TSONLY). Hardware stamps fall back to software ones when the
+ * NIC does not offer them.
+ * @param sock socket to configure
+ * @param target first destination reached through the socket
+ */
+
+static void
+ping_timestamping_init (struct s_icmp_socket *sock,
+                        const struct s_target *target)
+{
+    int flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_TX_SOFTWARE
+                | SOF_TIMESTAMPING_SOFTWARE | SOF_TIMESTAMPING_OPT_ID
+                | SOF_TIMESTAMPING_OPT_TSONLY;
+
+    if (g_ping.options.timestamping == TS_HARDWARE)
+    {
+        if (enable_hw_timestamping (sock->fd, target) == 0)
+        {
+            flags |= SOF_TIMESTAMPING_RX_HARDWARE | SOF_TIMESTAMPING_TX_HARDWARE
+                     | SOF_TIMESTAMPING_RAW_HARDWARE;
+        }
+        else
+        {
+            fprintf (stderr, "Hardware timestamping unavailable for %s, "
+                             "using software timestamps\n",
+                     target->ip_addr);
+            g_ping.options.timestamping = TS_SOFTWARE;
+        }
+    }
+
+    if (setsockopt (sock->fd, SOL_SOCKET, SO_TIMESTAMPING, &flags,
+                    sizeof (flags))
+        < 0)
+    {
+        perror ("setsockopt");
+        release_resources ();
+        exit (EXIT_FAILURE);
+    }
+
+    if ((sock->tx_seq = calloc (PROBE_RING_SIZE, sizeof (uint16_t))) == NULL)
+    {
+        perror ("calloc");
+        release_resources ();
         exit (EXIT_FAILURE);
     }
+}
 
-    /* setup destination socket address structure for preparing the socket to
-     * send ICMPv4/v6 Echo Request messages */
+/**
+ * @brief Opens the socket of one address family. An ICMP datagram socket
+ * needs no privilege as long as the group of the process is within
+ * net.ipv4.ping_group_range, the kernel then assigns the Echo identifier on
+ * bind, fills in the checksum and only delivers the replies to our own
+ * requests, ICMP errors come through the error queue. Raw sockets are the
+ * fallback, they see every ICMP packet of the host which is filtered in the
+ * kernel on our own identifier.
+ * @param sock socket to open
+ * @param ipv address family of the socket
+ */
 
-    if (g_ping.options.ipv == IPV6)
+static void
+icmp_socket_open (struct s_icmp_socket *sock, ip_version ipv)
+{
+    int domain = ipv == IPV6 ? AF_INET6 : AF_INET;
+    int protocol = ipv == IPV6 ? IPPROTO_ICMPV6 : IPPROTO_ICMP;
+    struct sockaddr_storage addr;
+    socklen_t len = ipv == IPV6 ? sizeof (struct sockaddr_in6)
+                                : sizeof (struct sockaddr_in);
+    int on = 1;
+
+    if ((sock->fd = socket (domain, SOCK_DGRAM, protocol)) != -1)
     {
-        memset (&g_ping.sock_info.addr_6, 0, sizeof (g_ping.sock_info.addr_6));
-        g_ping.sock_info.addr_6.sin6_family = AF_INET6;
-        g_ping.sock_info.addr_6.sin6_port = htons (0);
-        if (inet_pton (AF_INET6, g_ping.sock_info.ip_addr,
-                       &g_ping.sock_info.addr_6.sin6_addr)
-            != 1)
+        sock->dgram = true;
+        memset (&addr, 0, sizeof (addr));
+        addr.ss_family = domain;
+
+        if (bind (sock->fd, (struct sockaddr *)&addr, len) == -1
+            || getsockname (sock->fd, (struct sockaddr *)&addr, &len) == -1)
         {
-            perror ("inet_pton");
+            perror ("bind");
             release_resources ();
             exit (EXIT_FAILURE);
         }
-    }
-    else
-    {
-        memset (&g_ping.sock_info.addr_4, 0, sizeof (g_ping.sock_info.addr_4));
-        g_ping.sock_info.addr_4.sin_family = AF_INET;
-        g_ping.sock_info.addr_4.sin_port = htons (0);
-        if (!(g_ping.sock_info.addr_4.sin_addr.s_addr
-              = inet_addr (g_ping.sock_info.ip_addr)))
+        sock->ident = ntohs (ipv == IPV6
+                                 ? ((struct sockaddr_in6 *)&addr)->sin6_port
+                                 : ((struct sockaddr_in *)&addr)->sin_port);
+
+        if (setsockopt (sock->fd, ipv == IPV6 ? IPPROTO_IPV6 : IPPROTO_IP,
+                        ipv == IPV6 ? IPV6_RECVERR : IP_RECVERR, &on,
+                        sizeof (on))
+            < 0)
         {
-            fprintf (stderr, "inet_addr\n");
+            perror ("setsockopt");
             release_resources ();
             exit (EXIT_FAILURE);
         }
+        return;
+    }
+
+    /* SOCK_RAW provides access to internal network protocols and interfaces,
+     * which is essential for creating, sending and receiving ICMP packets, only
+     * available to users with root-user authority. */
+
+    if ((sock->fd = socket (domain, SOCK_RAW, protocol)) == -1)
+    {
+        perror ("socket");
+        release_resources ();
+        exit (EXIT_FAILURE);
     }
+    sock->dgram = false;
+    sock->ident = g_ping.info.ident;
+
+    /* A raw socket receives every ICMP packet of the host, the ones that are
+     * not meant for us are dropped in the kernel. */
+
+    ping_filter_attach (sock->fd, ipv);
+}
+
+/**
+ * @brief Opens and configures the socket of one address family.
+ * @param sock socket to open
+ * @param ipv address family of the socket
+ * @param target first destination reached through the socket
+ */
+
+static void
+icmp_socket_init (struct s_icmp_socket *sock, ip_version ipv,
+                  const struct s_target *target)
+{
+    icmp_socket_open (sock, ipv);
 
     /* The purpose of TTL is to prevent packets from circulating indefinitely in
      * case of routing loops. "Time Exceeded" is returned to the user if the
@@ -62,10 +347,9 @@ ping_socket_init ()
 
     int hopli = g_ping.options.ttl ? g_ping.options.ttl : 64;
 
-    if (setsockopt (g_ping.sock_info.sock_fd,
-                    g_ping.options.ipv == IPV6 ? IPPROTO_IPV6 : IPPROTO_IP,
-                    g_ping.options.ipv == IPV6 ? IPV6_UNICAST_HOPS : IP_TTL,
-                    &hopli, sizeof (hopli))
+    if (setsockopt (sock->fd, ipv == IPV6 ? IPPROTO_IPV6 : IPPROTO_IP,
+                    ipv == IPV6 ? IPV6_UNICAST_HOPS : IP_TTL, &hopli,
+                    sizeof (hopli))
         < 0)
     {
         perror ("setsockopt");
@@ -73,7 +357,22 @@ ping_socket_init ()
         exit (EXIT_FAILURE);
     }
 
-    if (g_ping.options.ipv == IPV6)
+    if (ipv == IPV4 && sock->dgram)
+    {
+        int on = 1;
+
+        /* Without the IP header, the TTL of a reply comes as ancillary data. */
+
+        if (setsockopt (sock->fd, IPPROTO_IP, IP_RECVTTL, &on, sizeof (on))
+            < 0)
+        {
+            perror ("setsockopt");
+            release_resources ();
+            exit (EXIT_FAILURE);
+        }
+    }
+
+    if (ipv == IPV6)
     {
         int on = 1;
         struct icmp6_filter filter;
@@ -90,8 +389,8 @@ ping_socket_init ()
         /* configures to receive the Hop Limit value from incoming packets by
          * setting the IPV6_RECVHOPLIMIT socket option. */
 
-        if (setsockopt (g_ping.sock_info.sock_fd, IPPROTO_IPV6,
-                        IPV6_RECVHOPLIMIT, &on, sizeof (on))
+        if (setsockopt (sock->fd, IPPROTO_IPV6, IPV6_RECVHOPLIMIT, &on,
+                        sizeof (on))
             < 0)
         {
             perror ("setsockopt");
@@ -102,9 +401,10 @@ ping_socket_init ()
         /* Applies filtering on ICMPv6 packets, allowing us to remove some
          * message handling complexity on receiving */
 
-        if (setsockopt (g_ping.sock_info.sock_fd, IPPROTO_ICMPV6, ICMP6_FILTER,
-                        &filter, sizeof (filter))
-            < 0)
+        if (!sock->dgram
+            && setsockopt (sock->fd, IPPROTO_ICMPV6, ICMP6_FILTER, &filter,
+                           sizeof (filter))
+                   < 0)
         {
             perror ("setsockopt");
             release_resources ();
@@ -112,6 +412,45 @@ ping_socket_init ()
         }
     }
 
+    /* Every datagram is stamped by the kernel on reception, the stamp is
+     * carried in the control messages and keeps replies drained in a batch
+     * from sharing a single receive time. */
+
+    int on = 1;
+
+    if (g_ping.options.timestamping != TS_NONE)
+    {
+        ping_timestamping_init (sock, target);
+    }
+    else if (setsockopt (sock->fd, SOL_SOCKET, SO_TIMESTAMPNS, &on,
+                         sizeof (on))
+             < 0)
+    {
+        perror ("setsockopt");
+        release_resources ();
+        exit (EXIT_FAILURE);
+    }
+
+    /* Large requests would leave room for a handful of replies only in the
+     * default receive buffer, it is grown to hold a whole batch. */
+
+    int rcvbuf;
+    int wanted = RECV_BATCH_MAX
+                 * (IP_HEADER_MAX + sizeof (struct icmphdr)
+                    + g_ping.options.datalen);
+    socklen_t optlen = sizeof (rcvbuf);
+
+    if (getsockopt (sock->fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, &optlen) < 0
+        || (rcvbuf < wanted
+            && setsockopt (sock->fd, SOL_SOCKET, SO_RCVBUF, &wanted,
+                           sizeof (wanted))
+                   < 0))
+    {
+        perror ("setsockopt");
+        release_resources ();
+        exit (EXIT_FAILURE);
+    }
+
     /* Socket options IP_TOS and IPV6_TCLASS are used to set the Type of Service
      * (ToS) and Traffic Class, respectively. These settings determine how
      * routers and network devices handle and prioritize packets as they travel
@@ -119,9 +458,8 @@ ping_socket_init ()
 
     int optval = 0x10;
 
-    if (setsockopt (g_ping.sock_info.sock_fd,
-                    g_ping.options.ipv == IPV6 ? IPPROTO_IPV6 : IPPROTO_IP,
-                    g_ping.options.ipv == IPV6 ? IPV6_TCLASS : IP_TOS, &optval,
+    if (setsockopt (sock->fd, ipv == IPV6 ? IPPROTO_IPV6 : IPPROTO_IP,
+                    ipv == IPV6 ? IPV6_TCLASS : IP_TOS, &optval,
                     sizeof (optval))
         < 0)
     {
@@ -129,4 +467,193 @@ ping_socket_init ()
         release_resources ();
         exit (EXIT_FAILURE);
     }
-}
\ No newline at end of file
+}
+
+/**
+ * @brief Registers a descriptor on the epoll instance of the session.
+ * @param fd descriptor to watch for readability
+ */
+
+void
+ping_event_watch (int fd)
+{
+    struct epoll_event ev;
+
+    memset (&ev, 0, sizeof (ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+
+    if (epoll_ctl (g_ping.event.epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1)
+    {
+        perror ("epoll_ctl");
+        release_resources ();
+        exit (EXIT_FAILURE);
+    }
+}
+
+/**
+ * @brief Opens the socket of the address family of a target unless it is
+ * already open. A target resolved once the session is running may bring a
+ * new family, its socket then joins the event loop and its request template
+ * is built with the identifier of the new socket.
+ * @param target destination reached through the socket
+ */
+
+void
+ping_socket_open (const struct s_target *target)
+{
+    struct s_icmp_socket *sock = target->ipv == IPV6 ? &g_ping.sock_info.v6
+                                                     : &g_ping.sock_info.v4;
+
+    if (sock->fd != -1)
+    {
+        return;
+    }
+
+    icmp_socket_init (sock, target->ipv, target);
+
+    if (g_ping.io != NULL)
+    {
+        g_ping.io->watch (sock, target->ipv);
+    }
+    if (g_ping.batch != NULL)
+    {
+        ping_template_init (g_ping.batch->tmpl_v4, g_ping.batch->tmpl_v6);
+    }
+}
+
+/**
+ * @brief Opens one socket for each address family found among the targets,
+ * every target of a family shares it.
+ */
+
+void
+ping_socket_init ()
+{
+    for (uint32_t i = 0; i < g_ping.nb_targets; ++i)
+    {
+        ping_socket_open (&g_ping.targets[i]);
+    }
+}
+
+/**
+ * @brief Sets up the event loop driving the ping session.
+ * The sockets, or the io_uring instance, and a timerfd are registered on an
+ * epoll instance so the process only wakes up when a packet is readable or
+ * when the next Echo Request is due, instead of polling the socket with
+ * MSG_DONTWAIT.
+ */
+
+void
+ping_event_init ()
+{
+    if ((g_ping.event.epoll_fd = epoll_create1 (EPOLL_CLOEXEC)) == -1)
+    {
+        perror ("epoll_create1");
+        release_resources ();
+        exit (EXIT_FAILURE);
+    }
+
+    /* CLOCK_MONOTONIC is immune to wall clock adjustments, the send schedule
+     * must not jump if the system time is changed. */
+
+    if ((g_ping.event.timer_fd
+         = timerfd_create (CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC))
+        == -1)
+    {
+        perror ("timerfd_create");
+        release_resources ();
+        exit (EXIT_FAILURE);
+    }
+
+    ping_event_watch (g_ping.event.timer_fd);
+
+    /* A worker is woken up by the stop event shared by every worker, it is
+     * never read so that it stays readable for all of them. */
+
+    if (g_ping.event.stop_fd != -1)
+    {
+        ping_event_watch (g_ping.event.stop_fd);
+    }
+
+    /* Names still being resolved signal each completed request. */
+
+    if (g_ping.event.resolve_fd != -1)
+    {
+        ping_event_watch (g_ping.event.resolve_fd);
+    }
+
+    /* The sockets are watched through the I/O backend. */
+
+    ping_io_init ();
+}
+
+/**
+ * @brief Allocates the sendmmsg()/recvmmsg() vectors once for the whole
+ * session. Every message points to its own packet buffer, the destination
+ * and length of a request are set when it is filled, and only the lengths
+ * updated by the kernel need to be reset before each batch of replies.
+ */
+
+void
+ping_batch_init ()
+{
+    struct s_batch *batch;
+    size_t stride;
+
+    if ((batch = calloc (1, sizeof (struct s_batch))) == NULL)
+    {
+        perror ("calloc");
+        release_resources ();
+        exit (EXIT_FAILURE);
+    }
+    g_ping.batch = batch;
+
+    /* Both ICMP headers are 8 bytes long, a request has the same size in
+     * either family. Buffers are kept 16-byte aligned. */
+
+    batch->pkt_size = sizeof (struct icmphdr) + g_ping.options.datalen;
+    batch->rcv_size = IP_HEADER_MAX + batch->pkt_size;
+    if (batch->rcv_size < ICMP_ERROR_MAX)
+    {
+        batch->rcv_size = ICMP_ERROR_MAX;
+    }
+    stride = (batch->pkt_size + 15) & ~(size_t)15;
+    batch->rcv_size = (batch->rcv_size + 15) & ~(size_t)15;
+
+    if ((batch->buffers = calloc (1, (2 + SEND_BURST_MAX) * stride
+                                         + RECV_BATCH_MAX * batch->rcv_size))
+        == NULL)
+    {
+        perror ("calloc");
+        release_resources ();
+        exit (EXIT_FAILURE);
+    }
+    batch->tmpl_v4 = (struct ping_packet_v4 *)batch->buffers;
+    batch->tmpl_v6 = (struct ping_packet_v6 *)(batch->buffers + stride);
+    ping_template_init (batch->tmpl_v4, batch->tmpl_v6);
+
+    for (int i = 0; i < SEND_BURST_MAX; ++i)
+    {
+        struct msghdr *hdr = &batch->snd_msgs[i].msg_hdr;
+
+        batch->snd_iov[i].iov_base = batch->buffers + (2 + i) * stride;
+        batch->snd_iov[i].iov_len = batch->pkt_size;
+        hdr->msg_iov = &batch->snd_iov[i];
+        hdr->msg_iovlen = 1;
+    }
+
+    for (int i = 0; i < RECV_BATCH_MAX; ++i)
+    {
+        struct msghdr *hdr = &batch->rcv_msgs[i].msg_hdr;
+
+        batch->rcv_iov[i].iov_base = batch->buffers
+                                     + (2 + SEND_BURST_MAX) * stride
+                                     + i * batch->rcv_size;
+        batch->rcv_iov[i].iov_len = batch->rcv_size;
+        hdr->msg_iov = &batch->rcv_iov[i];
+        hdr->msg_iovlen = 1;
+        hdr->msg_name = &batch->rcv_addr[i];
+        hdr->msg_control = batch->rcv_ctrl[i];
+    }
+}
@@ -0,0 +1,138 @@
+#include "ft_ping.h"
+
+/**
+ * @brief A socket is watched by the event loop of the context, its replies
+ * are drained with recvmmsg() once it is readable.
+ */
+
+static void
+socket_watch (struct s_icmp_socket *sock, ip_version ipv)
+{
+    (void)ipv;
+    ping_event_watch (sock->fd);
+}
+
+/**
+ * @brief Sends a burst of requests with a single sendmmsg().
+ * @param sock socket of the address family of the requests
+ * @param msgs filled requests
+ * @param count number of requests
+ */
+
+static void
+socket_send (struct s_icmp_socket *sock, struct mmsghdr *msgs, int count)
+{
+    int sent = 0;
+    _Bool retried = false;
+
+    /* sendmmsg() may stop early, the remaining requests are sent again until
+     * the whole burst is out or a real error occurs. A datagram socket may
+     * report a pending ICMP error instead of sending a request: the failed
+     * call cleared it, so the request is sent again, once, and the ICMP error
+     * queued with it is picked up by the receive path. A second failure is
+     * the request's own.
+     * A request refused for its destination only fails its own target. */
+
+    while (sent < count)
+    {
+        int ret = sendmmsg (sock->fd, &msgs[sent], count - sent, 0);
+
+        if (ret == -1 && sock->dgram && !retried && icmp_soft_error (errno))
+        {
+            retried = true;
+            continue;
+        }
+        retried = false;
+        if (ret == -1 && icmp_send_error (errno))
+        {
+            ping_send_failed (sent++, errno);
+            continue;
+        }
+        if (ret == -1)
+        {
+            perror ("sendmmsg");
+            release_resources ();
+            exit (EXIT_FAILURE);
+        }
+        sent += ret;
+    }
+}
+
+static _Bool
+socket_handle (int fd)
+{
+    if (fd == g_ping.sock_info.v4.fd)
+    {
+        ping_socket_handler (&g_ping.sock_info.v4, IPV4);
+    }
+    else if (fd == g_ping.sock_info.v6.fd)
+    {
+        ping_socket_handler (&g_ping.sock_info.v6, IPV6);
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+static int
+socket_init ()
+{
+    return 0;
+}
+
+static void
+socket_release ()
+{
+}
+
+const struct s_io_backend g_io_socket
+    = { "socket", socket_init, socket_watch, socket_send, socket_handle,
+        socket_release };
+
+static const struct s_io_backend *const g_backends[] = {
+    [IO_SOCKET] = &g_io_socket,
+    [IO_URING] = &g_io_uring,
+    [IO_PACKET] = &g_io_packet,
+};
+
+/**
+ * @brief Sets up the backend chosen with -I for the calling context and
+ * hooks up the sockets already open. A backend the kernel or the privileges
+ * of the process do not allow, io_uring disabled or AF_PACKET without
+ * CAP_NET_RAW, falls back to the socket backend.
+ */
+
+void
+ping_io_init ()
+{
+    g_ping.io = g_backends[g_ping.options.io];
+
+    if (g_ping.io->init () == -1)
+    {
+        fprintf (stderr, "ping: %s backend unavailable, using sockets\n",
+                 g_ping.io->name);
+        g_ping.io->release ();
+        g_ping.io = &g_io_socket;
+    }
+
+    if (g_ping.sock_info.v4.fd != -1)
+    {
+        g_ping.io->watch (&g_ping.sock_info.v4, IPV4);
+    }
+    if (g_ping.sock_info.v6.fd != -1)
+    {
+        g_ping.io->watch (&g_ping.sock_info.v6, IPV6);
+    }
+}
+
+void
+ping_io_release ()
+{
+    if (g_ping.io != NULL)
+    {
+        g_ping.io->release ();
+        g_ping.io = NULL;
+    }
+}
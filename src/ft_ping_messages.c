@@ -3,62 +3,393 @@
 static const char *START_MESSAGE_FORMAT
     = "PING %s (%s) %lu(%lu) bytes of data.\n";
 static const char *PING_MESSAGE_FORMAT
-    = "%d bytes from %s (%s): icmp_seq=%d ttl=%hhu time=%.2fms\n";
+    = "%d bytes from %s (%s): icmp_seq=%" PRIu64 " ttl=%hhu time=%.2fms%s\n";
 
 static const char *END_MESSAGE_HEADER_FORMAT = "--- %s ping statistics ---\n";
 static const char *END_MESSAGE_STATS_FORMAT
-    = "%d packets transmitted, %d received, %.0f%% packet loss, time %.0f ms\n";
+    = "%" PRIu64 " packets transmitted, %" PRIu64 " received, ";
+static const char *END_MESSAGE_DUP_FORMAT = "+%" PRIu64 " duplicates, ";
+static const char *END_MESSAGE_LOSS_FORMAT
+    = "%.0f%% packet loss, time %.0f ms\n";
+static const char *END_MESSAGE_ORDER_FORMAT
+    = "%" PRIu64 " reordered (max depth %" PRIu64 "), %" PRIu64 " late\n";
 static const char *END_MESSAGE_RTT_FORMAT
     = "rtt min/avg/max/mdev = %.3f/%.3f/%.3f/%.3f ms\n";
 
+static const char *END_MESSAGE_PERCENTILES_FORMAT
+    = "rtt p50/p90/p99/p99.9/p99.99 = %.3f/%.3f/%.3f/%.3f/%.3f ms\n";
+static const char *END_MESSAGE_MEDIAN_FORMAT
+    = "rtt median = %.3f ms (%" PRIu64 " samples kept)\n";
+
+static const char *END_MESSAGE_ADDR_HEADER_FORMAT
+    = "--- %s (%s) ping statistics ---\n";
+
+static const char *COMPARE_HEADER_FORMAT
+    = "--- %s addresses side by side ---\n";
+static const char *COMPARE_TITLE_FORMAT
+    = "%-39s %8s %8s %6s %9s %9s %9s %9s\n";
+static const char *COMPARE_ROW_FORMAT
+    = "%-39s %8" PRIu64 " %8" PRIu64 " %5.1f%% %9.3f %9.3f %9.3f ";
+static const char *COMPARE_DELTA_FORMAT
+    = "rtt delta IPv6 - IPv4 (%s - %s) avg/p50/p99 = %+.3f/%+.3f/%+.3f ms\n";
+
+static const char *AGGREGATE_HEADER_FORMAT
+    = "--- %u targets aggregate statistics ---\n";
+
+static const char *HOP_MESSAGE_FORMAT
+    = "hop %u to %s from %s: icmp_seq=%" PRIu64 " time=%.2fms (%" PRIu64
+      "/%" PRIu64 " answered, avg %.3fms)%s\n";
+static const char *PATH_HEADER_FORMAT = "--- %s (%s) path statistics ---\n";
+static const char *PATH_TITLE_FORMAT
+    = "%4s  %-39s %6s %6s %6s %9s %9s %9s %9s\n";
+static const char *PATH_ROW_FORMAT
+    = "%4u  %-39s %6" PRIu64 " %6" PRIu64 " %5.1f%% ";
+static const char *PATH_RTT_FORMAT = "%9.3f %9.3f %9.3f %9.3f\n";
+
+static void
+start_message (const struct s_target *target)
+{
+    size_t datalen = g_ping.options.datalen;
+
+    printf (START_MESSAGE_FORMAT, target->hostname, target->ip_addr, datalen,
+            datalen + sizeof (struct icmphdr)
+                + (target->ipv == IPV6 ? sizeof (struct ip6_hdr)
+                                       : sizeof (struct iphdr)));
+}
+
+/**
+ * @brief Prints the counters of a target or of the aggregate. Duplicates,
+ * reordered and late replies are only mentioned when there were some.
+ */
+
+static void
+stats_message (const struct s_stats *stats)
+{
+    printf (END_MESSAGE_STATS_FORMAT, stats->nb_snd, stats->nb_res);
+    if (stats->nb_dup > 0)
+    {
+        printf (END_MESSAGE_DUP_FORMAT, stats->nb_dup);
+    }
+    printf (END_MESSAGE_LOSS_FORMAT, stats->pkt_loss, stats->ping_session);
+    if (stats->nb_reordered > 0 || stats->nb_late > 0)
+    {
+        printf (END_MESSAGE_ORDER_FORMAT, stats->nb_reordered,
+                stats->reorder_max, stats->nb_late);
+    }
+}
+
+static void
+percentiles_message (const struct s_stats *stats)
+{
+    if (stats->nb_res > 0)
+    {
+        printf (END_MESSAGE_PERCENTILES_FORMAT, stats->percentiles[0],
+                stats->percentiles[1], stats->percentiles[2],
+                stats->percentiles[3], stats->percentiles[4]);
+    }
+}
+
+static void
+end_message (struct s_target *target)
+{
+    compute_rtt_stats (target);
+    if (g_ping.options.all_addresses)
+    {
+        printf (END_MESSAGE_ADDR_HEADER_FORMAT, target->hostname,
+                target->ip_addr);
+    }
+    else
+    {
+        printf (END_MESSAGE_HEADER_FORMAT, target->hostname);
+    }
+    stats_message (&target->stats);
+    printf (END_MESSAGE_RTT_FORMAT, target->stats.min, target->stats.avg,
+            target->stats.max, target->stats.mdev);
+    percentiles_message (&target->stats);
+    if (g_ping.options.keep_samples && target->stats.nb_res > 0)
+    {
+        printf (END_MESSAGE_MEDIAN_FORMAT, target->stats.median,
+                target->nb_samples);
+    }
+}
+
+/**
+ * @brief Prints the answer to a path probe along with the running counters
+ * of its hop. The answers of hops past the destination are only counted.
+ */
+
+static void
+hop_message ()
+{
+    const struct s_info *info = &g_ping.info;
+    const struct s_target *target = info->target;
+    const struct s_hop *hop = &target->hops[info->hop - 1];
+    char from[INET6_ADDRSTRLEN];
+
+    if (info->hop > target->path_len)
+    {
+        return;
+    }
+    printf (HOP_MESSAGE_FORMAT, info->hop, target->ip_addr,
+            hop_addr (hop, from), info->sequence, info->rtt, hop->nb_res,
+            hop->nb_snd, hop->rtt.mean,
+            info->duplicate ? " (DUP!)"
+            : info->late    ? " (late)"
+                            : "");
+}
+
+/**
+ * @brief Prints the hops of the path to a target, up to the destination
+ * once it answered, mtr style.
+ */
+
+static void
+path_message (struct s_target *target)
+{
+    char addr[INET6_ADDRSTRLEN];
+
+    compute_hop_stats (target);
+    printf (PATH_HEADER_FORMAT, target->hostname, target->ip_addr);
+    printf (PATH_TITLE_FORMAT, "hop", "address", "sent", "recv", "loss", "min",
+            "avg", "max", "mdev");
+    for (uint8_t i = 0; i < target->path_len; ++i)
+    {
+        const struct s_hop *hop = &target->hops[i];
+
+        printf (PATH_ROW_FORMAT, i + 1, hop_addr (hop, addr), hop->nb_snd,
+                hop->nb_res, hop->pkt_loss);
+        if (hop->nb_res > 0)
+        {
+            printf (PATH_RTT_FORMAT, hop->rtt.min, hop->rtt.mean, hop->rtt.max,
+                    hop->mdev);
+        }
+        else
+        {
+            putchar ('\n');
+        }
+    }
+}
+
+/**
+ * @brief Puts the addresses of a host next to each other once their
+ * statistics are computed. Each address is compared with the first one, the
+ * first IPv4 and IPv6 addresses are compared when the host has both.
+ * @param first index of the first target of the host
+ * @param nb number of targets of the host
+ */
+
+static void
+compare_message (uint32_t first, uint32_t nb)
+{
+    const struct s_target *targets = &g_ping.targets[first];
+    const struct s_target *v4 = NULL;
+    const struct s_target *v6 = NULL;
+
+    printf (COMPARE_HEADER_FORMAT, targets[0].hostname);
+    printf (COMPARE_TITLE_FORMAT, "address", "sent", "recv", "loss", "avg",
+            "p50", "p99", "delta");
+
+    for (uint32_t i = 0; i < nb; ++i)
+    {
+        const struct s_stats *stats = &targets[i].stats;
+
+        printf (COMPARE_ROW_FORMAT, targets[i].ip_addr, stats->nb_snd,
+                stats->nb_res, stats->pkt_loss, stats->avg,
+                stats->percentiles[0], stats->percentiles[2]);
+        if (stats->nb_res > 0 && targets[0].stats.nb_res > 0)
+        {
+            printf ("%+9.3f\n", stats->avg - targets[0].stats.avg);
+        }
+        else
+        {
+            printf ("%9s\n", "-");
+        }
+
+        if (stats->nb_res > 0 && targets[i].ipv == IPV4 && v4 == NULL)
+        {
+            v4 = &targets[i];
+        }
+        else if (stats->nb_res > 0 && targets[i].ipv == IPV6 && v6 == NULL)
+        {
+            v6 = &targets[i];
+        }
+    }
+
+    if (v4 != NULL && v6 != NULL)
+    {
+        printf (COMPARE_DELTA_FORMAT, v6->ip_addr, v4->ip_addr,
+                v6->stats.avg - v4->stats.avg,
+                v6->stats.percentiles[0] - v4->stats.percentiles[0],
+                v6->stats.percentiles[2] - v4->stats.percentiles[2]);
+    }
+}
+
+/**
+ * @brief Reports a truncated or altered reply payload after the reply line.
+ */
+
+static void
+payload_message ()
+{
+    const struct s_info *info = &g_ping.info;
+
+    if (info->data_len < g_ping.options.datalen)
+    {
+        printf ("Truncated reply: %zd of %u data bytes\n", info->data_len,
+                g_ping.options.datalen);
+    }
+    if (info->status == REPLY_CORRUPT)
+    {
+        printf ("wrong data byte #%zd should be 0x%02x but was 0x%02x\n",
+                info->wrong_byte, info->should_be, info->was);
+    }
+}
+
 void
 ping_messages_handler (message type)
 {
+    if (g_ping.options.format != FORMAT_TEXT)
+    {
+        ping_output_handler (type);
+        return;
+    }
+
+    /* A daemon is watched through its metrics, the replies are not printed. */
+
+    if (g_ping.options.metrics != NULL
+        && (type == SEND || type == PING || type == HOP))
+    {
+        return;
+    }
+
     if (type == START)
     {
         if (g_ping.options.verbose == true)
         {
-            printf ("ping: sock4.fd: %d (socktype: SOCK_RAW), sock6.fd: %d "
-                    "(socktype: SOCK_RAW), hints.ai_family: AF_UNSPEC\n",
-                    g_ping.sock_info.sock_fd, 0);
-            printf ("ai.ai_family: %s, ai.ai_canonname: '%s'",
-                    g_ping.sock_info.ai.ai_family == AF_INET ? "AF_INET"
-                                                             : "AF_INET6",
-                    g_ping.sock_info.ai.ai_canonname);
+            printf ("ping: sock4.fd: %d (socktype: %s), sock6.fd: %d "
+                    "(socktype: %s), hints.ai_family: AF_UNSPEC\n",
+                    g_ping.sock_info.v4.fd,
+                    g_ping.sock_info.v4.dgram ? "SOCK_DGRAM" : "SOCK_RAW",
+                    g_ping.sock_info.v6.fd,
+                    g_ping.sock_info.v6.dgram ? "SOCK_DGRAM" : "SOCK_RAW");
+            printf ("ai.ai_family: %s, targets: %u, resolving: %u\n",
+                    g_ping.nb_targets == 0          ? "AF_UNSPEC"
+                    : g_ping.targets[0].ipv == IPV4 ? "AF_INET"
+                                                    : "AF_INET6",
+                    g_ping.nb_targets, g_ping.resolver.nb_pending);
 
             printf ("Selected options: Verbose: %s, IPv4: %s, IPv6: %s, Count: "
-                    "%u, TTL: %u\n\n",
+                    "%u, TTL: %u, Timestamps: %s\n\n",
                     g_ping.options.verbose ? "Yes" : "No",
                     g_ping.options.ipv == IPV4 ? "Yes" : "No",
                     g_ping.options.ipv == IPV6 ? "Yes" : "No",
-                    g_ping.options.count, g_ping.options.ttl);
+                    g_ping.options.count, g_ping.options.ttl,
+                    g_ping.options.timestamping == TS_HARDWARE ? "hardware"
+                    : g_ping.options.timestamping == TS_SOFTWARE
+                        ? "software"
+                        : "user");
+        }
+        for (uint32_t i = 0; i < g_ping.nb_targets; ++i)
+        {
+            start_message (&g_ping.targets[i]);
+        }
+    }
+    else if (type == RESOLVED)
+    {
+        start_message (g_ping.info.target);
+    }
+    else if (type == SEND)
+    {
+        /* A flood ping prints a dot per request and erases it when the reply
+         * comes back, the remaining dots are the unanswered requests. */
+        if (g_ping.options.flood)
+        {
+            putchar ('.');
+        }
+    }
+    else if ((type == PING || type == HOP) && g_ping.options.flood)
+    {
+        /* A duplicate has no dot of its own to erase, the dot of a lost
+         * probe stays. */
+        if (!g_ping.info.duplicate && !g_ping.info.late)
+        {
+            fputs ("\b \b", stdout);
+        }
+        if (type == PING)
+        {
+            payload_message ();
+        }
+    }
+    else if (type == HOP || (type == PING && g_ping.info.hop > 0))
+    {
+        hop_message ();
+        if (type == PING)
+        {
+            payload_message ();
         }
-        printf (START_MESSAGE_FORMAT, g_ping.sock_info.hostname,
-                g_ping.sock_info.ip_addr,
-                g_ping.options.ipv == IPV6 ? ICMPV6_PAYLOAD_SIZE
-                                           : ICMPV4_PAYLOAD_SIZE,
-                g_ping.options.ipv == IPV6 ? ICMPV6_PACKET_SIZE
-                                           : ICMPV4_PACKET_SIZE);
     }
     else if (type == PING)
     {
-        printf (PING_MESSAGE_FORMAT,
-                g_ping.options.ipv == IPV6
-                    ? g_ping.info.bytes_recv
-                    : g_ping.info.bytes_recv - sizeof (struct iphdr),
-                g_ping.sock_info.hostname, g_ping.sock_info.ip_addr,
-                g_ping.info.sequence, g_ping.info.hopli,
-                g_ping.rtt_metrics->rtt);
+        const struct s_target *target = g_ping.info.target;
+
+        printf (PING_MESSAGE_FORMAT, (int)g_ping.info.bytes_recv,
+                target->hostname, target->ip_addr, g_ping.info.sequence,
+                g_ping.info.hopli, g_ping.info.rtt,
+                g_ping.info.duplicate ? " (DUP!)"
+                : g_ping.info.late    ? " (late)"
+                                      : "");
+        payload_message ();
     }
     else if (type == END)
     {
-        compute_rtt_stats ();
-        printf (END_MESSAGE_HEADER_FORMAT, g_ping.sock_info.hostname);
-        printf (END_MESSAGE_STATS_FORMAT, g_ping.stats.nb_snd,
-                g_ping.stats.nb_res, g_ping.stats.pkt_loss,
-                g_ping.stats.ping_session);
-        printf (END_MESSAGE_RTT_FORMAT, g_ping.stats.min,
-                g_ping.stats.avg, g_ping.stats.max,
-                g_ping.stats.dev_rtt);
+        if (g_ping.options.flood)
+        {
+            putchar ('\n');
+        }
+
+        /* In path mode, the hops of each target are the statistics. */
+
+        if (g_ping.options.path_hops > 0)
+        {
+            for (uint32_t i = 0; i < g_ping.nb_targets; ++i)
+            {
+                path_message (&g_ping.targets[i]);
+            }
+            return;
+        }
+        for (uint32_t i = 0; i < g_ping.nb_targets; ++i)
+        {
+            end_message (&g_ping.targets[i]);
+        }
+
+        /* The addresses of a host are contiguous in the target table. */
+
+        for (uint32_t i = 0, nb; g_ping.options.all_addresses
+                                 && i < g_ping.nb_targets;
+             i += nb)
+        {
+            for (nb = 1; i + nb < g_ping.nb_targets
+                         && g_ping.targets[i + nb].hostname
+                                == g_ping.targets[i].hostname;
+                 ++nb)
+            {
+            }
+            if (nb > 1)
+            {
+                compare_message (i, nb);
+            }
+        }
+
+        /* Several targets are summed up once more as a whole. */
+
+        if (g_ping.nb_targets > 1)
+        {
+            compute_aggregate_stats ();
+            printf (AGGREGATE_HEADER_FORMAT, g_ping.nb_targets);
+            stats_message (&g_ping.stats);
+            printf (END_MESSAGE_RTT_FORMAT, g_ping.stats.min,
+                    g_ping.stats.avg, g_ping.stats.max, g_ping.stats.mdev);
+            percentiles_message (&g_ping.stats);
+        }
     }
-}
\ No newline at end of file
+}
@@ -1,5 +1,7 @@
 #include "ft_ping.h"
 
+static const double PERCENTILES[NB_PERCENTILES] = { 50, 90, 99, 99.9, 99.99 };
+
 /**
  * https://datatracker.ietf.org/doc/html/rfc6298
  */
@@ -25,12 +27,6 @@ compute_elapsed_ms(struct timespec start, struct timespec end)
     return elapsed_sec + elapsed_nsec;
 }
 
-static void
-compute_std_rtt ()
-{
-    g_ping.rtt_metrics->rtt = compute_elapsed_ms(g_ping.rtt_metrics->start, g_ping.rtt_metrics->end);
-}
-
 /**
  * @brief Updates the estimated Round Trip Time (RTT) using an exponential
  * weighted average. This function calculates a new RTT estimate by combining
@@ -42,29 +38,28 @@ compute_std_rtt ()
  */
 
 static void
-compute_estimated_rtt ()
+compute_estimated_rtt (struct s_target *target, double sample_rtt)
 {
-    if (g_ping.rtt_metrics->rtt <= 0)
+    if (sample_rtt <= 0)
     {
         return;
     }
 
-    double sample_rtt = g_ping.rtt_metrics->rtt;
     double estimated_rtt;
     double alpha = RTT_WEIGHT_FACTOR;
 
     // 0 but esimtaed rtt is more precise than that. maintenant il se peut quon
     // rentre dedans a nouveau par probleme de precision.
-    if (g_ping.stats.estimated_rtt <= 0)
+    if (target->stats.estimated_rtt <= 0)
     {
-        g_ping.stats.estimated_rtt = g_ping.rtt_metrics->rtt;
-        g_ping.stats.dev_rtt = g_ping.rtt_metrics->rtt / 2;
+        target->stats.estimated_rtt = sample_rtt;
+        target->stats.dev_rtt = sample_rtt / 2;
         return;
     }
 
-    estimated_rtt = ((1 - alpha) * g_ping.stats.estimated_rtt)
+    estimated_rtt = ((1 - alpha) * target->stats.estimated_rtt)
                     + (alpha * sample_rtt);
-    g_ping.stats.estimated_rtt = estimated_rtt;
+    target->stats.estimated_rtt = estimated_rtt;
 }
 
 /**
@@ -81,22 +76,21 @@ compute_estimated_rtt ()
  */
 
 static void
-compute_deviation_rtt ()
+compute_deviation_rtt (struct s_target *target, double sample_rtt)
 {
-    if (g_ping.rtt_metrics->rtt <= 0 || g_ping.stats.estimated_rtt <= 0)
+    if (sample_rtt <= 0 || target->stats.estimated_rtt <= 0)
     {
         return;
     }
 
     double dev_rtt;
-    double sample_rtt = g_ping.rtt_metrics->rtt;
-    double estimated_rtt = g_ping.stats.estimated_rtt;
+    double estimated_rtt = target->stats.estimated_rtt;
     double beta = RTT_DEVIATION_FACTOR;
 
-    dev_rtt = (1 - beta) * g_ping.stats.dev_rtt
+    dev_rtt = (1 - beta) * target->stats.dev_rtt
               + beta * fabs (sample_rtt - estimated_rtt);
 
-    g_ping.stats.dev_rtt = dev_rtt;
+    target->stats.dev_rtt = dev_rtt;
 }
 
 /**
@@ -110,161 +104,710 @@ compute_deviation_rtt ()
  */
 
 static void
-compute_timeout_interval_rtt ()
+compute_timeout_interval_rtt (struct s_target *target)
 {
     double timeout_interval;
 
-    if (g_ping.stats.dev_rtt <= 0 || g_ping.stats.estimated_rtt <= 0)
+    if (target->stats.dev_rtt <= 0 || target->stats.estimated_rtt <= 0)
     {
         return;
     }
 
     timeout_interval
-        = 4 * g_ping.stats.dev_rtt + g_ping.stats.estimated_rtt;
+        = 4 * target->stats.dev_rtt + target->stats.estimated_rtt;
 
-    g_ping.stats.timeout_threshold = timeout_interval;
+    target->stats.timeout_threshold = timeout_interval;
 }
 
 /**
- * @brief Computes statistics for round-trip times (RTT) in a ping session.
- *
- * This function calculates the minimum, maximum, and average RTT values
- * based on the collected RTT metrics. It also computes the total duration
- * of the ping session in milliseconds and the packet loss percentage.
- *
- * The following steps are performed:
- * - Initialize min, max, and avg RTT values.
- * - Iterate through the RTT metrics linked list to find min, max, and compute
- *   the sum for average RTT.
- * - If RTT metrics are present, calculate the average. Otherwise, set RTT
- *   values to 0.
- * - Calculate the total session time in milliseconds by combining seconds
- *   and nanoseconds.
- * - Compute the packet loss percentage based on the number of sent and
- *   received packets.
+ * @brief Adds a sample to streaming statistics with Welford's algorithm,
+ * which is numerically stable whatever the number of samples.
+ * @param stats streaming statistics
+ * @param rtt sample in milliseconds
+ */
+
+static void
+rtt_stats_add (struct s_rtt_stats *stats, double rtt)
+{
+    double delta = rtt - stats->mean;
+
+    ++stats->n;
+    stats->mean += delta / stats->n;
+    stats->m2 += delta * (rtt - stats->mean);
+
+    if (stats->n == 1 || rtt < stats->min)
+    {
+        stats->min = rtt;
+    }
+    if (stats->n == 1 || rtt > stats->max)
+    {
+        stats->max = rtt;
+    }
+}
+
+/**
+ * @brief Merges streaming statistics into others as if every sample had been
+ * added to them (Chan et al. parallel variance).
+ * @param dst statistics receiving the samples
+ * @param src statistics whose samples are added
  */
 
 void
-compute_rtt_stats ()
+rtt_stats_merge (struct s_rtt_stats *dst, const struct s_rtt_stats *src)
 {
-    double sum = 0.0;
-    int i = 0;
+    if (src->n == 0)
+    {
+        return;
+    }
+    if (dst->n == 0)
+    {
+        *dst = *src;
+        return;
+    }
 
-    g_ping.stats.min = DBL_MAX;
-    g_ping.stats.max = DBL_MIN;
-    g_ping.stats.avg = 0.0;
+    uint64_t n = dst->n + src->n;
+    double delta = src->mean - dst->mean;
 
-    struct s_rtt *tmp = g_ping.rtt_metrics_beg;
-    while (tmp != NULL)
+    dst->mean += delta * src->n / n;
+    dst->m2 += src->m2 + delta * delta * dst->n * src->n / n;
+    dst->min = src->min < dst->min ? src->min : dst->min;
+    dst->max = src->max > dst->max ? src->max : dst->max;
+    dst->n = n;
+}
+
+static int
+rtt_cmp (const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Exact median of the kept samples of a target.
+ * @param target target whose samples are kept
+ * @return the median in milliseconds, 0 without samples.
+ */
+
+static double
+compute_median_rtt (const struct s_target *target)
+{
+    uint64_t n = target->nb_samples;
+    double *rtts;
+    double median;
+
+    if (n == 0)
     {
-        if (tmp->rtt < g_ping.stats.min)
+        return 0.0;
+    }
+    if ((rtts = malloc (n * sizeof (double))) == NULL)
+    {
+        perror ("malloc");
+        release_resources ();
+        exit (EXIT_FAILURE);
+    }
+    for (uint64_t i = 0; i < n; ++i)
+    {
+        rtts[i] = target->samples[i].rtt;
+    }
+    qsort (rtts, n, sizeof (double), rtt_cmp);
+    median = n % 2 ? rtts[n / 2] : (rtts[n / 2 - 1] + rtts[n / 2]) / 2;
+    free (rtts);
+    return median;
+}
+
+/**
+ * @brief Derives the reported statistics from streaming ones. The mean
+ * deviation is the standard deviation of the samples, as iputils computes
+ * it, sqrt(mean(rtt^2) - mean(rtt)^2).
+ * @param stats statistics to fill in
+ */
+
+static void
+report_rtt_stats (struct s_stats *stats)
+{
+    const struct s_rtt_stats *rtt = &stats->rtt;
+
+    if (rtt->n > 0)
+    {
+        stats->min = rtt->min;
+        stats->max = rtt->max;
+        stats->avg = rtt->mean;
+        stats->mdev = sqrt (rtt->m2 / rtt->n);
+        if (stats->histogram != NULL)
         {
-            g_ping.stats.min = tmp->rtt;
+            histogram_percentiles (stats->histogram, PERCENTILES,
+                                   NB_PERCENTILES, stats->percentiles);
         }
-        if (tmp->rtt > g_ping.stats.max)
+
+        /* A bucket midpoint may lie slightly outside of the samples. */
+
+        for (int i = 0; i < NB_PERCENTILES; ++i)
         {
-            g_ping.stats.max = tmp->rtt;
+            stats->percentiles[i] = fmax (rtt->min,
+                                          fmin (rtt->max,
+                                                stats->percentiles[i]));
         }
-        sum += tmp->rtt;
-        i++;
-        tmp = tmp->next;
+        stats->ping_session
+            = compute_elapsed_ms (stats->session_start, stats->session_end);
     }
-    if (i > 0)
+    else
     {
-        g_ping.stats.avg = sum / i;
+        stats->min = 0.0;
+        stats->max = 0.0;
+        stats->avg = 0.0;
+        stats->mdev = 0.0;
+        stats->ping_session = 0.0;
+        memset (stats->percentiles, 0, sizeof (stats->percentiles));
     }
-    else
+
+    stats->pkt_loss
+        = stats->nb_snd
+              ? ((double)(stats->nb_snd - stats->nb_res) / stats->nb_snd) * 100
+              : 0.0;
+}
+
+/**
+ * @brief Computes the final statistics of a target from its streaming
+ * statistics, nothing is walked but the kept samples if any.
+ * @param target target whose statistics are computed
+ */
+
+void
+compute_rtt_stats (struct s_target *target)
+{
+    report_rtt_stats (&target->stats);
+    if (g_ping.options.keep_samples)
     {
-        g_ping.stats.min = 0.0;
-        g_ping.stats.max = 0.0;
-        g_ping.stats.avg = 0.0;
+        target->stats.median = compute_median_rtt (target);
     }
-    
-    double elapsed_ms = compute_elapsed_ms(g_ping.rtt_metrics_beg->start, g_ping.rtt_metrics->end);
+}
 
-    g_ping.stats.ping_session = elapsed_ms;
+/**
+ * @brief Merges the streaming statistics and the histograms of every target
+ * into the session wide statistics.
+ */
 
-    double packet_loss;
+void
+compute_aggregate_stats ()
+{
+    struct s_stats *stats = &g_ping.stats;
 
-    packet_loss = ((double)(g_ping.stats.nb_snd - g_ping.stats.nb_res)
-                   / g_ping.stats.nb_snd)
-                  * 100;
-    g_ping.stats.pkt_loss = packet_loss;
+    if (stats->histogram == NULL
+        && (stats->histogram = calloc (1, sizeof (struct s_histogram)))
+               == NULL)
+    {
+        perror ("calloc");
+        release_resources ();
+        exit (EXIT_FAILURE);
+    }
+
+    memset (&stats->rtt, 0, sizeof (stats->rtt));
+    memset (stats->histogram, 0, sizeof (struct s_histogram));
+    for (uint32_t i = 0; i < g_ping.nb_targets; ++i)
+    {
+        const struct s_stats *t = &g_ping.targets[i].stats;
+
+        rtt_stats_merge (&stats->rtt, &t->rtt);
+        if (t->histogram != NULL)
+        {
+            histogram_merge (stats->histogram, t->histogram);
+        }
+    }
+    report_rtt_stats (stats);
 }
 
+/**
+ * @brief Retains a sample, the array grows geometrically. Only done when the
+ * samples are explicitly kept, the memory otherwise does not depend on the
+ * session length.
+ */
+
 static void
-rtt_lst_add (struct s_rtt *rtt)
+keep_sample (struct s_target *target, const struct s_rtt *sample)
 {
-    if (g_ping.rtt_metrics == NULL)
+    if (target->nb_samples == target->samples_size)
     {
-        g_ping.rtt_metrics = rtt;
-        g_ping.rtt_metrics_beg = g_ping.rtt_metrics;
+        uint64_t size = target->samples_size ? target->samples_size * 2 : 64;
+        struct s_rtt *samples;
+
+        if ((samples = realloc (target->samples, size * sizeof (struct s_rtt)))
+            == NULL)
+        {
+            perror ("realloc");
+            release_resources ();
+            exit (EXIT_FAILURE);
+        }
+        target->samples = samples;
+        target->samples_size = size;
     }
-    else
+    target->samples[target->nb_samples++] = *sample;
+}
+
+/**
+ * @brief Time a probe to a target is given before it is declared lost: the
+ * -W timeout, or the retransmission timeout of the target kept within the
+ * bounds TCP applies to its own.
+ * @param target destination of the probe
+ * @param timeout receives the duration
+ */
+
+static void
+loss_timeout (const struct s_target *target, struct timespec *timeout)
+{
+    const struct timespec *fixed = &g_ping.options.loss_timeout;
+    double msec = target->stats.timeout_threshold;
+
+    if (fixed->tv_sec != 0 || fixed->tv_nsec != 0)
+    {
+        *timeout = *fixed;
+        return;
+    }
+
+    msec = msec < LOSS_TIMEOUT_MIN_MSEC   ? LOSS_TIMEOUT_MIN_MSEC
+           : msec > LOSS_TIMEOUT_MAX_MSEC ? LOSS_TIMEOUT_MAX_MSEC
+                                          : msec;
+    timeout->tv_sec = (time_t)(msec / 1000);
+    timeout->tv_nsec = (long)((msec - timeout->tv_sec * 1000.0) * 1e6);
+}
+
+/**
+ * @brief The count applies to each target, the session ends once every
+ * target has taken that many turns. A turn sends one request, or one per hop
+ * in path mode.
+ * @return the total number of turns to take, 0 when unlimited.
+ */
+
+uint64_t
+ping_total_count ()
+{
+    return (uint64_t)g_ping.options.count * g_ping.nb_targets;
+}
+
+/**
+ * @brief Rebuilds the 64-bit sequence of a probe from the 16-bit sequence
+ * carried by the ICMP header. The reply necessarily refers to a probe sent
+ * at most 65535 probes ago, the distance to the last sequence sent is
+ * therefore computed modulo 2^16 which handles the wrap around.
+ * @param sequence sequence number read from the Echo Reply
+ * @return the matching probe, answered or not, or NULL if it is unknown or
+ * evicted from the ring.
+ */
+
+struct s_probe *
+probe_find (uint16_t sequence)
+{
+    uint64_t last = g_ping.stats.nb_snd;
+    uint16_t distance = (uint16_t)last - sequence;
+    uint64_t full_sequence;
+    struct s_probe *probe;
+
+    if (distance >= last)
     {
-        g_ping.rtt_metrics->next = rtt;
-        g_ping.rtt_metrics = rtt;
+        return NULL;
     }
+
+    full_sequence = last - distance;
+
+    if (last - full_sequence >= PROBE_RING_SIZE)
+    {
+        return NULL;
+    }
+
+    probe = &g_ping.probes[full_sequence & (PROBE_RING_SIZE - 1)];
+
+    if (probe->seq != full_sequence)
+    {
+        return NULL;
+    }
+    return probe;
+}
+
+/**
+ * @brief Same as probe_find(), restricted to the probes still unanswered.
+ * @param sequence sequence number read from the ICMP header
+ * @return the matching outstanding probe or NULL.
+ */
+
+struct s_probe *
+probe_lookup (uint16_t sequence)
+{
+    struct s_probe *probe = probe_find (sequence);
+
+    if (probe == NULL || !probe->outstanding)
+    {
+        return NULL;
+    }
+    return probe;
 }
 
+/**
+ * @brief Marks a sequence answered in the reply window. The window is a
+ * constant-size bitmap over the sequences of the probe ring, sending a
+ * sequence clears its bit so the window slides along without being walked.
+ * @param sequence 64-bit sequence of the answered probe
+ * @return true if it had already been answered.
+ */
+
+static _Bool
+reply_window_mark (uint64_t sequence)
+{
+    uint64_t *word
+        = &g_ping.answered[(sequence & (PROBE_RING_SIZE - 1)) / 64];
+    uint64_t bit = (uint64_t)1 << (sequence % 64);
+    _Bool answered = *word & bit;
+
+    *word |= bit;
+    return answered;
+}
+
+/**
+ * @brief Counts a reply coming back after a reply to a later request of the
+ * same target. The sequences are interleaved across the targets, only those
+ * of a single target tell a reordering.
+ * @param stats statistics of the probe target
+ * @param target_seq sequence of the probe among the requests of its target
+ */
+
 static void
-init_rtt_node ()
+reorder_metrics (struct s_stats *stats, uint64_t target_seq)
 {
-    struct s_rtt *rtt;
+    uint64_t depth;
 
-    rtt = malloc (sizeof (struct s_rtt));
+    if (target_seq > stats->last_answered)
+    {
+        stats->last_answered = target_seq;
+        return;
+    }
 
-    memset (rtt, 0, sizeof (struct s_rtt));
+    depth = stats->last_answered - target_seq;
+    ++stats->nb_reordered;
+    ++g_ping.stats.nb_reordered;
+    if (depth > stats->reorder_max)
+    {
+        stats->reorder_max = depth;
+    }
+    if (depth > g_ping.stats.reorder_max)
+    {
+        g_ping.stats.reorder_max = depth;
+    }
+}
 
-    if (rtt == NULL)
+/**
+ * @brief Records the send time of a probe in its ring slot and schedules its
+ * loss deadline. The slot of a probe sent PROBE_RING_SIZE sequences earlier
+ * is reused, that probe is declared lost first if it is still outstanding.
+ * @param sequence 64-bit sequence of the probe about to be sent
+ * @param target index of the destination of the probe
+ * @param ttl TTL of a path probe, whose hop counts it as sent, 0 otherwise
+ * @return the probe, its send time is embedded in the request.
+ */
+
+struct s_probe *
+start_rtt_metrics (uint64_t sequence, uint32_t target, uint8_t ttl)
+{
+    struct s_probe *probe = &g_ping.probes[sequence & (PROBE_RING_SIZE - 1)];
+    struct s_stats *stats = &g_ping.targets[target].stats;
+    struct timespec deadline;
+
+    if (probe->outstanding)
     {
-        perror ("malloc");
+        ping_wheel_remove (probe);
+        lost_rtt_metrics (probe);
+    }
+
+    probe->seq = sequence;
+    probe->target = target;
+    probe->target_seq = ++stats->nb_snd;
+    probe->ttl = ttl;
+    probe->outstanding = true;
+    probe->tx_stamp.kind = TS_NONE;
+    g_ping.answered[(sequence & (PROBE_RING_SIZE - 1)) / 64]
+        &= ~((uint64_t)1 << (sequence % 64));
+    /* clock_gettime(CLOCK_MONOTONIC, ...) is preferable to gettimeofday(...)
+     * because it assures us stability, precision for Intervals and security
+     * against System Manipulation */
+    clock_gettime (CLOCK_MONOTONIC, &probe->sent);
+    loss_timeout (&g_ping.targets[target], &deadline);
+    timespec_add (&deadline, &probe->sent);
+    ping_wheel_add (probe, &deadline);
+
+    if (stats->nb_snd == 1)
+    {
+        stats->session_start = probe->sent;
+    }
+    if (sequence == 1)
+    {
+        g_ping.stats.session_start = probe->sent;
+    }
+    if (ttl > 0)
+    {
+        ++g_ping.targets[target].hops[ttl - 1].nb_snd;
+    }
+    ping_shm_update (target);
+    return probe;
+}
+
+/**
+ * @brief Times the answer to a probe and makes it the current reply. A
+ * second answer is only counted as a duplicate, an answer to a probe already
+ * declared lost as a late reply.
+ * @param probe probe answered, found with probe_find()
+ * @param received CLOCK_MONOTONIC time at which the answer was received
+ * @param rx_stamp kernel receive stamp of the answer, NULL if unavailable
+ * @return true if the probe was outstanding, it is answered from now on.
+ */
+
+static _Bool
+answer_rtt_metrics (struct s_probe *probe, const struct timespec *received,
+                    const struct s_kstamp *rx_stamp)
+{
+    struct s_target *target = &g_ping.targets[probe->target];
+    double rtt;
+
+    g_ping.info.target = target;
+    g_ping.info.sequence = probe->target_seq;
+    g_ping.info.sent = probe->sent;
+    g_ping.info.received = *received;
+    g_ping.info.hop = probe->ttl;
+
+    rtt = compute_elapsed_ms (probe->sent, *received);
+    if (rx_stamp != NULL && rx_stamp->kind != TS_NONE
+        && rx_stamp->kind == probe->tx_stamp.kind)
+    {
+        rtt = compute_elapsed_ms (probe->tx_stamp.ts, rx_stamp->ts);
+    }
+    g_ping.info.rtt = rtt;
+    g_ping.info.late = false;
+
+    if ((g_ping.info.duplicate = reply_window_mark (probe->seq)))
+    {
+        ++target->stats.nb_dup;
+        ++g_ping.stats.nb_dup;
+        return false;
+    }
+
+    if ((g_ping.info.late = !probe->outstanding))
+    {
+        ++target->stats.nb_late;
+        ++g_ping.stats.nb_late;
+        return false;
+    }
+
+    probe->outstanding = false;
+    ping_wheel_remove (probe);
+    return true;
+}
+
+/**
+ * @brief Keeps the address a hop answered from, the last one wins when the
+ * route changes.
+ */
+
+static void
+hop_address (struct s_hop *hop, const struct sockaddr *from)
+{
+    memcpy (&hop->addr, from,
+            from->sa_family == AF_INET6 ? sizeof (struct sockaddr_in6)
+                                        : sizeof (struct sockaddr_in));
+}
+
+/**
+ * @brief Counts an answer at a hop of the path, from the address that sent
+ * it.
+ */
+
+static void
+hop_record (struct s_hop *hop, const struct sockaddr *from, double rtt)
+{
+    hop_address (hop, from);
+    ++hop->nb_res;
+    hop->last_rtt = rtt;
+    rtt_stats_add (&hop->rtt, rtt);
+}
+
+/**
+ * @brief Times a reply against the send time of its own probe, whatever the
+ * number of probes sent in the meantime, and updates the statistics of the
+ * probe target which becomes the current target.
+ * When kernel timestamping is enabled and both the transmit and the receive
+ * stamps of the same kind are known, the RTT is measured between them and no
+ * longer includes the scheduling and processing latency of ft_ping.
+ * A reply to an already answered probe is only counted as a duplicate, a
+ * reply to a probe already declared lost as a late reply.
+ * @param probe probe answered by the reply, found with probe_find()
+ * @param received CLOCK_MONOTONIC time at which the reply was received
+ * @param rx_stamp kernel receive stamp of the reply, NULL if unavailable
+ */
+
+void
+end_rtt_metrics (struct s_probe *probe, const struct timespec *received,
+                 const struct s_kstamp *rx_stamp)
+{
+    struct s_target *target = &g_ping.targets[probe->target];
+    double rtt;
+
+    if (!answer_rtt_metrics (probe, received, rx_stamp))
+    {
+        return;
+    }
+    rtt = g_ping.info.rtt;
+
+    target->stats.session_end = *received;
+    g_ping.stats.session_end = *received;
+    ++target->stats.nb_res;
+    ++g_ping.stats.nb_res;
+
+    /* The probes of a path round are answered in the order of the hops, not
+     * in the order they were sent. The first TTL the destination answered
+     * is the length of the path, the next rounds stop there. */
+
+    if (probe->ttl > 0)
+    {
+        hop_record (&target->hops[probe->ttl - 1],
+                    (const struct sockaddr *)&target->addr_4, rtt);
+        if (probe->ttl < target->path_len)
+        {
+            target->path_len = probe->ttl;
+        }
+    }
+    else
+    {
+        reorder_metrics (&target->stats, probe->target_seq);
+    }
+
+    rtt_stats_add (&target->stats.rtt, rtt);
+
+    /* The histogram is only allocated for targets that do reply. */
+
+    if (target->stats.histogram == NULL
+        && (target->stats.histogram = calloc (1, sizeof (struct s_histogram)))
+               == NULL)
+    {
+        perror ("calloc");
         release_resources ();
         exit (EXIT_FAILURE);
     }
+    histogram_record (target->stats.histogram, rtt);
+    if (g_ping.options.keep_samples)
+    {
+        keep_sample (target, &(struct s_rtt){ probe->sent, *received, rtt });
+    }
+    compute_estimated_rtt (target, rtt);
+    compute_deviation_rtt (target, rtt);
+    compute_timeout_interval_rtt (target);
+    ping_shm_update (probe->target);
+}
 
-    rtt_lst_add (rtt);
+/**
+ * @brief Declares an outstanding probe lost, its deadline has passed or its
+ * ring slot is needed again. A reply coming back afterwards is late.
+ * @param probe probe already removed from the timing wheel
+ */
+
+void
+lost_rtt_metrics (struct s_probe *probe)
+{
+    probe->outstanding = false;
+    if (g_ping.options.format != FORMAT_TEXT)
+    {
+        ping_output_probe_lost (probe);
+    }
 }
 
-_Bool
-rtt_timeout ()
+/**
+ * @brief Counts the Time Exceeded message a router sent about a path probe
+ * at the hop of the probe TTL. The RTT statistics of the target remain
+ * those of its Echo Replies. A late or duplicate message still tells which
+ * router sits at that hop.
+ * @param probe path probe quoted by the message, found with probe_find()
+ * @param from address of the router
+ * @param received CLOCK_MONOTONIC time at which the message was received
+ * @param rx_stamp kernel receive stamp of the message, NULL if unavailable
+ */
+
+void
+hop_rtt_metrics (struct s_probe *probe, const struct sockaddr *from,
+                 const struct timespec *received,
+                 const struct s_kstamp *rx_stamp)
 {
-    struct timespec now;
-    clock_gettime (CLOCK_MONOTONIC, &now);
-    double elapsed_ms = compute_elapsed_ms(g_ping.rtt_metrics->start, now);
-    return elapsed_ms >= g_ping.stats.timeout_threshold;
+    struct s_hop *hop = &g_ping.targets[probe->target].hops[probe->ttl - 1];
+
+    if (answer_rtt_metrics (probe, received, rx_stamp))
+    {
+        hop_record (hop, from, g_ping.info.rtt);
+    }
+    else
+    {
+        hop_address (hop, from);
+    }
 }
 
+/**
+ * @brief Derives the loss and the deviation of the hops of a path, up to the
+ * destination once it has been reached.
+ * @param target target probed in path mode
+ */
+
 void
-start_rtt_metrics ()
+compute_hop_stats (struct s_target *target)
 {
-    /* This allows us to avoid adding a link unnecessarily if the results of the
-     * last trip are not measurable. */
-    if (g_ping.rtt_metrics == NULL
-        || (g_ping.rtt_metrics->end.tv_sec != 0
-               && g_ping.rtt_metrics->end.tv_nsec != 0))
+    for (uint8_t i = 0; i < target->path_len; ++i)
     {
-        init_rtt_node ();
+        struct s_hop *hop = &target->hops[i];
+
+        hop->pkt_loss = hop->nb_snd ? ((double)(hop->nb_snd - hop->nb_res)
+                                       / hop->nb_snd)
+                                          * 100
+                                    : 0.0;
+        hop->mdev = hop->rtt.n ? sqrt (hop->rtt.m2 / hop->rtt.n) : 0.0;
     }
-    /* clock_gettime(CLOCK_MONOTONIC, ...) is preferable to gettimeofday(...)
-     * because it assures us stability, precision for Intervals and security
-     * against System Manipulation */
-    clock_gettime (CLOCK_MONOTONIC, &g_ping.rtt_metrics->start);
 }
 
+/**
+ * @brief Formats the address a hop answered from, "???" while it never did.
+ * @param hop hop of a path
+ * @param buf buffer of INET6_ADDRSTRLEN bytes
+ * @return buf
+ */
+
+const char *
+hop_addr (const struct s_hop *hop, char *buf)
+{
+    const struct sockaddr *addr = (const struct sockaddr *)&hop->addr;
+
+    if (addr->sa_family == AF_INET6)
+    {
+        inet_ntop (AF_INET6, &((const struct sockaddr_in6 *)addr)->sin6_addr,
+                   buf, INET6_ADDRSTRLEN);
+    }
+    else if (addr->sa_family == AF_INET)
+    {
+        inet_ntop (AF_INET, &((const struct sockaddr_in *)addr)->sin_addr, buf,
+                   INET6_ADDRSTRLEN);
+    }
+    else
+    {
+        strcpy (buf, "???");
+    }
+    return buf;
+}
+
+/**
+ * @brief Attaches the transmit stamp reported on the socket error queue to
+ * its probe. The stamp is dropped if the probe was already answered.
+ * @param sequence sequence number of the stamped request
+ * @param tx_stamp kernel transmit stamp
+ */
+
 void
-end_rtt_metrics ()
+tx_stamp_metrics (uint16_t sequence, const struct s_kstamp *tx_stamp)
 {
-    clock_gettime (CLOCK_MONOTONIC, &g_ping.rtt_metrics->end);
-    compute_std_rtt ();
-    compute_estimated_rtt ();
-    compute_deviation_rtt ();
-    compute_timeout_interval_rtt ();
+    struct s_probe *probe;
 
-    if (rtt_timeout () == true)
+    if ((probe = probe_lookup (sequence)) != NULL)
     {
-        fprintf (stderr, "ping reached timeout: %f\n",
-                 g_ping.stats.timeout_threshold);
-        g_ping.info.read_loop = false;
+        probe->tx_stamp = *tx_stamp;
     }
 }
@@ -0,0 +1,499 @@
+#include "ft_ping.h"
+
+/* Every thread fills its own buffer, whole records are written out under a
+ * lock so that the records of the workers never interleave. */
+
+static pthread_mutex_t g_output_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static const char *CSV_HEADER
+    = "type,target,addr,seq,bytes,ttl,rtt_ms,sent,received,status,"
+      "icmp_type,icmp_code,from,transmitted,received_count,loss_pct,time_ms,"
+      "min_ms,avg_ms,max_ms,mdev_ms,p50_ms,p90_ms,p99_ms,p999_ms,p9999_ms,"
+      "duplicates,reordered,reorder_max,late,hop\n";
+
+static const char *STATUS_NAMES[] = { "reply", "truncated", "corrupt" };
+
+/**
+ * @brief Writes the buffered records out, a short write is resumed.
+ */
+
+void
+ping_output_flush ()
+{
+    struct s_output *output = &g_ping.output;
+    size_t written = 0;
+
+    if (output->len == 0)
+    {
+        return;
+    }
+
+    pthread_mutex_lock (&g_output_lock);
+    while (written < output->len)
+    {
+        ssize_t ret = write (STDOUT_FILENO, output->buf + written,
+                             output->len - written);
+
+        if (ret == -1 && errno == EINTR)
+        {
+            continue;
+        }
+        if (ret <= 0)
+        {
+            break;
+        }
+        written += ret;
+    }
+    pthread_mutex_unlock (&g_output_lock);
+
+    output->len = 0;
+    clock_gettime (CLOCK_MONOTONIC, &output->last_flush);
+}
+
+/**
+ * @brief Flushes the records that have waited for OUTPUT_FLUSH_MSEC, called
+ * on each tick of the send timer so that a slow session is not held back
+ * until the buffer fills up.
+ * @param now current CLOCK_MONOTONIC time
+ */
+
+void
+ping_output_tick (const struct timespec *now)
+{
+    struct timespec deadline = g_ping.output.last_flush;
+    struct timespec delay
+        = { OUTPUT_FLUSH_MSEC / 1000, (OUTPUT_FLUSH_MSEC % 1000) * 1000000 };
+
+    timespec_add (&deadline, &delay);
+    if (g_ping.output.len > 0 && timespec_cmp (now, &deadline) >= 0)
+    {
+        ping_output_flush ();
+    }
+}
+
+/**
+ * @brief Allocates the buffer of the calling thread on first use and
+ * samples the offset between the wall clock and CLOCK_MONOTONIC, records
+ * carry wall clock times while probes are timed on the monotonic clock.
+ */
+
+static void
+output_init ()
+{
+    struct s_output *output = &g_ping.output;
+    struct timespec realtime;
+
+    if ((output->buf = malloc (OUTPUT_BUFFER_SIZE)) == NULL)
+    {
+        perror ("malloc");
+        release_resources ();
+        exit (EXIT_FAILURE);
+    }
+    clock_gettime (CLOCK_REALTIME, &realtime);
+    clock_gettime (CLOCK_MONOTONIC, &output->last_flush);
+    output->offset.tv_sec = realtime.tv_sec - output->last_flush.tv_sec;
+    output->offset.tv_nsec = realtime.tv_nsec - output->last_flush.tv_nsec;
+    if (output->offset.tv_nsec < 0)
+    {
+        output->offset.tv_sec -= 1;
+        output->offset.tv_nsec += 1000000000;
+    }
+}
+
+/**
+ * @brief Starts a record. The buffer is flushed beforehand unless a whole
+ * record still fits, so that only complete records are ever written out.
+ */
+
+static void
+output_begin ()
+{
+    if (g_ping.output.buf == NULL)
+    {
+        output_init ();
+    }
+    if (g_ping.output.len > OUTPUT_BUFFER_SIZE - OUTPUT_RECORD_MAX)
+    {
+        ping_output_flush ();
+    }
+}
+
+/**
+ * @brief Appends formatted text to the record being built, output_begin()
+ * left room for it.
+ */
+
+__attribute__ ((format (printf, 1, 2))) static void
+output_printf (const char *fmt, ...)
+{
+    struct s_output *output = &g_ping.output;
+    va_list ap;
+    int len;
+
+    va_start (ap, fmt);
+    len = vsnprintf (output->buf + output->len,
+                     OUTPUT_BUFFER_SIZE - output->len, fmt, ap);
+    va_end (ap);
+
+    if (len > 0)
+    {
+        output->len += (size_t)len < OUTPUT_BUFFER_SIZE - output->len
+                           ? (size_t)len
+                           : OUTPUT_BUFFER_SIZE - output->len - 1;
+    }
+}
+
+/**
+ * @brief Appends a string field, quoted and escaped as the format requires.
+ * Hostnames come from the command line and may hold anything.
+ */
+
+static void
+output_string (const char *str)
+{
+    char quoted[2 * NI_MAXHOST + 3];
+    size_t len = 0;
+    _Bool json = g_ping.options.format == FORMAT_JSON;
+
+    if (str == NULL)
+    {
+        output_printf ("%s", json ? "null" : "");
+        return;
+    }
+
+    quoted[len++] = '"';
+    for (; *str != '\0' && len < sizeof (quoted) - 8; ++str)
+    {
+        unsigned char c = *str;
+
+        if (json && (c == '"' || c == '\\'))
+        {
+            quoted[len++] = '\\';
+            quoted[len++] = c;
+        }
+        else if (json && c < 0x20)
+        {
+            len += snprintf (quoted + len, sizeof (quoted) - len, "\\u%04x",
+                             c);
+        }
+        else if (!json && c == '"')
+        {
+            quoted[len++] = '"';
+            quoted[len++] = '"';
+        }
+        else
+        {
+            quoted[len++] = c;
+        }
+    }
+    quoted[len++] = '"';
+    quoted[len] = '\0';
+    output_printf ("%s", quoted);
+}
+
+/**
+ * @brief Appends a CLOCK_MONOTONIC time as wall clock seconds.
+ */
+
+static void
+output_time (const struct timespec *ts)
+{
+    struct timespec wall = *ts;
+
+    timespec_add (&wall, &g_ping.output.offset);
+    output_printf ("%ld.%09ld", (long)wall.tv_sec, wall.tv_nsec);
+}
+
+/**
+ * @brief Appends the target and the fields common to every probe record.
+ */
+
+static void
+output_probe_head (const struct s_target *target, uint64_t seq)
+{
+    output_begin ();
+    if (g_ping.options.format == FORMAT_JSON)
+    {
+        output_printf ("{\"type\":\"probe\",\"target\":");
+        output_string (target->hostname);
+        output_printf (",\"addr\":\"%s\",\"seq\":%" PRIu64, target->ip_addr,
+                       seq);
+    }
+    else
+    {
+        output_printf ("probe,");
+        output_string (target->hostname);
+        output_printf (",%s,%" PRIu64 ",", target->ip_addr, seq);
+    }
+}
+
+/**
+ * @brief Records a reply, a duplicate or a late reply is recorded with its
+ * own status whatever its payload. The answer to a path probe also carries
+ * its hop and the address it came from, a Time Exceeded message has the
+ * status "time_exceeded".
+ * @param type PING for an Echo Reply, HOP for a Time Exceeded message
+ */
+
+static void
+output_reply (message type)
+{
+    const struct s_info *info = &g_ping.info;
+    const char *status = info->duplicate ? "duplicate"
+                         : info->late    ? "late"
+                         : type == HOP   ? "time_exceeded"
+                                         : STATUS_NAMES[info->status];
+    char from[INET6_ADDRSTRLEN] = "";
+
+    if (info->hop > 0)
+    {
+        hop_addr (&info->target->hops[info->hop - 1], from);
+    }
+
+    output_probe_head (info->target, info->sequence);
+    if (g_ping.options.format == FORMAT_JSON)
+    {
+        output_printf (",\"bytes\":%zd,\"ttl\":%d,\"rtt_ms\":%.3f,\"sent\":",
+                       info->bytes_recv, info->hopli, info->rtt);
+        output_time (&info->sent);
+        output_printf (",\"received\":");
+        output_time (&info->received);
+        output_printf (",\"status\":\"%s\"", status);
+        if (info->hop > 0)
+        {
+            output_printf (",\"from\":\"%s\",\"hop\":%u", from, info->hop);
+        }
+        output_printf ("}\n");
+    }
+    else
+    {
+        output_printf ("%zd,%d,%.3f,", info->bytes_recv, info->hopli,
+                       info->rtt);
+        output_time (&info->sent);
+        output_printf (",");
+        output_time (&info->received);
+        output_printf (",%s,,,%s,,,,,,,,,,,,,,,,,,", status, from);
+        if (info->hop > 0)
+        {
+            output_printf ("%u", info->hop);
+        }
+        output_printf ("\n");
+    }
+}
+
+/**
+ * @brief Records an ICMP error about one of our requests.
+ * @param type ICMP type
+ * @param code ICMP code
+ * @param mtu next hop MTU of a Packet Too Big error
+ * @param from address of the router or host reporting the error
+ */
+
+void
+ping_output_error (uint8_t type, uint8_t code, uint32_t mtu, const char *from)
+{
+    struct timespec now;
+
+    clock_gettime (CLOCK_MONOTONIC, &now);
+    output_begin ();
+    if (g_ping.options.format == FORMAT_JSON)
+    {
+        output_printf ("{\"type\":\"error\",\"received\":");
+        output_time (&now);
+        output_printf (",\"icmp_type\":%u,\"icmp_code\":%u,\"mtu\":%u,"
+                       "\"from\":\"%s\"}\n",
+                       type, code, mtu, from);
+    }
+    else
+    {
+        output_printf ("error,,,,,,,,");
+        output_time (&now);
+        output_printf (",,%u,%u,%s,,,,,,,,,,,,,,,,,,\n", type, code, from);
+    }
+}
+
+/**
+ * @brief Records a probe declared lost, once its deadline has passed or when
+ * the session ends before it.
+ */
+
+void
+ping_output_probe_lost (const struct s_probe *probe)
+{
+    output_probe_head (&g_ping.targets[probe->target], probe->target_seq);
+    if (g_ping.options.format == FORMAT_JSON)
+    {
+        output_printf (",\"sent\":");
+        output_time (&probe->sent);
+        output_printf (",\"status\":\"lost\"");
+        if (probe->ttl > 0)
+        {
+            output_printf (",\"hop\":%u", probe->ttl);
+        }
+        output_printf ("}\n");
+    }
+    else
+    {
+        output_printf (",,,");
+        output_time (&probe->sent);
+        output_printf (",,lost,,,,,,,,,,,,,,,,,,,,,");
+        if (probe->ttl > 0)
+        {
+            output_printf ("%u", probe->ttl);
+        }
+        output_printf ("\n");
+    }
+}
+
+/**
+ * @brief Records the probes still unanswered at the end of the session of
+ * the calling thread, and flushes its buffer.
+ */
+
+void
+ping_output_lost ()
+{
+    for (uint32_t i = 0; i < PROBE_RING_SIZE; ++i)
+    {
+        const struct s_probe *probe = &g_ping.probes[i];
+
+        if (probe->outstanding && probe->target < g_ping.nb_targets)
+        {
+            ping_output_probe_lost (probe);
+        }
+    }
+    ping_output_flush ();
+}
+
+static void
+output_summary (const char *type, const struct s_target *target,
+                const struct s_stats *stats)
+{
+    const double *p = stats->percentiles;
+
+    output_begin ();
+    if (g_ping.options.format == FORMAT_JSON)
+    {
+        output_printf ("{\"type\":\"%s\",\"target\":", type);
+        output_string (target ? target->hostname : NULL);
+        output_printf (",\"addr\":");
+        output_string (target ? target->ip_addr : NULL);
+        output_printf (",\"transmitted\":%" PRIu64 ",\"received\":%" PRIu64
+                       ",\"loss_pct\":%.3f,\"time_ms\":%.0f,\"min_ms\":%.3f,"
+                       "\"avg_ms\":%.3f,\"max_ms\":%.3f,\"mdev_ms\":%.3f,"
+                       "\"p50_ms\":%.3f,\"p90_ms\":%.3f,\"p99_ms\":%.3f,"
+                       "\"p999_ms\":%.3f,\"p9999_ms\":%.3f,\"duplicates\":%"
+                       PRIu64 ",\"reordered\":%" PRIu64
+                       ",\"reorder_max\":%" PRIu64 ",\"late\":%" PRIu64
+                       "}\n",
+                       stats->nb_snd, stats->nb_res, stats->pkt_loss,
+                       stats->ping_session, stats->min, stats->avg, stats->max,
+                       stats->mdev, p[0], p[1], p[2], p[3], p[4],
+                       stats->nb_dup, stats->nb_reordered, stats->reorder_max,
+                       stats->nb_late);
+    }
+    else
+    {
+        output_printf ("%s,", type);
+        output_string (target ? target->hostname : NULL);
+        output_printf (",%s,,,,,,,,,,,%" PRIu64 ",%" PRIu64
+                       ",%.3f,%.0f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,"
+                       "%.3f,%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64
+                       ",\n",
+                       target ? target->ip_addr : "", stats->nb_snd,
+                       stats->nb_res, stats->pkt_loss, stats->ping_session,
+                       stats->min, stats->avg, stats->max, stats->mdev, p[0],
+                       p[1], p[2], p[3], p[4], stats->nb_dup,
+                       stats->nb_reordered, stats->reorder_max,
+                       stats->nb_late);
+    }
+}
+
+/**
+ * @brief Records the statistics of one hop of the path to a target.
+ * @param target target probed in path mode
+ * @param index rank of the hop, from 0
+ */
+
+static void
+output_hop (const struct s_target *target, uint8_t index)
+{
+    const struct s_hop *hop = &target->hops[index];
+    char from[INET6_ADDRSTRLEN];
+
+    hop_addr (hop, from);
+    output_begin ();
+    if (g_ping.options.format == FORMAT_JSON)
+    {
+        output_printf ("{\"type\":\"hop\",\"target\":");
+        output_string (target->hostname);
+        output_printf (",\"addr\":\"%s\",\"hop\":%u,\"from\":\"%s\","
+                       "\"transmitted\":%" PRIu64 ",\"received\":%" PRIu64
+                       ",\"loss_pct\":%.3f,\"min_ms\":%.3f,\"avg_ms\":%.3f,"
+                       "\"max_ms\":%.3f,\"mdev_ms\":%.3f}\n",
+                       target->ip_addr, index + 1, from, hop->nb_snd,
+                       hop->nb_res, hop->pkt_loss, hop->rtt.min, hop->rtt.mean,
+                       hop->rtt.max, hop->mdev);
+    }
+    else
+    {
+        output_printf ("hop,");
+        output_string (target->hostname);
+        output_printf (",%s,,,,,,,,,,%s,%" PRIu64 ",%" PRIu64
+                       ",%.3f,,%.3f,%.3f,%.3f,%.3f,,,,,,,,,,%u\n",
+                       target->ip_addr, from, hop->nb_snd, hop->nb_res,
+                       hop->pkt_loss, hop->rtt.min, hop->rtt.mean,
+                       hop->rtt.max, hop->mdev, index + 1);
+    }
+}
+
+/**
+ * @brief Machine readable counterpart of ping_messages_handler(), one
+ * record per reply and a summary record per target once the session is
+ * over, plus an aggregate one for several targets. In path mode, a hop
+ * record per hop of each target replaces the summaries.
+ * @param type message to emit
+ */
+
+void
+ping_output_handler (message type)
+{
+    if (type == START && g_ping.options.format == FORMAT_CSV)
+    {
+        output_begin ();
+        output_printf ("%s", CSV_HEADER);
+    }
+    else if (type == PING || type == HOP)
+    {
+        output_reply (type);
+    }
+    else if (type == END && g_ping.options.path_hops > 0)
+    {
+        /* In path mode, the hops of each target are the statistics. */
+
+        for (uint32_t i = 0; i < g_ping.nb_targets; ++i)
+        {
+            compute_hop_stats (&g_ping.targets[i]);
+            for (uint8_t hop = 0; hop < g_ping.targets[i].path_len; ++hop)
+            {
+                output_hop (&g_ping.targets[i], hop);
+            }
+        }
+        ping_output_flush ();
+    }
+    else if (type == END)
+    {
+        for (uint32_t i = 0; i < g_ping.nb_targets; ++i)
+        {
+            compute_rtt_stats (&g_ping.targets[i]);
+            output_summary ("summary", &g_ping.targets[i],
+                            &g_ping.targets[i].stats);
+        }
+        if (g_ping.nb_targets > 1)
+        {
+            compute_aggregate_stats ();
+            output_summary ("aggregate", NULL, &g_ping.stats);
+        }
+        ping_output_flush ();
+    }
+}
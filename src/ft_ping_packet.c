@@ -0,0 +1,292 @@
+#include "ft_ping.h"
+
+/**
+ * @brief Matches both families on the identifiers of their sockets, those of
+ * datagram sockets are only known once they are open.
+ */
+
+static void
+packet_filter ()
+{
+    ping_filter_packet_attach (g_ping.packet->fd, g_ping.sock_info.v4.ident,
+                               g_ping.sock_info.v6.ident);
+}
+
+/**
+ * @brief Hands one captured reply to the common receive path. The frame
+ * starts at the IP header, the source address, the hop limit and the kernel
+ * stamp of the frame are turned into what recvmsg() would have returned on
+ * a raw IPv4 socket or on an IPv6 socket. The link layer may pad a short
+ * frame, the length is taken from the IP header.
+ * @param frame frame header, followed by the frame in the ring
+ * @param mono CLOCK_MONOTONIC time sampled before the walk
+ * @param real CLOCK_REALTIME time sampled along with mono
+ */
+
+static void
+packet_frame (const struct tpacket3_hdr *frame, const struct timespec *mono,
+              const struct timespec *real)
+{
+    uint8_t *data = (uint8_t *)frame + frame->tp_mac;
+    size_t len = frame->tp_snaplen;
+    struct timespec stamp = { frame->tp_sec, frame->tp_nsec };
+    struct sockaddr_storage from;
+    union
+    {
+        char buf[CMSG_SPACE (sizeof (struct timespec))
+                 + CMSG_SPACE (sizeof (int))];
+        struct cmsghdr align;
+    } control;
+    struct iovec iov;
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+
+    memset (&from, 0, sizeof (from));
+    memset (&msg, 0, sizeof (msg));
+    msg.msg_name = &from;
+    msg.msg_namelen = sizeof (from);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = CMSG_SPACE (sizeof (struct timespec));
+
+    cmsg = CMSG_FIRSTHDR (&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_TIMESTAMPNS;
+    cmsg->cmsg_len = CMSG_LEN (sizeof (stamp));
+    memcpy (CMSG_DATA (cmsg), &stamp, sizeof (stamp));
+
+    if (len >= sizeof (struct ip6_hdr) + sizeof (struct icmp6_hdr)
+        && data[0] >> 4 == 6)
+    {
+        const struct ip6_hdr *ip6_hdr = (const struct ip6_hdr *)data;
+        struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)&from;
+        int hoplimit = ip6_hdr->ip6_hlim;
+
+        if (g_ping.sock_info.v6.fd == -1)
+        {
+            return;
+        }
+        sin6->sin6_family = AF_INET6;
+        sin6->sin6_addr = ip6_hdr->ip6_src;
+
+        msg.msg_controllen = sizeof (control.buf);
+        cmsg = CMSG_NXTHDR (&msg, cmsg);
+        cmsg->cmsg_level = IPPROTO_IPV6;
+        cmsg->cmsg_type = IPV6_HOPLIMIT;
+        cmsg->cmsg_len = CMSG_LEN (sizeof (hoplimit));
+        memcpy (CMSG_DATA (cmsg), &hoplimit, sizeof (hoplimit));
+
+        iov.iov_base = data + sizeof (struct ip6_hdr);
+        iov.iov_len = len - sizeof (struct ip6_hdr);
+        if (iov.iov_len > ntohs (ip6_hdr->ip6_plen))
+        {
+            iov.iov_len = ntohs (ip6_hdr->ip6_plen);
+        }
+        ping_reply_handler (&g_ping.sock_info.v6, IPV6, &msg, iov.iov_len,
+                            mono, real);
+    }
+    else if (len >= sizeof (struct iphdr) + sizeof (struct icmphdr))
+    {
+        const struct iphdr *ip_hdr = (const struct iphdr *)data;
+        struct sockaddr_in *sin = (struct sockaddr_in *)&from;
+        struct s_icmp_socket raw;
+
+        if (g_ping.sock_info.v4.fd == -1)
+        {
+            return;
+        }
+        sin->sin_family = AF_INET;
+        sin->sin_addr.s_addr = ip_hdr->saddr;
+
+        /* The IP header is there whatever the socket the request left on,
+         * the reply is parsed as if it came from a raw socket. */
+
+        raw = g_ping.sock_info.v4;
+        raw.dgram = false;
+        iov.iov_base = data;
+        iov.iov_len = len;
+        if (iov.iov_len > ntohs (ip_hdr->tot_len))
+        {
+            iov.iov_len = ntohs (ip_hdr->tot_len);
+        }
+        ping_reply_handler (&raw, IPV4, &msg, iov.iov_len, mono, real);
+    }
+}
+
+/**
+ * @brief Walks the blocks the kernel has handed over, in ring order, and
+ * handles their frames in place. Each block goes back to the kernel once
+ * all of its frames are done.
+ */
+
+static void
+packet_walk ()
+{
+    struct s_packet_ring *packet = g_ping.packet;
+    struct timespec mono, real;
+
+    sample_clocks (&mono, &real);
+
+    while (g_ping.info.read_loop)
+    {
+        struct tpacket_block_desc *block
+            = (struct tpacket_block_desc *)(packet->map
+                                            + (size_t)packet->current
+                                                  * PACKET_BLOCK_SIZE);
+        _Atomic uint32_t *status
+            = (_Atomic uint32_t *)&block->hdr.bh1.block_status;
+        const uint8_t *frame;
+
+        if (!(atomic_load_explicit (status, memory_order_acquire)
+              & TP_STATUS_USER))
+        {
+            break;
+        }
+
+        frame = (const uint8_t *)block + block->hdr.bh1.offset_to_first_pkt;
+        for (uint32_t i = 0; i < block->hdr.bh1.num_pkts; ++i)
+        {
+            const struct tpacket3_hdr *hdr
+                = (const struct tpacket3_hdr *)frame;
+
+            packet_frame (hdr, &mono, &real);
+            frame += hdr->tp_next_offset;
+        }
+
+        atomic_store_explicit (status, TP_STATUS_KERNEL, memory_order_release);
+        packet->current = (packet->current + 1) % PACKET_BLOCKS;
+    }
+}
+
+/**
+ * @brief The ICMP socket keeps sending the requests and receiving the error
+ * messages, its Echo Replies are dropped as they are captured in the ring.
+ */
+
+static void
+packet_watch (struct s_icmp_socket *sock, ip_version ipv)
+{
+    ping_filter_errors_only (sock, ipv);
+    packet_filter ();
+    g_io_socket.watch (sock, ipv);
+}
+
+static void
+packet_send (struct s_icmp_socket *sock, struct mmsghdr *msgs, int count)
+{
+    g_io_socket.send (sock, msgs, count);
+}
+
+static _Bool
+packet_handle (int fd)
+{
+    if (fd != g_ping.packet->fd)
+    {
+        return g_io_socket.handle (fd);
+    }
+    packet_walk ();
+    ping_replies_done ();
+    return true;
+}
+
+static void
+packet_release ()
+{
+    struct s_packet_ring *packet = g_ping.packet;
+
+    if (packet == NULL)
+    {
+        return;
+    }
+    if (packet->map != NULL && packet->map != MAP_FAILED)
+    {
+        munmap (packet->map, (size_t)PACKET_BLOCKS * PACKET_BLOCK_SIZE);
+    }
+    if (packet->fd != -1)
+    {
+        close (packet->fd);
+    }
+    free (packet);
+    g_ping.packet = NULL;
+}
+
+/**
+ * @brief Sets up the TPACKET_V3 receive ring of the calling context. The
+ * socket captures on every interface from the network header on, the filter
+ * is attached before it is bound so that nothing else is ever queued. The
+ * event loop watches it along with the sockets, it is readable once a block
+ * has been handed over.
+ * @return 0 on success, -1 without CAP_NET_RAW or TPACKET_V3 support, or if
+ * the replies may not fit an Ethernet frame, the socket backend is then used.
+ */
+
+static int
+packet_init ()
+{
+    struct s_packet_ring *packet;
+    int version = TPACKET_V3;
+    struct tpacket_req3 req;
+    struct sockaddr_ll addr;
+
+    if ((packet = calloc (1, sizeof (struct s_packet_ring))) == NULL)
+    {
+        perror ("calloc");
+        release_resources ();
+        exit (EXIT_FAILURE);
+    }
+    g_ping.packet = packet;
+    packet->fd = -1;
+
+    /* The ring sees the fragments of a large reply, not the reassembled
+     * datagram. */
+
+    if (sizeof (struct ip6_hdr) + g_ping.batch->pkt_size > ETH_DATA_LEN)
+    {
+        return -1;
+    }
+
+    memset (&req, 0, sizeof (req));
+    req.tp_block_size = PACKET_BLOCK_SIZE;
+    req.tp_block_nr = PACKET_BLOCKS;
+    req.tp_frame_size = PACKET_FRAME_SIZE;
+    req.tp_frame_nr = PACKET_BLOCK_SIZE / PACKET_FRAME_SIZE * PACKET_BLOCKS;
+    req.tp_retire_blk_tov = PACKET_BLOCK_TIMEOUT_MSEC;
+
+    memset (&addr, 0, sizeof (addr));
+    addr.sll_family = AF_PACKET;
+    addr.sll_protocol = htons (ETH_P_ALL);
+
+    packet->fd = socket (AF_PACKET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                         0);
+    if (packet->fd == -1
+        || setsockopt (packet->fd, SOL_PACKET, PACKET_VERSION, &version,
+                       sizeof (version))
+               == -1
+        || setsockopt (packet->fd, SOL_PACKET, PACKET_RX_RING, &req,
+                       sizeof (req))
+               == -1)
+    {
+        return -1;
+    }
+    packet->map = mmap (NULL, (size_t)PACKET_BLOCKS * PACKET_BLOCK_SIZE,
+                        PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        packet->fd, 0);
+    if (packet->map == MAP_FAILED)
+    {
+        return -1;
+    }
+
+    packet_filter ();
+    if (bind (packet->fd, (struct sockaddr *)&addr, sizeof (addr)) == -1)
+    {
+        return -1;
+    }
+
+    ping_event_watch (packet->fd);
+    return 0;
+}
+
+const struct s_io_backend g_io_packet
+    = { "packet", packet_init, packet_watch, packet_send, packet_handle,
+        packet_release };
@@ -0,0 +1,543 @@
+#include "ft_ping.h"
+
+static void
+hints_init (struct addrinfo *hints, int flags)
+{
+    memset (hints, 0, sizeof (*hints));
+    hints->ai_family = AF_UNSPEC;
+    hints->ai_socktype = SOCK_RAW;
+    hints->ai_flags = flags;
+}
+
+/**
+ * @brief Takes the next free slot of the target table. The table starts
+ * with one slot per host given on the command line, a host may however
+ * bring several addresses with -a.
+ */
+
+static struct s_target *
+target_slot ()
+{
+    struct s_target *target;
+
+    if (g_ping.nb_targets == g_ping.targets_size)
+    {
+        size_t size = g_ping.targets_size * 2;
+
+        if ((target = realloc (g_ping.targets, size * sizeof (struct s_target)))
+            == NULL)
+        {
+            perror ("realloc");
+            release_resources ();
+            exit (EXIT_FAILURE);
+        }
+        g_ping.targets = target;
+        g_ping.targets_size = size;
+    }
+
+    target = &g_ping.targets[g_ping.nb_targets];
+    memset (target, 0, sizeof (*target));
+    target->stats.timeout_threshold = LOSS_TIMEOUT_INIT_MSEC;
+    return target;
+}
+
+/**
+ * @brief Appends a target for one address of a hostname, unless the
+ * hostname already has a target for that very address.
+ * @param hostname destination hostname
+ * @param addr resolved address, either AF_INET or AF_INET6
+ * @return 1 if a target was added, 0 otherwise.
+ */
+
+static uint32_t
+target_add (const char *hostname, const struct sockaddr *addr)
+{
+    struct s_target *target = target_slot ();
+
+    if (addr->sa_family == AF_INET)
+    {
+        memcpy (&target->addr_4, addr, sizeof (target->addr_4));
+        inet_ntop (AF_INET, &target->addr_4.sin_addr, target->ip_addr,
+                   sizeof (target->ip_addr));
+        target->ipv = IPV4;
+    }
+    else
+    {
+        memcpy (&target->addr_6, addr, sizeof (target->addr_6));
+        inet_ntop (AF_INET6, &target->addr_6.sin6_addr, target->ip_addr,
+                   sizeof (target->ip_addr));
+        target->ipv = IPV6;
+    }
+    target->hostname = hostname;
+
+    /* The targets of a hostname are appended together. */
+
+    for (uint32_t i = g_ping.nb_targets;
+         i > 0 && g_ping.targets[i - 1].hostname == hostname; --i)
+    {
+        if (strcmp (g_ping.targets[i - 1].ip_addr, target->ip_addr) == 0)
+        {
+            return 0;
+        }
+    }
+
+    /* In path mode, every hop is probed until the destination answers. */
+
+    if (g_ping.options.path_hops > 0)
+    {
+        if ((target->hops = calloc (g_ping.options.path_hops,
+                                    sizeof (struct s_hop)))
+            == NULL)
+        {
+            perror ("calloc");
+            release_resources ();
+            exit (EXIT_FAILURE);
+        }
+        target->path_len = g_ping.options.path_hops;
+    }
+    ++g_ping.nb_targets;
+    return 1;
+}
+
+/**
+ * @brief Turns the addresses resolved for a destination into targets, we
+ * are dealing with IPV4 & 6. The getaddrinfo() function allocates and
+ * initializes a linked list of addrinfo structures. There are several
+ * reasons why the linked list may have more than one addrinfo structure :
+ * - Multihoming (A network host can be reached via multiple IP addresses)
+ * - Multiple protocols (AF_INET (IPv4) and AF_INET6 (IPv6))
+ * - Various socket types (The same service can be reached via different socket
+ * types, such as SOCK_STREAM (TCP) and SOCK_DGRAM (UDP))
+ * With -a every address of the family selected with -4 or -6, of both
+ * families by default, becomes a target. Otherwise the first address of the
+ * selected family is preferred and the last address of the other family is
+ * used as a fallback.
+ * @param hostname destination hostname
+ * @param res addresses resolved for the hostname
+ * @return the number of targets added, 0 if no usable address was found.
+ */
+
+static uint32_t
+targets_from_addrinfo (const char *hostname, const struct addrinfo *res)
+{
+    const struct addrinfo *p;
+    const struct addrinfo *chosen = NULL;
+    uint32_t added = 0;
+
+    for (p = res; p != NULL; p = p->ai_next)
+    {
+        if (p->ai_family != AF_INET && p->ai_family != AF_INET6)
+        {
+            continue;
+        }
+
+        _Bool wanted = g_ping.options.ipv == UNSPEC
+                       || g_ping.options.ipv
+                              == (p->ai_family == AF_INET ? IPV4 : IPV6);
+
+        if (g_ping.options.all_addresses)
+        {
+            added += wanted ? target_add (hostname, p->ai_addr) : 0;
+            continue;
+        }
+
+        chosen = p;
+        if (wanted)
+        {
+            break;
+        }
+    }
+
+    if (chosen != NULL)
+    {
+        added = target_add (hostname, chosen->ai_addr);
+    }
+
+    if (chosen == NULL && added == 0)
+    {
+        fprintf (stderr, "No valid IPv4 or IPv6 address found for %s\n",
+                 hostname);
+    }
+    return added;
+}
+
+/**
+ * @brief Key of a cache entry, the addresses kept for a name depend on the
+ * family selected with -4 or -6 and on whether -a wants all of them.
+ */
+
+static int
+cache_key ()
+{
+    return g_ping.options.ipv + (g_ping.options.all_addresses ? 3 : 0);
+}
+
+/**
+ * @brief Loads the resolution cache given with -C. A line holds a hostname,
+ * its key, one resolved address and the time it expires at, expired lines
+ * are dropped.
+ */
+
+static void
+cache_load ()
+{
+    struct s_resolver *resolver = &g_ping.resolver;
+    struct s_cache_entry entry;
+    time_t now = time (NULL);
+    FILE *file;
+
+    if ((file = fopen (g_ping.options.cache_path, "r")) == NULL)
+    {
+        return;
+    }
+
+    while (fscanf (file, "%1024s %d %45s %ld", entry.hostname, &entry.key,
+                   entry.ip_addr, &entry.expires)
+           == 4)
+    {
+        if (entry.expires <= now)
+        {
+            continue;
+        }
+        if (resolver->nb_cache == resolver->cache_size)
+        {
+            size_t size = resolver->cache_size ? resolver->cache_size * 2 : 64;
+            struct s_cache_entry *cache;
+
+            if ((cache = realloc (resolver->cache,
+                                  size * sizeof (struct s_cache_entry)))
+                == NULL)
+            {
+                perror ("realloc");
+                fclose (file);
+                release_resources ();
+                exit (EXIT_FAILURE);
+            }
+            resolver->cache = cache;
+            resolver->cache_size = size;
+        }
+        resolver->cache[resolver->nb_cache++] = entry;
+    }
+    fclose (file);
+}
+
+static struct s_cache_entry *
+cache_lookup (const char *hostname, size_t from)
+{
+    struct s_resolver *resolver = &g_ping.resolver;
+
+    for (size_t i = from; i < resolver->nb_cache; ++i)
+    {
+        if (resolver->cache[i].key == cache_key ()
+            && strcmp (resolver->cache[i].hostname, hostname) == 0)
+        {
+            return &resolver->cache[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Writes the cache back with the names resolved by this run, through
+ * a temporary file renamed over the cache so that concurrent runs never read
+ * a partial one.
+ */
+
+static void
+cache_save ()
+{
+    struct s_resolver *resolver = &g_ping.resolver;
+    char tmp_path[PATH_MAX];
+    time_t expires = time (NULL) + RESOLVE_CACHE_TTL;
+    FILE *file;
+
+    if (snprintf (tmp_path, sizeof (tmp_path), "%s.%d",
+                  g_ping.options.cache_path, getpid ())
+            >= (int)sizeof (tmp_path)
+        || (file = fopen (tmp_path, "w")) == NULL)
+    {
+        return;
+    }
+
+    for (size_t i = 0; i < resolver->nb_cache; ++i)
+    {
+        const struct s_cache_entry *entry = &resolver->cache[i];
+        _Bool renewed = false;
+
+        for (uint32_t j = 0; j < resolver->nb_requests && !renewed; ++j)
+        {
+            renewed = resolver->requests[j].resolved
+                      && entry->key == cache_key ()
+                      && strcmp (resolver->requests[j].req.ar_name,
+                                 entry->hostname)
+                             == 0;
+        }
+        if (!renewed)
+        {
+            fprintf (file, "%s %d %s %ld\n", entry->hostname, entry->key,
+                     entry->ip_addr, (long)entry->expires);
+        }
+    }
+
+    for (uint32_t i = 0; i < g_ping.nb_targets; ++i)
+    {
+        const struct s_target *target = &g_ping.targets[i];
+
+        for (uint32_t j = 0; j < resolver->nb_requests; ++j)
+        {
+            if (resolver->requests[j].resolved
+                && resolver->requests[j].req.ar_name == target->hostname)
+            {
+                fprintf (file, "%s %d %s %ld\n", target->hostname,
+                         cache_key (), target->ip_addr, (long)expires);
+            }
+        }
+    }
+
+    if (fclose (file) != 0 || rename (tmp_path, g_ping.options.cache_path) != 0)
+    {
+        unlink (tmp_path);
+    }
+}
+
+/**
+ * @brief Resolves a hostname without the resolver, either because it is a
+ * numeric address or because the cache knows it.
+ * @return the number of targets added, 0 if the resolver is needed.
+ */
+
+static uint32_t
+resolve_local (const char *hostname)
+{
+    const struct s_cache_entry *entry;
+    struct addrinfo hints, *res;
+    uint32_t added = 0;
+
+    hints_init (&hints, AI_NUMERICHOST);
+    if (getaddrinfo (hostname, NULL, &hints, &res) == 0)
+    {
+        added = targets_from_addrinfo (hostname, res);
+        freeaddrinfo (res);
+        return added;
+    }
+
+    if (g_ping.options.cache_path == NULL)
+    {
+        return 0;
+    }
+
+    for (entry = cache_lookup (hostname, 0); entry != NULL;
+         entry = cache_lookup (hostname, entry - g_ping.resolver.cache + 1))
+    {
+        if (getaddrinfo (entry->ip_addr, NULL, &hints, &res) == 0)
+        {
+            added += targets_from_addrinfo (hostname, res);
+            freeaddrinfo (res);
+        }
+    }
+    return added;
+}
+
+/**
+ * @brief Runs in a helper thread of the resolver once a request completed,
+ * it only wakes the event loop up.
+ */
+
+static void
+resolve_notify (union sigval value)
+{
+    eventfd_write (value.sival_int, 1);
+}
+
+/**
+ * @brief Resolves every host given on the command line. Numeric addresses
+ * bypass the resolver (AI_NUMERICHOST) and names found in the cache are
+ * used right away, the other names are handed to getaddrinfo_a() one
+ * request each so that every name is probed as soon as it is resolved,
+ * while the already known targets are probed.
+ * @param nb_hosts number of destination hostnames
+ * @param hosts destination hostnames
+ */
+
+void
+ping_resolve_start (int nb_hosts, char **hosts)
+{
+    struct s_resolver *resolver = &g_ping.resolver;
+    struct sigevent sev;
+
+    if (g_ping.options.cache_path != NULL)
+    {
+        cache_load ();
+    }
+
+    if ((resolver->requests = calloc (nb_hosts, sizeof (struct s_resolve)))
+        == NULL)
+    {
+        perror ("calloc");
+        release_resources ();
+        exit (EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < nb_hosts; ++i)
+    {
+        struct s_resolve *request;
+
+        if (resolve_local (hosts[i]) > 0)
+        {
+            continue;
+        }
+
+        if (g_ping.event.resolve_fd == -1
+            && (g_ping.event.resolve_fd
+                = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC))
+                   == -1)
+        {
+            perror ("eventfd");
+            release_resources ();
+            exit (EXIT_FAILURE);
+        }
+
+        request = &resolver->requests[resolver->nb_requests++];
+        hints_init (&request->hints, 0);
+        request->req.ar_name = hosts[i];
+        request->req.ar_request = &request->hints;
+        request->list[0] = &request->req;
+
+        memset (&sev, 0, sizeof (sev));
+        sev.sigev_notify = SIGEV_THREAD;
+        sev.sigev_notify_function = resolve_notify;
+        sev.sigev_value.sival_int = g_ping.event.resolve_fd;
+
+        if (getaddrinfo_a (GAI_NOWAIT, request->list, 1, &sev) != 0)
+        {
+            fprintf (stderr, "Failed to resolve hostname %s\n", hosts[i]);
+            request->done = true;
+            continue;
+        }
+        ++resolver->nb_pending;
+    }
+}
+
+/**
+ * @brief Collects the requests completed since the last call, every name
+ * resolved is appended to the target table.
+ * @return the number of targets added.
+ */
+
+uint32_t
+ping_resolve_handler ()
+{
+    struct s_resolver *resolver = &g_ping.resolver;
+    uint32_t added = 0;
+    eventfd_t value;
+
+    eventfd_read (g_ping.event.resolve_fd, &value);
+
+    for (uint32_t i = 0; i < resolver->nb_requests; ++i)
+    {
+        struct s_resolve *request = &resolver->requests[i];
+        uint32_t nb;
+        int status;
+
+        if (request->done
+            || (status = gai_error (&request->req)) == EAI_INPROGRESS)
+        {
+            continue;
+        }
+
+        request->done = true;
+        --resolver->nb_pending;
+
+        if (status != 0)
+        {
+            fprintf (stderr, "getaddrinfo: %s\n", gai_strerror (status));
+            fprintf (stderr, "Failed to resolve hostname %s\n",
+                     request->req.ar_name);
+            continue;
+        }
+
+        if ((nb = targets_from_addrinfo (request->req.ar_name,
+                                         request->req.ar_result))
+            > 0)
+        {
+            request->resolved = true;
+            added += nb;
+        }
+        freeaddrinfo (request->req.ar_result);
+        request->req.ar_result = NULL;
+    }
+
+    if (resolver->nb_pending == 0 && g_ping.options.cache_path != NULL)
+    {
+        cache_save ();
+    }
+    return added;
+}
+
+/**
+ * @brief Waits for every pending name to be resolved, used when the targets
+ * must all be known before probing starts.
+ */
+
+void
+ping_resolve_wait ()
+{
+    struct s_resolver *resolver = &g_ping.resolver;
+
+    while (resolver->nb_pending > 0)
+    {
+        for (uint32_t i = 0; i < resolver->nb_requests; ++i)
+        {
+            const struct gaicb *const *list
+                = (const struct gaicb *const *)resolver->requests[i].list;
+
+            if (!resolver->requests[i].done)
+            {
+                gai_suspend (list, 1, NULL);
+                break;
+            }
+        }
+        ping_resolve_handler ();
+    }
+}
+
+/**
+ * @brief Cancels the requests still in flight. A request the resolver could
+ * not cancel is still using its memory, the table is then left behind for
+ * the process to exit with.
+ */
+
+void
+ping_resolve_release ()
+{
+    struct s_resolver *resolver = &g_ping.resolver;
+    _Bool in_use = false;
+
+    for (uint32_t i = 0; i < resolver->nb_requests; ++i)
+    {
+        struct s_resolve *request = &resolver->requests[i];
+
+        if (request->done)
+        {
+            continue;
+        }
+        if (gai_cancel (&request->req) == EAI_NOTCANCELED)
+        {
+            in_use = true;
+        }
+        else if (request->req.ar_result != NULL)
+        {
+            freeaddrinfo (request->req.ar_result);
+        }
+    }
+
+    if (!in_use)
+    {
+        free (resolver->requests);
+    }
+    free (resolver->cache);
+    resolver->requests = NULL;
+    resolver->cache = NULL;
+    resolver->nb_requests = 0;
+    resolver->nb_cache = 0;
+}
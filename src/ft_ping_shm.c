@@ -0,0 +1,154 @@
+#include "ft_ping.h"
+
+/* The segment is shared by the probing threads, each of them only writes
+ * the entries of its own targets. */
+
+static struct s_shm g_shm = { .fd = -1 };
+
+static size_t
+shm_size (uint32_t capacity)
+{
+    return sizeof (struct s_shm_header)
+           + (size_t)capacity * sizeof (struct s_shm_target);
+}
+
+/**
+ * @brief Copies the statistics of a target into its entry. The sequence is
+ * odd while the entry is being written, a reader retries until it reads the
+ * same even sequence before and after its copy. Only plain stores, no
+ * syscall is made.
+ * @param target index of the target in the table of the calling thread
+ */
+
+void
+ping_shm_update (uint32_t target)
+{
+    const struct s_target *t = &g_ping.targets[target];
+    struct s_shm_target *entry;
+    uint64_t seq;
+
+    if (g_shm.header == NULL)
+    {
+        return;
+    }
+
+    entry = &g_shm.header->targets[g_ping.first_target + target];
+    seq = atomic_load_explicit (&entry->seq, memory_order_relaxed);
+    atomic_store_explicit (&entry->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence (memory_order_release);
+
+    entry->nb_snd = t->stats.nb_snd;
+    entry->nb_res = t->stats.nb_res;
+    entry->rtt = t->stats.rtt;
+    entry->last_rtt = g_ping.info.target == t ? g_ping.info.rtt
+                                              : entry->last_rtt;
+    entry->estimated_rtt = t->stats.estimated_rtt;
+    entry->dev_rtt = t->stats.dev_rtt;
+    entry->updated = t->stats.nb_res ? t->stats.session_end
+                                     : t->stats.session_start;
+
+    atomic_store_explicit (&entry->seq, seq + 2, memory_order_release);
+}
+
+/**
+ * @brief Describes the targets of the table in their entries and publishes
+ * their number, entries are always described before being counted.
+ */
+
+void
+ping_shm_targets ()
+{
+    struct s_shm_header *header = g_shm.header;
+
+    if (header == NULL)
+    {
+        return;
+    }
+
+    if (g_ping.nb_targets > header->capacity)
+    {
+        uint32_t capacity = g_ping.nb_targets * 2;
+        void *addr;
+
+        if (ftruncate (g_shm.fd, shm_size (capacity)) == -1
+            || (addr = mremap (header, shm_size (header->capacity),
+                               shm_size (capacity), MREMAP_MAYMOVE))
+                   == MAP_FAILED)
+        {
+            perror ("mremap");
+            return;
+        }
+        header = g_shm.header = addr;
+        header->capacity = capacity;
+    }
+
+    for (uint32_t i = atomic_load (&header->nb_targets); i < g_ping.nb_targets;
+         ++i)
+    {
+        struct s_shm_target *entry = &header->targets[i];
+
+        snprintf (entry->hostname, sizeof (entry->hostname), "%s",
+                  g_ping.targets[i].hostname);
+        memcpy (entry->ip_addr, g_ping.targets[i].ip_addr,
+                sizeof (entry->ip_addr));
+        ping_shm_update (i);
+    }
+    atomic_store_explicit (&header->nb_targets, g_ping.nb_targets,
+                           memory_order_release);
+}
+
+/**
+ * @brief Creates the statistics segment given with -S, a file mapped by
+ * ft_ping and by the readers. It starts with room for the targets known so
+ * far, a reader maps it again once it sees a larger capacity.
+ */
+
+void
+ping_shm_open ()
+{
+    uint32_t capacity = g_ping.nb_targets ? g_ping.nb_targets : 1;
+    struct s_shm_header *header;
+
+    if ((g_shm.fd = open (g_ping.options.stats_shm,
+                          O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644))
+            == -1
+        || ftruncate (g_shm.fd, shm_size (capacity)) == -1
+        || (header = mmap (NULL, shm_size (capacity), PROT_READ | PROT_WRITE,
+                           MAP_SHARED, g_shm.fd, 0))
+               == MAP_FAILED)
+    {
+        perror (g_ping.options.stats_shm);
+        ping_shm_close ();
+        release_resources ();
+        exit (EXIT_FAILURE);
+    }
+
+    header->magic = SHM_MAGIC;
+    header->version = SHM_VERSION;
+    header->pid = getpid ();
+    header->capacity = capacity;
+    clock_gettime (CLOCK_MONOTONIC, &header->started);
+    g_shm.header = header;
+    ping_shm_targets ();
+}
+
+/**
+ * @brief Unmaps and removes the segment, readers see a finished instance
+ * disappear.
+ */
+
+void
+ping_shm_close ()
+{
+    if (g_shm.header != NULL)
+    {
+        munmap (g_shm.header, shm_size (g_shm.header->capacity));
+        g_shm.header = NULL;
+    }
+    if (g_shm.fd != -1)
+    {
+        close (g_shm.fd);
+        unlink (g_ping.options.stats_shm);
+        g_shm.fd = -1;
+    }
+}
@@ -0,0 +1,740 @@
+#include "ft_ping.h"
+
+/* The user data of a request tells its kind and the socket it is about, the
+ * v4 socket is the registered file 0 and the v6 one the registered file 1.
+ * A send also tells the position of its request in the burst. */
+
+#define URING_SEND 0
+#define URING_RECV 1
+#define URING_POLLERR 2
+#define URING_PROBE 3
+#define URING_DATA(kind, index) ((uint64_t)(kind) << 1 | (index))
+#define URING_SEND_DATA(index, slot)                                          \
+    (URING_DATA (URING_SEND, index) | (uint64_t)(slot) << 3)
+#define URING_KIND(data) ((data) >> 1 & 3)
+#define URING_INDEX(data) ((data) & 1)
+#define URING_SLOT(data) ((data) >> 3)
+
+static int
+uring_setup (uint32_t entries, struct io_uring_params *params)
+{
+    return syscall (__NR_io_uring_setup, entries, params);
+}
+
+static int
+uring_enter (int fd, uint32_t to_submit, uint32_t min_complete, uint32_t flags)
+{
+    return syscall (__NR_io_uring_enter, fd, to_submit, min_complete, flags,
+                    NULL, 0);
+}
+
+static int
+uring_register (int fd, uint32_t opcode, const void *arg, uint32_t nr_args)
+{
+    return syscall (__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static struct s_icmp_socket *
+uring_socket (uint64_t data)
+{
+    return URING_INDEX (data) ? &g_ping.sock_info.v6 : &g_ping.sock_info.v4;
+}
+
+/**
+ * @brief Submits the queued requests and waits for min_complete completions
+ * to be available, all within a single io_uring_enter().
+ */
+
+static void
+uring_submit (uint32_t min_complete)
+{
+    struct s_uring *uring = g_ping.uring;
+
+    do
+    {
+        int ret = uring_enter (uring->fd, uring->to_submit, min_complete,
+                               min_complete ? IORING_ENTER_GETEVENTS : 0);
+
+        if (ret == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            perror ("io_uring_enter");
+            release_resources ();
+            exit (EXIT_FAILURE);
+        }
+        uring->to_submit -= ret;
+        min_complete = 0;
+    } while (uring->to_submit > 0);
+}
+
+/**
+ * @brief Returns the next free submission queue entry, cleared. It only
+ * reaches the kernel once uring_queue() published it.
+ */
+
+static struct io_uring_sqe *
+uring_sqe ()
+{
+    struct s_uring *uring = g_ping.uring;
+    uint32_t tail = atomic_load_explicit (uring->sq_tail, memory_order_relaxed);
+    struct io_uring_sqe *sqe;
+
+    if (tail - atomic_load_explicit (uring->sq_head, memory_order_acquire)
+        > uring->sq_mask)
+    {
+        uring_submit (0);
+    }
+    sqe = &uring->sqes[tail & uring->sq_mask];
+    memset (sqe, 0, sizeof (*sqe));
+    return sqe;
+}
+
+static void
+uring_queue ()
+{
+    struct s_uring *uring = g_ping.uring;
+
+    atomic_fetch_add_explicit (uring->sq_tail, 1, memory_order_release);
+    ++uring->to_submit;
+}
+
+/**
+ * @brief Arms the multishot recvmsg of a socket, every datagram then comes
+ * as a completion in a provided buffer without any further submission.
+ */
+
+static void
+uring_arm_recv (uint32_t index)
+{
+    struct io_uring_sqe *sqe = uring_sqe ();
+
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = index;
+    sqe->flags = IOSQE_FIXED_FILE | IOSQE_BUFFER_SELECT;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->addr = (uint64_t)(uintptr_t)&g_ping.uring->recv_msg;
+    sqe->len = 1;
+    sqe->buf_group = 0;
+    sqe->user_data = URING_DATA (URING_RECV, index);
+    uring_queue ();
+}
+
+/**
+ * @brief Arms a multishot poll on the error queue of a socket, which holds
+ * the transmit stamps and, on a datagram socket, the ICMP errors.
+ */
+
+static void
+uring_arm_pollerr (uint32_t index)
+{
+    struct io_uring_sqe *sqe = uring_sqe ();
+
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = index;
+    sqe->flags = IOSQE_FIXED_FILE;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->poll32_events = POLLERR;
+    sqe->user_data = URING_DATA (URING_POLLERR, index);
+    uring_queue ();
+}
+
+/**
+ * @brief Gives a provided buffer back to the kernel, the tail is published
+ * once the whole batch of completions has been handled.
+ */
+
+static void
+uring_recycle (uint16_t bid)
+{
+    struct s_uring *uring = g_ping.uring;
+    struct io_uring_buf *buf
+        = &uring->buf_ring->bufs[uring->buf_tail & (URING_BUFFERS - 1)];
+
+    buf->addr = (uint64_t)(uintptr_t)(uring->buffers
+                                      + (size_t)bid * uring->buffer_size);
+    buf->len = uring->buffer_size;
+    buf->bid = bid;
+    ++uring->buf_tail;
+}
+
+/**
+ * @brief Rebuilds the message of a datagram received in a provided buffer
+ * and hands it over to the common receive path.
+ */
+
+static void
+uring_reply (const struct io_uring_cqe *cqe, const struct timespec *mono,
+             const struct timespec *real)
+{
+    struct s_uring *uring = g_ping.uring;
+    uint16_t bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+    uint8_t *buf = uring->buffers + (size_t)bid * uring->buffer_size;
+    const struct io_uring_recvmsg_out *out
+        = (const struct io_uring_recvmsg_out *)buf;
+    uint8_t *name = buf + sizeof (*out);
+    uint8_t *control = name + uring->recv_msg.msg_namelen;
+    uint8_t *payload = control + uring->recv_msg.msg_controllen;
+    size_t room = uring->buffer_size - (payload - buf);
+    struct iovec iov = { payload,
+                         out->payloadlen < room ? out->payloadlen : room };
+    struct msghdr msg = { 0 };
+
+    msg.msg_name = name;
+    msg.msg_namelen = out->namelen;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = out->controllen ? control : NULL;
+    msg.msg_controllen = out->controllen;
+
+    if (g_ping.info.read_loop)
+    {
+        ping_reply_handler (uring_socket (cqe->user_data),
+                            URING_INDEX (cqe->user_data) ? IPV6 : IPV4, &msg,
+                            iov.iov_len, mono, real);
+    }
+    uring_recycle (bid);
+}
+
+/**
+ * @brief Handles a completion of the multishot recvmsg of a socket. The
+ * request ends when the provided buffers run out or on an error, it is armed
+ * again once the batch is handled.
+ * @return true if the request has to be armed again.
+ */
+
+static _Bool
+uring_recv_completion (const struct io_uring_cqe *cqe,
+                       const struct timespec *mono,
+                       const struct timespec *real)
+{
+    struct s_icmp_socket *sock = uring_socket (cqe->user_data);
+
+    if (cqe->res >= 0 && (cqe->flags & IORING_CQE_F_BUFFER))
+    {
+        uring_reply (cqe, mono, real);
+    }
+    else if (cqe->res < 0 && cqe->res != -ENOBUFS)
+    {
+        /* As with recvmmsg(), a datagram socket reports a pending ICMP
+         * error once on the next read, the error is in the error queue. */
+
+        if (sock->dgram && icmp_soft_error (-cqe->res))
+        {
+            recv_errqueue (sock);
+        }
+        else
+        {
+            errno = -cqe->res;
+            perror ("recvmsg");
+            g_ping.info.read_loop = g_ping.info.exit_code = false;
+            return false;
+        }
+    }
+    return !(cqe->flags & IORING_CQE_F_MORE);
+}
+
+/**
+ * @brief Reading the error queue leaves the error of a datagram socket
+ * pending, recvmmsg() would report it but the multishot recvmsg is not
+ * retried without data. It is cleared so that the next send does not
+ * report it in place of a request.
+ */
+
+static void
+uring_clear_error (const struct s_icmp_socket *sock)
+{
+    int err;
+    socklen_t len = sizeof (err);
+
+    if (sock->dgram)
+    {
+        getsockopt (sock->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+    }
+}
+
+/**
+ * @brief Reaps every completion, without any syscall: the replies are
+ * dispatched in arrival order, the error queues are drained and the
+ * multishot requests that ended are armed again with a single submission.
+ */
+
+static void
+uring_reap ()
+{
+    struct s_uring *uring = g_ping.uring;
+    struct timespec mono, real;
+    _Bool rearm[2][URING_POLLERR + 1] = { { false } };
+    uint32_t head;
+    uint32_t tail;
+
+    sample_clocks (&mono, &real);
+    head = atomic_load_explicit (uring->cq_head, memory_order_relaxed);
+    while (head != (tail = atomic_load_explicit (uring->cq_tail,
+                                                 memory_order_acquire)))
+    {
+        for (; head != tail; ++head)
+        {
+            const struct io_uring_cqe *cqe
+                = &uring->cqes[head & uring->cq_mask];
+            uint32_t index = URING_INDEX (cqe->user_data);
+
+            switch (URING_KIND (cqe->user_data))
+            {
+                case URING_SEND:
+                    --uring->sends_pending;
+                    if (cqe->res < 0)
+                    {
+                        errno = -cqe->res;
+                        perror ("sendmsg");
+                        release_resources ();
+                        exit (EXIT_FAILURE);
+                    }
+                    break;
+                case URING_RECV:
+                    rearm[index][URING_RECV]
+                        |= uring_recv_completion (cqe, &mono, &real);
+                    break;
+                case URING_POLLERR:
+                    while (cqe->res >= 0
+                           && recv_errqueue (uring_socket (cqe->user_data))
+                                  == RECV_BATCH_MAX)
+                    {
+                    }
+                    uring_clear_error (uring_socket (cqe->user_data));
+                    rearm[index][URING_POLLERR]
+                        |= !(cqe->flags & IORING_CQE_F_MORE);
+                    break;
+            }
+        }
+        atomic_store_explicit (uring->cq_head, head, memory_order_release);
+    }
+    atomic_store_explicit ((_Atomic uint16_t *)&uring->buf_ring->tail,
+                           uring->buf_tail, memory_order_release);
+
+    for (uint32_t index = 0; index < 2 && g_ping.info.read_loop; ++index)
+    {
+        if (rearm[index][URING_RECV])
+        {
+            uring_arm_recv (index);
+        }
+        if (rearm[index][URING_POLLERR])
+        {
+            uring_arm_pollerr (index);
+        }
+    }
+    if (uring->to_submit > 0)
+    {
+        uring_submit (0);
+    }
+
+    ping_replies_done ();
+}
+
+/**
+ * @brief Deals with the failed sends of a burst while the send vector still
+ * holds it, their completions are fixed up for uring_reap(). A datagram
+ * socket reports a pending ICMP error on a send instead of sending the
+ * request, which happens within a burst once a router answers one of its
+ * first requests: such a request is sent again right away, once, the error
+ * itself is read from the error queue. A request refused for its
+ * destination only fails its own target.
+ * @param sock socket of the burst
+ * @param msgs requests of the burst
+ * @param head first completion not reaped yet
+ * @param tail end of the completions
+ */
+
+static void
+uring_send_errors (const struct s_icmp_socket *sock, struct mmsghdr *msgs,
+                   uint32_t head, uint32_t tail)
+{
+    struct s_uring *uring = g_ping.uring;
+
+    for (uint32_t i = head; i != tail; ++i)
+    {
+        struct io_uring_cqe *cqe = &uring->cqes[i & uring->cq_mask];
+
+        if (URING_KIND (cqe->user_data) != URING_SEND)
+        {
+            continue;
+        }
+        if (sock->dgram && cqe->res < 0 && icmp_soft_error (-cqe->res))
+        {
+            ssize_t ret = sendmsg (
+                sock->fd, &msgs[URING_SLOT (cqe->user_data)].msg_hdr, 0);
+
+            cqe->res = ret == -1 ? -errno : (int32_t)ret;
+        }
+        if (cqe->res < 0 && icmp_send_error (-cqe->res))
+        {
+            ping_send_failed (URING_SLOT (cqe->user_data), -cqe->res);
+            cqe->res = 0;
+        }
+    }
+}
+
+/**
+ * @brief Queues one sendmsg per request and submits the burst with a single
+ * io_uring_enter(). The send vector is refilled by the next burst, the call
+ * only returns once the kernel is done with every request, which it is
+ * right away unless the socket buffer is full.
+ */
+
+static void
+uring_send (struct s_icmp_socket *sock, struct mmsghdr *msgs, int count)
+{
+    struct s_uring *uring = g_ping.uring;
+    uint32_t index = sock == &g_ping.sock_info.v6;
+
+    for (int i = 0; i < count; ++i)
+    {
+        struct io_uring_sqe *sqe = uring_sqe ();
+
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->fd = index;
+        sqe->flags = IOSQE_FIXED_FILE;
+        sqe->addr = (uint64_t)(uintptr_t)&msgs[i].msg_hdr;
+        sqe->len = 1;
+        sqe->user_data = URING_SEND_DATA (index, i);
+        uring_queue ();
+    }
+    uring->sends_pending += count;
+    uring_submit (0);
+
+    /* The completions are left in place for uring_reap(), they are only
+     * counted here. */
+
+    for (;;)
+    {
+        uint32_t head
+            = atomic_load_explicit (uring->cq_head, memory_order_relaxed);
+        uint32_t tail
+            = atomic_load_explicit (uring->cq_tail, memory_order_acquire);
+        uint32_t done = 0;
+
+        for (uint32_t i = head; i != tail; ++i)
+        {
+            done += URING_KIND (uring->cqes[i & uring->cq_mask].user_data)
+                    == URING_SEND;
+        }
+        if (done >= uring->sends_pending)
+        {
+            uring_send_errors (sock, msgs, head, tail);
+            break;
+        }
+        uring_submit (tail - head + uring->sends_pending - done);
+    }
+}
+
+/**
+ * @brief Registers a newly opened socket in its file slot, then arms its
+ * receive and its error queue poll.
+ */
+
+static void
+uring_watch (struct s_icmp_socket *sock, ip_version ipv)
+{
+    uint32_t index = ipv == IPV6;
+    struct io_uring_files_update update = { 0 };
+
+    update.offset = index;
+    update.fds = (uint64_t)(uintptr_t)&sock->fd;
+    if (uring_register (g_ping.uring->fd, IORING_REGISTER_FILES_UPDATE,
+                        &update, 1)
+        == -1)
+    {
+        perror ("io_uring_register");
+        release_resources ();
+        exit (EXIT_FAILURE);
+    }
+    uring_arm_recv (index);
+    uring_arm_pollerr (index);
+    uring_submit (0);
+}
+
+static _Bool
+uring_handle (int fd)
+{
+    if (fd != g_ping.uring->fd)
+    {
+        return false;
+    }
+    uring_reap ();
+    return true;
+}
+
+static void
+uring_release ()
+{
+    struct s_uring *uring = g_ping.uring;
+
+    if (uring == NULL)
+    {
+        return;
+    }
+    if (uring->fd != -1)
+    {
+        close (uring->fd);
+    }
+    if (uring->sq_ring != NULL && uring->sq_ring != MAP_FAILED)
+    {
+        munmap (uring->sq_ring, uring->sq_ring_size);
+    }
+    if (uring->cq_ring != NULL && uring->cq_ring != MAP_FAILED
+        && uring->cq_ring != uring->sq_ring)
+    {
+        munmap (uring->cq_ring, uring->cq_ring_size);
+    }
+    if (uring->sqes != NULL && uring->sqes != MAP_FAILED)
+    {
+        munmap (uring->sqes, uring->sqes_size);
+    }
+    if (uring->buf_ring != NULL && uring->buf_ring != MAP_FAILED)
+    {
+        munmap (uring->buf_ring, uring->buf_ring_size);
+    }
+    free (uring->buffers);
+    free (uring);
+    g_ping.uring = NULL;
+}
+
+/**
+ * @brief Maps the submission and completion rings of a new instance.
+ * @return 0 on success, -1 otherwise.
+ */
+
+static int
+uring_map (struct s_uring *uring, const struct io_uring_params *params)
+{
+    uint8_t *sq;
+    uint8_t *cq;
+
+    uring->sq_ring_size
+        = params->sq_off.array + params->sq_entries * sizeof (uint32_t);
+    uring->cq_ring_size = params->cq_off.cqes
+                          + params->cq_entries * sizeof (struct io_uring_cqe);
+    if (params->features & IORING_FEAT_SINGLE_MMAP)
+    {
+        uring->sq_ring_size = uring->cq_ring_size
+            = uring->sq_ring_size > uring->cq_ring_size ? uring->sq_ring_size
+                                                        : uring->cq_ring_size;
+    }
+
+    uring->sq_ring = mmap (NULL, uring->sq_ring_size, PROT_READ | PROT_WRITE,
+                           MAP_SHARED | MAP_POPULATE, uring->fd,
+                           IORING_OFF_SQ_RING);
+    if (uring->sq_ring == MAP_FAILED)
+    {
+        return -1;
+    }
+    uring->cq_ring = uring->sq_ring;
+    if (!(params->features & IORING_FEAT_SINGLE_MMAP))
+    {
+        uring->cq_ring = mmap (NULL, uring->cq_ring_size,
+                               PROT_READ | PROT_WRITE,
+                               MAP_SHARED | MAP_POPULATE, uring->fd,
+                               IORING_OFF_CQ_RING);
+        if (uring->cq_ring == MAP_FAILED)
+        {
+            return -1;
+        }
+    }
+    uring->sqes_size = params->sq_entries * sizeof (struct io_uring_sqe);
+    uring->sqes = mmap (NULL, uring->sqes_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, uring->fd,
+                        IORING_OFF_SQES);
+    if (uring->sqes == MAP_FAILED)
+    {
+        return -1;
+    }
+
+    sq = uring->sq_ring;
+    cq = uring->cq_ring;
+    uring->sq_head = (_Atomic uint32_t *)(sq + params->sq_off.head);
+    uring->sq_tail = (_Atomic uint32_t *)(sq + params->sq_off.tail);
+    uring->sq_mask = *(uint32_t *)(sq + params->sq_off.ring_mask);
+    uring->sq_array = (uint32_t *)(sq + params->sq_off.array);
+    uring->cq_head = (_Atomic uint32_t *)(cq + params->cq_off.head);
+    uring->cq_tail = (_Atomic uint32_t *)(cq + params->cq_off.tail);
+    uring->cq_mask = *(uint32_t *)(cq + params->cq_off.ring_mask);
+    uring->cqes = (struct io_uring_cqe *)(cq + params->cq_off.cqes);
+
+    /* Every entry of the queue is submitted in order. */
+
+    for (uint32_t i = 0; i < params->sq_entries; ++i)
+    {
+        uring->sq_array[i] = i;
+    }
+    return 0;
+}
+
+/**
+ * @brief Registers the two socket slots, empty until the sockets are
+ * watched, and the ring of provided receive buffers, which is filled up.
+ * @return 0 on success, -1 otherwise.
+ */
+
+static int
+uring_buffers (struct s_uring *uring)
+{
+    int fds[2] = { -1, -1 };
+    struct io_uring_buf_reg reg = { 0 };
+
+    if (uring_register (uring->fd, IORING_REGISTER_FILES, fds, 2) == -1)
+    {
+        return -1;
+    }
+
+    uring->buffer_size = (sizeof (struct io_uring_recvmsg_out)
+                          + sizeof (struct sockaddr_storage)
+                          + CONTROL_BUFFER_SIZE + g_ping.batch->rcv_size + 63)
+                         & ~(size_t)63;
+    uring->buf_ring_size = URING_BUFFERS * sizeof (struct io_uring_buf);
+    uring->buf_ring = mmap (NULL, uring->buf_ring_size, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (uring->buf_ring == MAP_FAILED
+        || (uring->buffers = malloc (URING_BUFFERS * uring->buffer_size))
+               == NULL)
+    {
+        return -1;
+    }
+
+    reg.ring_addr = (uint64_t)(uintptr_t)uring->buf_ring;
+    reg.ring_entries = URING_BUFFERS;
+    reg.bgid = 0;
+    if (uring_register (uring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) == -1)
+    {
+        return -1;
+    }
+
+    for (uint16_t bid = 0; bid < URING_BUFFERS; ++bid)
+    {
+        uring_recycle (bid);
+    }
+    atomic_store_explicit ((_Atomic uint16_t *)&uring->buf_ring->tail,
+                           uring->buf_tail, memory_order_release);
+
+    uring->recv_msg.msg_namelen = sizeof (struct sockaddr_storage);
+    uring->recv_msg.msg_controllen = CONTROL_BUFFER_SIZE;
+    return 0;
+}
+
+/**
+ * @brief Checks that the kernel takes a multishot recvmsg, which came after
+ * the provided buffer rings. One is armed on a throwaway socket pair and
+ * cancelled at once, both completions are waited for: the recvmsg ends with
+ * -ECANCELED when it was armed and with -EINVAL when it is not supported.
+ * @return 0 if multishot recvmsg is supported, -1 otherwise.
+ */
+
+static int
+uring_probe_recv (struct s_uring *uring)
+{
+    struct io_uring_sqe *sqe;
+    int ret = -1;
+    int fds[2];
+
+    if (socketpair (AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0, fds) == -1)
+    {
+        return -1;
+    }
+
+    sqe = uring_sqe ();
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = fds[0];
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->addr = (uint64_t)(uintptr_t)&uring->recv_msg;
+    sqe->len = 1;
+    sqe->buf_group = 0;
+    sqe->user_data = URING_DATA (URING_PROBE, 0);
+    uring_queue ();
+
+    sqe = uring_sqe ();
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = URING_DATA (URING_PROBE, 0);
+    sqe->user_data = URING_DATA (URING_PROBE, 1);
+    uring_queue ();
+
+    for (uint32_t done = 0; done < 2;)
+    {
+        uint32_t head
+            = atomic_load_explicit (uring->cq_head, memory_order_relaxed);
+        uint32_t tail
+            = atomic_load_explicit (uring->cq_tail, memory_order_acquire);
+
+        if (head == tail)
+        {
+            uring_submit (1);
+            continue;
+        }
+        for (; head != tail; ++head)
+        {
+            const struct io_uring_cqe *cqe
+                = &uring->cqes[head & uring->cq_mask];
+
+            if (cqe->user_data == URING_DATA (URING_PROBE, 0)
+                && !(cqe->flags & IORING_CQE_F_MORE))
+            {
+                ret = cqe->res == -ECANCELED ? 0 : -1;
+                ++done;
+            }
+            else if (cqe->user_data == URING_DATA (URING_PROBE, 1))
+            {
+                ++done;
+            }
+        }
+        atomic_store_explicit (uring->cq_head, head, memory_order_release);
+    }
+
+    close (fds[0]);
+    close (fds[1]);
+    return ret;
+}
+
+/**
+ * @brief Sets up the io_uring instance of the calling context. Its
+ * descriptor is readable as long as completions are pending, the event loop
+ * watches it instead of the sockets.
+ * @return 0 on success, -1 if io_uring or one of the features used, the
+ * provided buffer rings and the multishot recvmsg, is not available, the
+ * socket backend is then used.
+ */
+
+static int
+uring_init ()
+{
+    struct io_uring_params params;
+    struct s_uring *uring;
+
+    if ((uring = calloc (1, sizeof (struct s_uring))) == NULL)
+    {
+        perror ("calloc");
+        release_resources ();
+        exit (EXIT_FAILURE);
+    }
+    g_ping.uring = uring;
+
+    memset (&params, 0, sizeof (params));
+    params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL;
+    params.cq_entries = URING_CQ_ENTRIES;
+
+    if ((uring->fd = uring_setup (URING_ENTRIES, &params)) == -1
+        || !(params.features & IORING_FEAT_NODROP)
+        || uring_map (uring, &params) == -1 || uring_buffers (uring) == -1
+        || uring_probe_recv (uring) == -1)
+    {
+        return -1;
+    }
+
+    ping_event_watch (uring->fd);
+    return 0;
+}
+
+const struct s_io_backend g_io_uring
+    = { "io_uring", uring_init, uring_watch, uring_send, uring_handle,
+        uring_release };
@@ -0,0 +1,269 @@
+#include "ft_ping.h"
+
+static uint32_t
+probe_index (const struct s_probe *probe)
+{
+    return probe->seq & (PROBE_RING_SIZE - 1);
+}
+
+/**
+ * @brief Converts a CLOCK_MONOTONIC time into ticks of the wheel, rounded
+ * up for a deadline so that a probe never expires early, down otherwise.
+ */
+
+static uint64_t
+wheel_ticks (const struct timespec *ts, _Bool round_up)
+{
+    const struct timespec *origin = &g_ping.wheel.origin;
+    int64_t nsec = (int64_t)(ts->tv_sec - origin->tv_sec) * 1000000000
+                   + (ts->tv_nsec - origin->tv_nsec);
+
+    if (nsec <= 0)
+    {
+        return 0;
+    }
+    return ((uint64_t)nsec + (round_up ? WHEEL_TICK_NSEC - 1 : 0))
+           / WHEEL_TICK_NSEC;
+}
+
+/**
+ * @brief Links a probe in the slot its deadline falls in, as seen from the
+ * current tick: level l holds the deadlines less than WHEEL_SLOTS^(l + 1)
+ * ticks away. A deadline beyond the last level is brought back within it,
+ * it is only reached later than asked.
+ */
+
+static void
+wheel_link (struct s_probe *probe)
+{
+    struct s_wheel *wheel = &g_ping.wheel;
+    uint64_t expires = probe->deadline;
+    uint32_t index = probe_index (probe);
+    uint32_t level = 0;
+    uint32_t slot;
+
+    if (expires < wheel->now)
+    {
+        expires = wheel->now;
+    }
+    while (level < WHEEL_LEVELS - 1
+           && expires - wheel->now >= (uint64_t)1
+                                          << (WHEEL_BITS * (level + 1)))
+    {
+        ++level;
+    }
+    if (expires - wheel->now >= (uint64_t)1 << (WHEEL_BITS * WHEEL_LEVELS))
+    {
+        expires = wheel->now + ((uint64_t)1 << (WHEEL_BITS * WHEEL_LEVELS))
+                  - 1;
+    }
+
+    slot = (expires >> (WHEEL_BITS * level)) & (WHEEL_SLOTS - 1);
+    probe->wheel_slot = level * WHEEL_SLOTS + slot;
+    probe->wheel_prev = WHEEL_NONE;
+    probe->wheel_next = wheel->slots[probe->wheel_slot];
+    if (probe->wheel_next != WHEEL_NONE)
+    {
+        g_ping.probes[probe->wheel_next].wheel_prev = index;
+    }
+    wheel->slots[probe->wheel_slot] = index;
+    wheel->occupied[level] |= (uint64_t)1 << slot;
+}
+
+/**
+ * @brief Detaches the whole list of a slot.
+ * @return ring index of its first probe, WHEEL_NONE if it was empty.
+ */
+
+static uint32_t
+wheel_detach (uint32_t level, uint32_t slot)
+{
+    struct s_wheel *wheel = &g_ping.wheel;
+    uint32_t first = wheel->slots[level * WHEEL_SLOTS + slot];
+
+    wheel->slots[level * WHEEL_SLOTS + slot] = WHEEL_NONE;
+    wheel->occupied[level] &= ~((uint64_t)1 << slot);
+    return first;
+}
+
+/**
+ * @brief Moves the probes of a slot one level down or more, now that their
+ * deadline is within reach of the level below.
+ * @return the slot, the level above is cascaded as well when it is 0.
+ */
+
+static uint32_t
+wheel_cascade (uint32_t level)
+{
+    uint32_t slot
+        = (g_ping.wheel.now >> (WHEEL_BITS * level)) & (WHEEL_SLOTS - 1);
+
+    for (uint32_t index = wheel_detach (level, slot), next;
+         index != WHEEL_NONE; index = next)
+    {
+        next = g_ping.probes[index].wheel_next;
+        wheel_link (&g_ping.probes[index]);
+    }
+    return slot;
+}
+
+/**
+ * @brief Starts the wheel of the calling context empty, its ticks count from
+ * now on.
+ */
+
+void
+ping_wheel_init ()
+{
+    struct s_wheel *wheel = &g_ping.wheel;
+
+    clock_gettime (CLOCK_MONOTONIC, &wheel->origin);
+    wheel->now = 0;
+    wheel->count = 0;
+    memset (wheel->occupied, 0, sizeof (wheel->occupied));
+    for (uint32_t i = 0; i < WHEEL_LEVELS * WHEEL_SLOTS; ++i)
+    {
+        wheel->slots[i] = WHEEL_NONE;
+    }
+}
+
+/**
+ * @brief Schedules the loss deadline of a probe just sent.
+ * @param probe outstanding probe
+ * @param deadline CLOCK_MONOTONIC time at which it is declared lost
+ */
+
+void
+ping_wheel_add (struct s_probe *probe, const struct timespec *deadline)
+{
+    probe->deadline = wheel_ticks (deadline, true);
+    wheel_link (probe);
+    ++g_ping.wheel.count;
+}
+
+/**
+ * @brief Cancels the deadline of an answered probe, in constant time.
+ */
+
+void
+ping_wheel_remove (struct s_probe *probe)
+{
+    struct s_wheel *wheel = &g_ping.wheel;
+
+    if (probe->wheel_prev != WHEEL_NONE)
+    {
+        g_ping.probes[probe->wheel_prev].wheel_next = probe->wheel_next;
+    }
+    else if ((wheel->slots[probe->wheel_slot] = probe->wheel_next)
+             == WHEEL_NONE)
+    {
+        wheel->occupied[probe->wheel_slot / WHEEL_SLOTS]
+            &= ~((uint64_t)1 << (probe->wheel_slot % WHEEL_SLOTS));
+    }
+    if (probe->wheel_next != WHEEL_NONE)
+    {
+        g_ping.probes[probe->wheel_next].wheel_prev = probe->wheel_prev;
+    }
+    --wheel->count;
+}
+
+/**
+ * @brief Declares lost every probe whose deadline has passed. The ticks are
+ * processed one at a time up to now, each probe is moved down at most
+ * WHEEL_LEVELS - 1 times before it expires, hence a constant amortized cost
+ * per probe. An empty wheel jumps straight to now.
+ * @param now current CLOCK_MONOTONIC time
+ */
+
+void
+ping_wheel_expire (const struct timespec *now)
+{
+    struct s_wheel *wheel = &g_ping.wheel;
+    uint64_t target = wheel_ticks (now, false);
+
+    for (; wheel->now <= target; ++wheel->now)
+    {
+        uint32_t slot = wheel->now & (WHEEL_SLOTS - 1);
+
+        if (wheel->count == 0)
+        {
+            wheel->now = target + 1;
+            break;
+        }
+
+        if (slot == 0)
+        {
+            for (uint32_t level = 1;
+                 level < WHEEL_LEVELS && wheel_cascade (level) == 0; ++level)
+            {
+            }
+        }
+
+        for (uint32_t index = wheel_detach (0, slot), next;
+             index != WHEEL_NONE; index = next)
+        {
+            next = g_ping.probes[index].wheel_next;
+            --wheel->count;
+            lost_rtt_metrics (&g_ping.probes[index]);
+        }
+    }
+}
+
+/**
+ * @brief Finds the next tick the wheel has something to do at, a deadline
+ * on level 0 or a slot of a higher level to move down. The first occupied
+ * slot of each level is found from its current position with a bit scan.
+ * @param next CLOCK_MONOTONIC time of that tick
+ * @return false if no probe is outstanding.
+ */
+
+_Bool
+ping_wheel_next (struct timespec *next)
+{
+    struct s_wheel *wheel = &g_ping.wheel;
+    uint64_t best = UINT64_MAX;
+    uint64_t nsec;
+
+    if (wheel->count == 0)
+    {
+        return false;
+    }
+
+    for (uint32_t level = 0; level < WHEEL_LEVELS; ++level)
+    {
+        uint32_t shift = WHEEL_BITS * level;
+        uint64_t occupied = wheel->occupied[level];
+        uint64_t base;
+        uint32_t start;
+        uint64_t tick;
+
+        if (occupied == 0)
+        {
+            continue;
+        }
+
+        /* The first slot boundary of the level not processed yet. */
+
+        base = (wheel->now + ((uint64_t)1 << shift) - 1) >> shift;
+        start = base & (WHEEL_SLOTS - 1);
+        if (start != 0)
+        {
+            occupied = occupied >> start | occupied << (WHEEL_SLOTS - start);
+        }
+        tick = (base + __builtin_ctzll (occupied)) << shift;
+        if (tick < best)
+        {
+            best = tick;
+        }
+    }
+
+    nsec = best * WHEEL_TICK_NSEC;
+    next->tv_sec = wheel->origin.tv_sec + nsec / 1000000000;
+    next->tv_nsec = wheel->origin.tv_nsec + nsec % 1000000000;
+    if (next->tv_nsec >= 1000000000)
+    {
+        next->tv_nsec -= 1000000000;
+        ++next->tv_sec;
+    }
+    return true;
+}
@@ -0,0 +1,154 @@
+#include "ft_ping.h"
+
+/**
+ * @brief Entry point of a worker thread. The worker sets up its own context
+ * from the handle given by the main thread and probes its slice of targets
+ * like a single threaded session would.
+ * @param arg worker handle
+ */
+
+static void *
+ping_worker (void *arg)
+{
+    struct s_worker *worker = arg;
+
+    ping_init_g_info ();
+    g_ping.options = worker->options;
+    g_ping.targets = worker->targets;
+    g_ping.nb_targets = worker->nb_targets;
+    g_ping.first_target = worker->first_target;
+    g_ping.info.ident = worker->ident;
+    g_ping.event.stop_fd = worker->stop_fd;
+
+    ping_session_init ();
+    ping_loop ();
+    if (g_ping.options.format != FORMAT_TEXT)
+    {
+        ping_output_lost ();
+    }
+
+    worker->stats = g_ping.stats;
+    worker->exit_code = g_ping.info.exit_code;
+
+    /* The targets and the stop event belong to the main thread, the results
+     * of every target are reported from there. */
+
+    g_ping.targets = NULL;
+    g_ping.nb_targets = 0;
+    g_ping.event.stop_fd = -1;
+    release_resources ();
+    return NULL;
+}
+
+/**
+ * @brief Folds the statistics of a worker into the session wide statistics.
+ * @param worker joined worker
+ */
+
+static void
+merge_worker_stats (const struct s_worker *worker)
+{
+    struct s_stats *stats = &g_ping.stats;
+    const struct s_stats *w = &worker->stats;
+
+    if (w->nb_snd > 0
+        && (stats->nb_snd == 0
+            || timespec_cmp (&w->session_start, &stats->session_start) < 0))
+    {
+        stats->session_start = w->session_start;
+    }
+    if (w->nb_res > 0
+        && (stats->nb_res == 0
+            || timespec_cmp (&w->session_end, &stats->session_end) > 0))
+    {
+        stats->session_end = w->session_end;
+    }
+    stats->nb_snd += w->nb_snd;
+    stats->nb_res += w->nb_res;
+    stats->nb_dup += w->nb_dup;
+    stats->nb_reordered += w->nb_reordered;
+    stats->nb_late += w->nb_late;
+    if (w->reorder_max > stats->reorder_max)
+    {
+        stats->reorder_max = w->reorder_max;
+    }
+    g_ping.info.exit_code |= worker->exit_code;
+}
+
+/**
+ * @brief Splits the targets into contiguous slices, one per worker, and waits
+ * for every worker to be done. Each worker probes through its own raw
+ * sockets and with its own ICMP identifier, the replies are demultiplexed by
+ * the identifier and no state is shared while probing.
+ * SIGINT is blocked in the workers, the main thread catches it and raises
+ * the stop event they are all polling.
+ */
+
+void
+ping_workers_run ()
+{
+    uint32_t nb_workers = g_ping.options.workers;
+    struct s_worker *workers;
+    sigset_t mask, prev;
+    uint32_t first = 0;
+    uint32_t started;
+    int err = 0;
+
+    if ((workers = calloc (nb_workers, sizeof (struct s_worker))) == NULL)
+    {
+        perror ("calloc");
+        release_resources ();
+        exit (EXIT_FAILURE);
+    }
+
+    if ((g_ping.event.stop_fd = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC))
+        == -1)
+    {
+        perror ("eventfd");
+        free (workers);
+        release_resources ();
+        exit (EXIT_FAILURE);
+    }
+
+    sigemptyset (&mask);
+    sigaddset (&mask, SIGINT);
+    sigaddset (&mask, SIGTERM);
+    pthread_sigmask (SIG_BLOCK, &mask, &prev);
+
+    for (started = 0; started < nb_workers; ++started)
+    {
+        struct s_worker *worker = &workers[started];
+
+        worker->options = g_ping.options;
+        worker->targets = &g_ping.targets[first];
+        worker->first_target = first;
+        worker->nb_targets = g_ping.nb_targets / nb_workers
+                             + (started < g_ping.nb_targets % nb_workers);
+        worker->ident = (g_ping.info.ident + started) & 0xFFFF;
+        worker->stop_fd = g_ping.event.stop_fd;
+        first += worker->nb_targets;
+
+        if ((err = pthread_create (&worker->thread, NULL, ping_worker, worker))
+            != 0)
+        {
+            fprintf (stderr, "pthread_create: %s\n", strerror (err));
+            eventfd_write (g_ping.event.stop_fd, 1);
+            break;
+        }
+    }
+
+    pthread_sigmask (SIG_SETMASK, &prev, NULL);
+
+    for (uint32_t i = 0; i < started; ++i)
+    {
+        pthread_join (workers[i].thread, NULL);
+        merge_worker_stats (&workers[i]);
+    }
+    free (workers);
+
+    if (err != 0)
+    {
+        release_resources ();
+        exit (EXIT_FAILURE);
+    }
+}
@@ -0,0 +1,177 @@
+#!/bin/sh
+#
+# Network impairment tests. Two namespaces joined by a veth pair, the
+# requests leave through a tc netem qdisc applying one profile at a time,
+# and the CSV summary of ft_ping must match the profile within tolerance.
+# The peer namespace only runs the kernel echo responder, nothing leaves the
+# box. Needs root, iproute2 and the sch_netem module.
+#
+# Usage: tests/netem.sh [ft_ping]
+# Exits 0 if every profile passed, 1 if one failed, 77 if it cannot run.
+
+FT_PING=$(realpath "${1:-./ft_ping}")
+NS_PING=ftping-test-$$
+NS_PEER=ftping-peer-$$
+ADDR4_PING=10.250.0.1
+ADDR4_PEER=10.250.0.2
+ADDR6_PING=fd00:f7:9::1
+ADDR6_PEER=fd00:f7:9::2
+# Every profile sends COUNT requests, one every INTERVAL seconds.
+COUNT=${COUNT:-1000}
+INTERVAL=0.005
+SEED=1977
+
+failures=0
+seed=
+
+skip ()
+{
+    echo "SKIP: $*"
+    exit 77
+}
+
+teardown ()
+{
+    ip netns del "$NS_PING" 2>/dev/null
+    ip netns del "$NS_PEER" 2>/dev/null
+}
+
+setup ()
+{
+    ip netns add "$NS_PING" || skip "cannot create network namespaces"
+    trap teardown EXIT INT TERM
+    ip netns add "$NS_PEER"
+    ip link add veth-ping netns "$NS_PING" type veth peer name veth-peer \
+        netns "$NS_PEER" || skip "cannot create a veth pair"
+
+    for ns in "$NS_PING" "$NS_PEER"; do
+        ip -n "$ns" link set lo up
+    done
+    ip -n "$NS_PING" addr add "$ADDR4_PING/24" dev veth-ping
+    ip -n "$NS_PEER" addr add "$ADDR4_PEER/24" dev veth-peer
+    ip -n "$NS_PING" addr add "$ADDR6_PING/64" dev veth-ping nodad
+    ip -n "$NS_PEER" addr add "$ADDR6_PEER/64" dev veth-peer nodad
+    ip -n "$NS_PING" link set veth-ping up
+    ip -n "$NS_PEER" link set veth-peer up
+
+    # A datagram ICMP socket is used when the group range allows it.
+    ip netns exec "$NS_PING" sysctl -qw net.ipv4.ping_group_range="0 0"
+
+    ip netns exec "$NS_PING" tc qdisc add dev veth-ping root netem delay 1ms \
+        2>/dev/null || skip "tc netem is not available"
+    # The seed makes the random drops repeatable, older tc lacks it.
+    if ip netns exec "$NS_PING" tc qdisc change dev veth-ping root netem \
+        delay 1ms seed "$SEED" 2>/dev/null; then
+        seed="seed $SEED"
+    fi
+}
+
+# Runs ft_ping under a netem profile and keeps the fields of its summary
+# record: transmitted received loss_pct min avg max mdev p50 p90 p99
+# duplicates reordered reorder_max late. Any further argument is passed on
+# to ft_ping.
+run ()
+{
+    profile=$1
+    addr=$2
+    shift 2
+
+    # shellcheck disable=SC2086
+    ip netns exec "$NS_PING" tc qdisc change dev veth-ping root netem \
+        $profile $seed || return 1
+    summary=$(ip netns exec "$NS_PING" "$FT_PING" -F csv -i "$INTERVAL" \
+        -c "$COUNT" "$@" "$addr" | awk -F, '$1 == "summary" {
+            print $14, $15, $16, $18, $19, $20, $21, $22, $23, $24,
+                $27, $28, $29, $30 }')
+    # shellcheck disable=SC2086
+    set -- $summary
+    transmitted=$1 received=$2 loss=$3 min=$4 avg=$5 max=$6 mdev=$7
+    p50=$8 p90=$9 p99=${10} duplicates=${11} reordered=${12}
+    reorder_max=${13} late=${14}
+}
+
+# check <profile> <field> <value> <lo> <hi>
+check ()
+{
+    if awk -v v="$3" -v lo="$4" -v hi="$5" \
+        'BEGIN { exit !(v != "" && v >= lo && v <= hi) }'; then
+        echo "ok   $1: $2 = $3 in [$4, $5]"
+    else
+        echo "FAIL $1: $2 = $3 not in [$4, $5]"
+        failures=$((failures + 1))
+    fi
+}
+
+[ "$(id -u)" -eq 0 ] || skip "must be run as root"
+[ -x "$FT_PING" ] || skip "$FT_PING is not built"
+command -v tc >/dev/null || skip "tc is not installed"
+setup
+
+# A constant delay shifts the whole distribution, nothing is lost.
+run "delay 20ms" "$ADDR4_PEER"
+check delay transmitted "$transmitted" "$COUNT" "$COUNT"
+check delay loss "$loss" 0 0
+check delay min "$min" 20 20.5
+check delay p50 "$p50" 20 21
+check delay p99 "$p99" 20 22
+
+run "delay 20ms" "$ADDR6_PEER"
+check delay-v6 loss "$loss" 0 0
+check delay-v6 p50 "$p50" 20 21
+
+# Replies captured by the AF_PACKET ring, stamped as they reach the device.
+run "delay 20ms" "$ADDR4_PEER" -I packet
+check delay-packet received "$received" "$COUNT" "$COUNT"
+check delay-packet min "$min" 20 20.5
+check delay-packet p99 "$p99" 20 22
+
+run "delay 20ms" "$ADDR6_PEER" -I packet
+check delay-packet-v6 received "$received" "$COUNT" "$COUNT"
+check delay-packet-v6 p50 "$p50" 20 21
+
+# Normal jitter: the standard deviation is the jitter.
+run "delay 20ms 4ms distribution normal" "$ADDR4_PEER"
+check jitter loss "$loss" 0 0
+check jitter avg "$avg" 19 21
+check jitter mdev "$mdev" 3 5
+check jitter p50 "$p50" 19 21
+check jitter p90 "$p90" 23 27
+
+# Random loss, 3 standard deviations of a binomial over COUNT requests.
+run "delay 5ms loss 10%" "$ADDR4_PEER"
+check loss loss "$loss" 7 13
+check loss received "$received" $((COUNT * 87 / 100)) $((COUNT * 93 / 100))
+
+# Replies slower than the loss deadline are lost, then counted as late. The
+# session ends on the deadline of the last request, the last replies are
+# never seen.
+run "delay 200ms" "$ADDR4_PEER" -W 0.1
+check late received "$received" 0 0
+check late loss "$loss" 100 100
+check late late "$late" $((COUNT * 95 / 100)) "$COUNT"
+
+# Duplicated replies are not counted as replies, but as duplicates.
+run "delay 5ms duplicate 20%" "$ADDR4_PEER"
+check duplicate received "$received" "$COUNT" "$COUNT"
+check duplicate loss "$loss" 0 0
+check duplicate duplicates "$duplicates" $((COUNT * 16 / 100)) \
+    $((COUNT * 24 / 100))
+check duplicate reordered "$reordered" 0 0
+
+# Reordered requests skip the delay, a quarter of them here.
+run "delay 10ms reorder 25%" "$ADDR4_PEER"
+check reorder loss "$loss" 0 0
+check reorder min "$min" 0 1
+check reorder p50 "$p50" 10 11
+check reorder avg "$avg" 6 9
+# An undelayed reply overtakes the delayed ones sent up to 10ms before it.
+check reorder reordered "$reordered" $((COUNT * 15 / 100)) \
+    $((COUNT * 45 / 100))
+check reorder reorder_max "$reorder_max" 1 3
+check reorder duplicates "$duplicates" 0 0
+
+if [ "$failures" -ne 0 ]; then
+    echo "$failures check(s) failed"
+    exit 1
+fi
+echo "all checks passed"
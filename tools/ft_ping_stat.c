@@ -0,0 +1,258 @@
+#include "ft_ping.h"
+
+/* Reader of the -S statistics segments. Nothing is asked to the instances,
+ * their segments are mapped read only and the entries are copied under
+ * their seqlock. */
+
+struct s_segment
+{
+    const char *path;
+    int fd;
+    const struct s_shm_header *header;
+    size_t size;
+};
+
+static void
+show_usage_and_exit (int exit_code)
+{
+    printf ("\
+Usage: ft_ping_stat [OPTION]... FILE...\n\
+Options :\n\
+  -h, --help         display this help and exit\n\
+  -i, --interval     seconds between each refresh, once if not given\n");
+    exit (exit_code);
+}
+
+/**
+ * @brief Maps the segment again if ft_ping grew it past the current mapping.
+ * @return 0 on success, -1 if the file is not a segment.
+ */
+
+static int
+segment_map (struct s_segment *segment)
+{
+    struct stat st;
+
+    if (fstat (segment->fd, &st) == -1
+        || (size_t)st.st_size < sizeof (struct s_shm_header))
+    {
+        return -1;
+    }
+    if ((size_t)st.st_size == segment->size)
+    {
+        return 0;
+    }
+
+    if (segment->header != NULL)
+    {
+        munmap ((void *)segment->header, segment->size);
+    }
+    segment->size = st.st_size;
+    segment->header
+        = mmap (NULL, segment->size, PROT_READ, MAP_SHARED, segment->fd, 0);
+    if (segment->header == MAP_FAILED)
+    {
+        segment->header = NULL;
+        segment->size = 0;
+        return -1;
+    }
+    if (segment->header->magic != SHM_MAGIC
+        || segment->header->version != SHM_VERSION)
+    {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Copies an entry, retried as long as a write was in progress or
+ * happened during the copy, SHM_READ_TRIES times at most.
+ * @return false if no consistent copy could be made.
+ */
+
+static _Bool
+entry_read (const struct s_shm_target *entry, struct s_shm_target *copy)
+{
+    uint64_t seq;
+
+    for (int i = 0; i < SHM_READ_TRIES; ++i)
+    {
+        seq = atomic_load_explicit (&entry->seq, memory_order_acquire);
+        if (!(seq & 1))
+        {
+            memcpy ((char *)copy + sizeof (copy->seq),
+                    (const char *)entry + sizeof (entry->seq),
+                    sizeof (*entry) - sizeof (entry->seq));
+            atomic_thread_fence (memory_order_acquire);
+            if (atomic_load_explicit (&entry->seq, memory_order_relaxed)
+                == seq)
+            {
+                return true;
+            }
+        }
+        sched_yield ();
+    }
+    return false;
+}
+
+static double
+elapsed_sec (const struct timespec *now, const struct timespec *then)
+{
+    return (now->tv_sec - then->tv_sec) + (now->tv_nsec - then->tv_nsec) / 1e9;
+}
+
+static void
+segment_print (struct s_segment *segment, const struct timespec *now)
+{
+    const struct s_shm_header *header;
+    uint32_t nb_targets;
+    uint32_t mapped;
+    uint64_t nb_snd = 0;
+    uint64_t nb_res = 0;
+    _Bool stale;
+
+    if (segment_map (segment) == -1)
+    {
+        printf ("%s: not an ft_ping statistics segment\n", segment->path);
+        return;
+    }
+
+    header = segment->header;
+    nb_targets
+        = atomic_load_explicit (&header->nb_targets, memory_order_acquire);
+    mapped = (segment->size - sizeof (*header)) / sizeof (header->targets[0]);
+    if (nb_targets > mapped)
+    {
+        nb_targets = mapped;
+    }
+
+    stale = kill (header->pid, 0) == -1 && errno == ESRCH;
+    printf ("%s: pid %d, up %.0fs%s\n", segment->path, header->pid,
+            elapsed_sec (now, &header->started), stale ? " (stale)" : "");
+    printf ("%-24s %-16s %8s %8s %6s %9s %9s %9s %9s %9s %6s\n", "target",
+            "address", "sent", "received", "loss", "min", "avg", "max", "mdev",
+            "last", "age");
+
+    for (uint32_t i = 0; i < nb_targets; ++i)
+    {
+        struct s_shm_target entry;
+        double avg = 0;
+        double mdev = 0;
+
+        if (!entry_read (&header->targets[i], &entry))
+        {
+            printf ("%-24s entry %u %s\n", "?", i,
+                    stale ? "left half written by its writer"
+                          : "still being written, skipped");
+            continue;
+        }
+        if (entry.rtt.n > 0)
+        {
+            avg = entry.rtt.mean;
+            mdev = sqrt (entry.rtt.m2 / entry.rtt.n);
+        }
+        printf ("%-24.24s %-16s %8" PRIu64 " %8" PRIu64 " %5.1f%% %9.3f %9.3f "
+                "%9.3f %9.3f %9.3f %5.0fs\n",
+                entry.hostname, entry.ip_addr, entry.nb_snd, entry.nb_res,
+                entry.nb_snd ? 100.0 * (entry.nb_snd - entry.nb_res)
+                                   / entry.nb_snd
+                             : 0.0,
+                entry.rtt.n ? entry.rtt.min : 0.0, avg,
+                entry.rtt.n ? entry.rtt.max : 0.0, mdev, entry.last_rtt,
+                entry.nb_snd ? elapsed_sec (now, &entry.updated) : 0.0);
+        nb_snd += entry.nb_snd;
+        nb_res += entry.nb_res;
+    }
+
+    if (nb_targets > 1)
+    {
+        printf ("%-41s %8" PRIu64 " %8" PRIu64 " %5.1f%%\n", "total", nb_snd,
+                nb_res, nb_snd ? 100.0 * (nb_snd - nb_res) / nb_snd : 0.0);
+    }
+}
+
+int
+main (int argc, char *argv[])
+{
+    static struct option long_options[]
+        = { { "help", no_argument, NULL, 'h' },
+            { "interval", required_argument, NULL, 'i' },
+            { NULL, 0, NULL, 0 } };
+    struct s_segment *segments;
+    double interval = 0;
+    int nb_segments;
+    int opt;
+
+    while ((opt = getopt_long (argc, argv, "hi:", long_options, NULL)) != -1)
+    {
+        if (opt == 'i')
+        {
+            char *endptr;
+
+            interval = strtod (optarg, &endptr);
+            if (!(interval > 0) || *endptr != '\0')
+            {
+                fprintf (stderr, "Invalid interval value: %s\n", optarg);
+                show_usage_and_exit (EXIT_FAILURE);
+            }
+        }
+        else
+        {
+            show_usage_and_exit (opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+    }
+
+    if (optind >= argc)
+    {
+        show_usage_and_exit (EXIT_FAILURE);
+    }
+
+    nb_segments = argc - optind;
+    if ((segments = calloc (nb_segments, sizeof (*segments))) == NULL)
+    {
+        perror ("calloc");
+        exit (EXIT_FAILURE);
+    }
+    for (int i = 0; i < nb_segments; ++i)
+    {
+        segments[i].path = argv[optind + i];
+        if ((segments[i].fd = open (segments[i].path, O_RDONLY | O_CLOEXEC))
+            == -1)
+        {
+            perror (segments[i].path);
+        }
+    }
+
+    do
+    {
+        struct timespec now;
+
+        clock_gettime (CLOCK_MONOTONIC, &now);
+        for (int i = 0; i < nb_segments; ++i)
+        {
+            if (segments[i].fd != -1)
+            {
+                segment_print (&segments[i], &now);
+            }
+        }
+        fflush (stdout);
+        if (interval > 0)
+        {
+            usleep ((useconds_t)(interval * 1e6));
+        }
+    } while (interval > 0);
+
+    for (int i = 0; i < nb_segments; ++i)
+    {
+        if (segments[i].header != NULL)
+        {
+            munmap ((void *)segments[i].header, segments[i].size);
+        }
+        if (segments[i].fd != -1)
+        {
+            close (segments[i].fd);
+        }
+    }
+    free (segments);
+    return EXIT_SUCCESS;
+}